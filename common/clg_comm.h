@@ -17,6 +17,13 @@ enum ActiveMessageIdEnum
 	AMID_SHIPCOMMUNICATION 		= 8
 };
 
+// A crane-agent that hosts several games serves game 'game' on AM types
+// 'amid' + game * CLG_GAME_AMID_STRIDE, game 0 uses the base AM types above.
+#define CLG_GAME_AMID_STRIDE 0x10
+#define CLG_GAME_AMID(amid, game) ((amid) + (game) * CLG_GAME_AMID_STRIDE)
+// Receive callback user pointer that selects game 'game'
+#define CLG_GAME_USER(game) ((void*)(uintptr_t)(game))
+
 /************************************************************
  *	Radio message structures
  ************************************************************/
@@ -53,6 +60,9 @@ typedef struct {
 
 //-------- CRANE MESSAGE STRUCTURES
 
+// Number of rounds of crane moves carried by a crane location message
+#define CRANE_HISTORY_LEN 8
+
 #pragma pack(1)
 typedef struct {
 	uint8_t messageID;
@@ -60,6 +70,12 @@ typedef struct {
 	uint8_t x_coordinate;
 	uint8_t y_coordinate;
 	uint8_t cargoPlaced;
+	uint16_t seq;			// Round of this crane state, counts rounds since the crane started.
+							// Use ntoh16() when receiving, see endianness.h
+	uint8_t historyLen;		// Valid entries in 'history', 0 in responses to CM_CURRENT_LOCATION
+	uint8_t history[CRANE_HISTORY_LEN]; // What the crane did in rounds seq, seq-1, ...: CM_UP, CM_DOWN,
+							// CM_LEFT, CM_RIGHT if it moved, CM_PLACE_CARGO if it placed cargo,
+							// CM_NO_COMMAND if nothing changed. Lets ships rebuild missed rounds.
 } crane_location_msg_t;
 
 #pragma pack(1)
@@ -78,6 +94,20 @@ typedef struct { // Structure for all system queries and welcome message
 	am_addr_t shipAddr; 	// Optional, not used in all queries
 } query_msg_t;
 
+// Ships are listed by registration slot in pages of ROSTER_PAGE_SLOTS slots
+#define ROSTER_PAGE_SLOTS 32
+#define ROSTER_END 0xFFFF	// No page
+
+#pragma pack(1)
+typedef struct { // Structure for paged ship list query, starts like query_msg_t
+	uint8_t messageID; 		// AS_PAGE_QMSG
+	am_addr_t senderAddr;
+	am_addr_t shipAddr; 	// Not used
+	uint16_t cursor;		// Slot to continue from, 0 to start
+	uint16_t since;			// Roster version the requester is up to date with, only pages that
+							// changed after it are sent. 0 for all pages.
+} query_page_msg_t;
+
 #pragma pack(1)
 typedef struct { // Structure for system query and welcome message responses
 	uint8_t messageID; 		// This defines the type of the response
@@ -87,6 +117,9 @@ typedef struct { // Structure for system query and welcome message responses
 	uint8_t x_coordinate; 	// Optional, not used in all responses
 	uint8_t y_coordinate; 	// Optional, not used in all responses
 	uint8_t isCargoLoaded;	// Optional, not used in all responses
+	uint16_t slot;			// Registration slot of the ship, see cargo_map_msg_t. Optional, not used in all responses
+	uint16_t rosterVersion;	// Roster version 'slot' refers to, see roster_page_msg_t. 0 if not used.
+							// Last field, so that decoders unaware of it keep working.
 } query_response_msg_t;
 
 #pragma pack(1)
@@ -96,8 +129,53 @@ typedef struct { // Structure for all ships and all cargo query responses
 	am_addr_t shipAddr;
 	uint8_t len; 			// Number of addresses in 'ships' buffer
 	am_addr_t ships[MAX_SHIPS];
+	uint16_t version;		// List version, changes when the list changes, 0 if not versioned.
+							// Last field, so that decoders unaware of it keep working.
 } query_response_buf_t;
 
+#pragma pack(1)
+typedef struct { // Structure for paged ship list responses
+	uint8_t messageID; 		// AS_PAGE_QRMSG
+	am_addr_t senderAddr;
+	am_addr_t shipAddr;		// Requester
+	uint16_t version;		// Roster version, changes when a ship joins or leaves the game
+	uint16_t firstSlot;		// Slot of ships[0], ROSTER_END if no page changed at or after the cursor
+	uint16_t next;			// Cursor of the next changed page, ROSTER_END if there are no more
+	am_addr_t ships[ROSTER_PAGE_SLOTS]; // Address of the ship in each slot, 0 if the slot is free
+} roster_page_msg_t;
+
+// Cargo map payload space for slot ranges and cargo bits
+#define CARGO_MAP_DATA_SIZE (COMMS_MSG_PAYLOAD_SIZE - 10)
+
+#pragma pack(1)
+typedef struct { // Structure for cargo map responses, refers to ships by registration slot
+	uint8_t messageID; 		// This defines the type of the response
+	am_addr_t senderAddr;
+	am_addr_t shipAddr;		// Requester, AM_BROADCAST_ADDR if answered with a broadcast
+	uint16_t version;		// Map version, changes when a ship registers or gets its cargo
+	uint16_t rosterVersion;	// Roster version the slots refer to, see roster_page_msg_t
+	uint8_t rangeCount;		// Number of occupied slot ranges at the start of 'data'
+	uint8_t data[CARGO_MAP_DATA_SIZE]; // 'rangeCount' times first slot and slot count (uint16_t each, network
+							// byte order), then one cargo bit per occupied slot in range order, LSB first.
+							// Only the used part is sent. If the roster does not fit, the map covers
+							// the lowest slots.
+} cargo_map_msg_t;
+
+// Scoreboard winner addresses per frame
+#define SCOREBOARD_FRAME_SHIPS ((COMMS_MSG_PAYLOAD_SIZE - 11) / sizeof(am_addr_t))
+
+#pragma pack(1)
+typedef struct { // Structure for end of game scoreboard, a frame of the list of ships that got their cargo
+	uint8_t messageID; 		// SCOREBOARD_MSG
+	am_addr_t senderAddr;
+	uint16_t gameSeq;		// Games played by the crane-agent, the one that ended included
+	uint16_t ships;			// Ships that joined the game
+	uint16_t loaded;		// Ships that got their cargo before their loading deadline, all frames together
+	uint8_t first;			// Index of winners[0] in the list of all 'loaded' ships
+	uint8_t len;			// Number of addresses in 'winners', only the used part is sent
+	am_addr_t winners[SCOREBOARD_FRAME_SHIPS];
+} scoreboard_msg_t;
+
 #pragma pack(pop)
 
 #endif // CLG_COMM_H
@@ -11,18 +11,25 @@
 //-------- RADIO MESSAGE IDs
 #define CRANE_COMMAND_MSG 111   //0x6F
 #define CRANE_LOCATION_MSG 112  //0x70
+#define LEAVE_QMSG 113		//0x71          // Ship leaves the game, see DEPART_RMSG
 
+#define AS_PAGE_QMSG 114	//0x72          // Paged query of ship IDs of ships in the game, see query_page_msg_t
 #define WELCOME_MSG 115     //0x73
 #define GTIME_QMSG 116		//0x74          // Global time query message
 #define SHIP_QMSG 117		//0x75          // [ship ID] departure time, location and cargo status query message
 #define AS_QMSG 118			//0x76          // Query of all ship IDs of ships in the game
 #define ACARGO_QMSG 119		//0x77          // Query of cargo status of all ships in the game
+#define CARGO_MAP_QMSG 120	//0x78          // Query of ship slots and cargo status of all ships as a bitmap
 
 #define WELCOME_RMSG 121	//0x79          // Response to welcome message
 #define GTIME_QRMSG 122		//0x7A          // Global time query response message
 #define SHIP_QRMSG 123		//0x7B          // [ship ID] departure time, location and cargo status query response message
 #define AS_QRMSG 124		//0x7C          // Response for query of all ship IDs of ships in the game
 #define ACARGO_QRMSG 125	//0x7D          // Rsponse for query of cargo status of all ships in the game
+#define CARGO_MAP_QRMSG 126	//0x7E          // Response for query of ship slots and cargo status bitmap
+#define AS_PAGE_QRMSG 127	//0x7F          // Response for paged query of ship IDs, see roster_page_msg_t
+#define DEPART_RMSG 128		//0x80          // Broadcast when a ship leaves or its loading deadline passes, its slot is free again
+#define SCOREBOARD_MSG 129	//0x81          // Broadcast when a game ends, see scoreboard_msg_t
 
 //-------- AGENT IDs
 #define	CRANE_ADDR 13        //0x0D
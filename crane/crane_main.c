@@ -58,9 +58,11 @@ INCBIN(Header, "header.bin");
 
 #include "system_state.h"
 #include "crane_state.h"
+#include "latency.h"
 #include "clg_comm.h"
 
 #define M_HEARTBEAT_INTERVAL 60		// Heartbeat interval, seconds
+#define M_LATENCY_DUMP_INTERVAL 60	// Latency histogram dump interval, seconds
 
 static void radio_start_done (comms_layer_t * comms, comms_status_t status, void * user)
 {
@@ -70,7 +72,8 @@ static void radio_start_done (comms_layer_t * comms, comms_status_t status, void
 // Perform basic radio setup
 static comms_layer_t* radio_setup (am_addr_t node_addr)
 {
-    static comms_receiver_t rcvr, rcvr2;
+    static comms_receiver_t rcvr[CLG_MAX_GAMES], rcvr2[CLG_MAX_GAMES];
+    uint8_t game;
     comms_layer_t * radio = radio_init(DEFAULT_RADIO_CHANNEL, 0x22, node_addr);
     if (NULL == radio)
     {
@@ -88,8 +91,11 @@ static comms_layer_t* radio_setup (am_addr_t node_addr)
         osDelay(1);
     }
 
-    comms_register_recv(radio, &rcvr, craneReceiveMessage, NULL, AMID_CRANECOMMUNICATION);
-	comms_register_recv(radio, &rcvr2, systemReceiveMessage, NULL, AMID_SYSTEMCOMMUNICATION);
+    for (game = 0; game < CLG_MAX_GAMES; game++)
+    {
+        comms_register_recv(radio, &rcvr[game], craneReceiveMessage, CLG_GAME_USER(game), CLG_GAME_AMID(AMID_CRANECOMMUNICATION, game));
+        comms_register_recv(radio, &rcvr2[game], systemReceiveMessage, CLG_GAME_USER(game), CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, game));
+    }
 
     debug1("Radio rdy");
     return radio;
@@ -121,8 +127,12 @@ void setup_loop (void * arg)
         for (;;); // Panic
     }
 
-	initCrane(radio, node_addr);
-	initSystem(radio, node_addr);
+	initLatency(M_LATENCY_DUMP_INTERVAL);
+	for (uint8_t game = 0; game < CLG_MAX_GAMES; game++)
+	{
+		initCrane(game, radio, node_addr);
+		initSystem(game, radio, node_addr);
+	}
 
     // Loop forever
     for (;;)
@@ -30,10 +30,24 @@
  * selects a winning command. The winning command is always the most popular 
  * choice, i.e. the command that was requested the most during this round. In
  * case of a tie the winning command is randomly chosen from the two (or more)
- * most popular requests. If no movement commands where received, no winning 
+ * most popular requests (see prng.c). If no movement commands where received, no winning 
  * command is chosen. Then all received commands are erased in preparation for
  * the next update interval.
  * 
+ * Received commands are passed from the radio receive thread to the handler
+ * thread through a single producer, single consumer ring (cmd_ring) that has
+ * room for a vote and a location request from every ship the system module
+ * can hold. The handler drains the ring in batches. Commands that do not fit
+ * are dropped and counted; drops and ring high-water mark are logged and 
+ * reset every round.
+ * 
+ * Votes are tallied as they arrive: every stored command is stamped with the
+ * round (epoch) it belongs to and the per-command counters are updated,
+ * taking back the ship's previous vote of the same round. Closing a round
+ * only takes the counters and starts a new epoch, commands of earlier 
+ * epochs are ignored. Commands that arrive before the new state has been 
+ * broadcast count towards the next round.
+ * 
  * After the winning command is chosen crane changes its state (changes location)
  * according to the command. If the winning command was to place cargo, then 
  * crane places cargo in the current location and the new state reflects the 
@@ -41,6 +55,33 @@
  * (new location and cargo placement status) is then broadcasted to everybody 
  * and receivement of movement commands commences.
  * 
+ * Every state broadcast carries the round sequence number and what the crane
+ * did in the last CRANE_HISTORY_LEN rounds (see crane_location_msg_t in
+ * clg_comm.h). Moves that hit the grid bounds are recorded as no change, so
+ * a ship that missed some broadcasts can walk the history back from the
+ * current location and find every cargo placement it did not hear about.
+ * Responses to CM_CURRENT_LOCATION carry the sequence number but no history,
+ * they do not start a round.
+ * 
+ * Crane location is published as a single packed word (see publishLocation),
+ * so readers (getCraneLocation, location requests) never block. cloc_mutex
+ * only serialises the writers.
+ * 
+ * One crane-agent can host up to CLG_MAX_GAMES independent games. All state
+ * of a game is kept in its own crane_game_t and every game has its own
+ * threads and round timer. Game 'g' is reached through AM types
+ * CLG_GAME_AMID(AMID_CRANECOMMUNICATION, g) (see clg_comm.h), receive 
+ * callbacks are registered with user pointer CLG_GAME_USER(g).
+ * 
+ * The crane only moves while a game is running. The system module starts a
+ * game with initCraneLoc, which puts the crane at a random start location,
+ * and ends it with resetCrane, which drops the stored commands and parks the
+ * crane at DEFAULT_LOC until the next game. Rounds go on in between, so the
+ * round sequence keeps counting over games.
+ * 
+ * Received commands and the outcome of every round are recorded in the event
+ * journal, see journal.c.
+ * 
  * If the crane is asked to exit the game area (see GRID_LOWER_BOUND and
  * GRID_UPPER_BOUND in game_types.h) then crane location is not changed but
  * a new state messages is still broadcast with the last valid location.
@@ -56,7 +97,7 @@
 
 #include "cmsis_os2.h"
 
-#include <stdlib.h>
+#include <string.h>
 
 #include "mist_comm_am.h"
 #include "radio.h"
@@ -66,76 +107,164 @@
 #include "crane_state.h"
 #include "clg_comm.h"
 #include "game_types.h"
+#include "latency.h"
+#include "prng.h"
+#include "journal.h"
 
 #include "loglevels.h"
 #define __MODUUL__ "crane"
 #define __LOG_LEVEL__ (LOG_LEVEL_crane_state & BASE_LOG_LEVEL)
 #include "log.h"
 
-static crane_command_t cmd_buf[MAX_SHIPS]; // Buffer to store received commands
-static crane_location_t cloc;
+typedef struct {
+	crane_command_t cmd;
+	uint32_t epoch; // Round in which the command was received
+} vote_t;
+
+// Random number stream of the crane, the system module uses its own with the same seed
+#define CRANE_PRNG_STREAM 1
 
-static osMutexId_t cmdb_mutex, cloc_mutex;
-static osMessageQueueId_t smsg_qID, rmsg_qID;
-static osThreadId_t snd_task_id;
+// Received command ring size, one slot is always kept empty
+#define CMD_RING_SIZE (2 * SDB_MAX_SHIPS + 1)
 
-static comms_msg_t m_msg;
-static comms_layer_t* cradio;
-static am_addr_t my_address;
+typedef struct {
+	crane_command_msg_t packet;
+	uint32_t rx_time; // Kernel tick count
+} cmd_entry_t;
+
+// Outgoing location message
+typedef struct {
+	crane_location_msg_t packet;
+	lat_stamp_t stamp;
+} location_out_t;
+
+// Crane state of one game
+typedef struct {
+	uint8_t game;
+
+	cmd_entry_t cmd_ring[CMD_RING_SIZE];
+	uint16_t ring_head; // Written by craneReceiveMessage only
+	uint16_t ring_tail; // Written by incomingMsgHandler only
+	uint16_t ring_drops, ring_high_water; // Since start of round
+
+	vote_t cmd_buf[SDB_MAX_SHIPS]; // Buffer to store received commands
+	uint16_t tally[CM_CURRENT_LOCATION]; // Votes per command in current round
+	uint32_t round_epoch;
+	crane_location_t cloc;	// Writer's copy of crane location, protected by cloc_mutex
+	uint32_t cloc_word;		// Published crane location, see publishLocation
+	uint16_t round_seq;		// Rounds since start, written under cloc_mutex
+	uint8_t history[CRANE_HISTORY_LEN]; // Crane state changes, latest round first, protected by cloc_mutex
+	uint8_t history_len;
+	bool idle;				// No game running, crane does not move, protected by cloc_mutex
+	prng_t rng;				// Tie breaks, protected by cloc_mutex
+
+	osMutexId_t cmdb_mutex, cloc_mutex;
+	osMessageQueueId_t smsg_qID;
+	osThreadId_t snd_task_id, rcv_task_id;
+	lat_stamp_t tx_stamp; // Location message being sent
+	uint32_t tx_start;
+
+	comms_msg_t m_msg;
+	comms_layer_t* cradio;
+	am_addr_t my_address;
+} crane_game_t;
+
+static crane_game_t games[CLG_MAX_GAMES];
 
 static void incomingMsgHandler(void *args);
 static void craneMainLoop(void *args);
 static void sendLocationMsg(void *args);
 
-static crane_command_t getWinningCmd();
-static void doCommand(crane_command_t wcmd);
-static uint32_t randomNumber(uint32_t rndL, uint32_t rndH);
+static void publishLocation(crane_game_t* g);
+static crane_location_t readLocation(crane_game_t* g);
+static crane_command_t getWinningCmd(crane_game_t* g);
+static crane_command_t doCommand(crane_game_t* g, crane_command_t wcmd);
+static void recordRound(crane_game_t* g, crane_command_t done);
+static void clearCommands(crane_game_t* g);
 
 /**********************************************************************************************
  *	Initialise module
  **********************************************************************************************/
 
-void initCrane(comms_layer_t* radio, am_addr_t my_addr)
+void initCrane(uint8_t game, comms_layer_t* radio, am_addr_t my_addr)
 {
-	uint8_t i;
+	crane_game_t* g = &games[game];
 
-	cmdb_mutex = osMutexNew(NULL); // Protects received ship command database
-	cloc_mutex = osMutexNew(NULL); // Protects current crane location values
+	g->game = game;
+	g->cmdb_mutex = osMutexNew(NULL); // Protects received ship command database
+	g->cloc_mutex = osMutexNew(NULL); // Serialises crane location writers
 		
-	smsg_qID = osMessageQueueNew(9, sizeof(crane_location_msg_t), NULL);
-	rmsg_qID = osMessageQueueNew(9, sizeof(crane_command_msg_t), NULL);
+	g->smsg_qID = osMessageQueueNew(9, sizeof(location_out_t), NULL);
 	
 	// Initialise buffer
-	while(osMutexAcquire(cmdb_mutex, 1000) != osOK);
-	for(i=0;i<MAX_SHIPS;i++)cmd_buf[i] = CM_NO_COMMAND;
-	osMutexRelease(cmdb_mutex);
+	g->round_epoch = 0;
+	clearCommands(g);
+	journalRecord(game, JOURNAL_START, NULL, 0);
 
-	cradio = radio;
-	my_address = my_addr;
+	g->cradio = radio;
+	g->my_address = my_addr;
 
 	// Crane default location
-	while(osMutexAcquire(cloc_mutex, 1000) != osOK);
-	cloc.crane_y = 0;
-	cloc.crane_x = 0;
-	cloc.cargo_here = false;
-	osMutexRelease(cloc_mutex);
-
-    osThreadNew(incomingMsgHandler, NULL, NULL);	// Handles received messages 
-	osThreadNew(craneMainLoop, NULL, NULL);		// Crane state changes
-	snd_task_id = osThreadNew(sendLocationMsg, NULL, NULL);	// Sends crane location info
-	osThreadFlagsSet(snd_task_id, 0x00000001U); // Sets thread to ready-to-send state
+	while(osMutexAcquire(g->cloc_mutex, 1000) != osOK);
+	g->cloc.crane_y = DEFAULT_LOC;
+	g->cloc.crane_x = DEFAULT_LOC;
+	g->cloc.cargo_here = false;
+	g->round_seq = 0;
+	g->history_len = 0;
+	g->idle = true;
+	publishLocation(g);
+	osMutexRelease(g->cloc_mutex);
+
+    g->rcv_task_id = osThreadNew(incomingMsgHandler, g, NULL);	// Handles received messages 
+	osThreadNew(craneMainLoop, g, NULL);		// Crane state changes
+	g->snd_task_id = osThreadNew(sendLocationMsg, g, NULL);	// Sends crane location info
+	osThreadFlagsSet(g->snd_task_id, 0x00000001U); // Sets thread to ready-to-send state
 }
 
-void initCraneLoc()
+void initCraneLoc(uint8_t game, uint32_t seed)
 {
+	crane_game_t* g = &games[game];
+
 	// Get crane start location
+	while(osMutexAcquire(g->cloc_mutex, 1000) != osOK);
+	prngSeed(&g->rng, seed, CRANE_PRNG_STREAM);
+	g->cloc.crane_y = prngRange(&g->rng, GRID_LOWER_BOUND, GRID_UPPER_BOUND);
+	g->cloc.crane_x = prngRange(&g->rng, GRID_LOWER_BOUND, GRID_UPPER_BOUND);
+	g->cloc.cargo_here = false;
+	g->idle = false;
+	publishLocation(g);
+	osMutexRelease(g->cloc_mutex);
+}
+
+void resetCrane(uint8_t game)
+{
+	crane_game_t* g = &games[game];
+
+	clearCommands(g);
+	while(osMutexAcquire(g->cloc_mutex, 1000) != osOK);
+	g->cloc.crane_y = DEFAULT_LOC;
+	g->cloc.crane_x = DEFAULT_LOC;
+	g->cloc.cargo_here = false;
+	g->history_len = 0;
+	g->idle = true;
+	publishLocation(g);
+	osMutexRelease(g->cloc_mutex);
+}
 
-	while(osMutexAcquire(cloc_mutex, 1000) != osOK)
-	rand(); // TODO rand() always starts with 0, wtf?
-	cloc.crane_y = randomNumber(GRID_LOWER_BOUND, GRID_UPPER_BOUND);
-	cloc.crane_x = randomNumber(GRID_LOWER_BOUND, GRID_UPPER_BOUND);
-	cloc.cargo_here = false;
-	osMutexRelease(cloc_mutex);
+// Drops all stored commands and starts a new epoch, commands already in the ring count towards it.
+static void clearCommands(crane_game_t* g)
+{
+	uint16_t i;
+
+	while(osMutexAcquire(g->cmdb_mutex, 1000) != osOK);
+	for(i=0;i<SDB_MAX_SHIPS;i++)
+	{
+		g->cmd_buf[i].cmd = CM_NO_COMMAND;
+		g->cmd_buf[i].epoch = 0;
+	}
+	for(i=0;i<CM_CURRENT_LOCATION;i++)g->tally[i] = 0;
+	g->round_epoch++;
+	osMutexRelease(g->cmdb_mutex);
 }
 
 /**********************************************************************************************
@@ -144,26 +273,52 @@ void initCraneLoc()
 
 static void craneMainLoop(void *args)
 {
-	crane_command_t wcmd;
-	static crane_location_msg_t sloc;
+	crane_game_t* g = (crane_game_t*)args;
+	crane_command_t wcmd, done;
+	uint16_t drops, high_water;
+	location_out_t sloc;
+	journal_round_t jround;
 	const uint32_t delay_ticks = (uint32_t)CRANE_UPDATE_INTERVAL * osKernelGetTickFreq();
 	for(;;)
 	{
 		osDelay(delay_ticks);
-		wcmd = getWinningCmd();
 
-		while(osMutexAcquire(cloc_mutex, 1000) != osOK);
+		drops = __atomic_exchange_n(&g->ring_drops, 0, __ATOMIC_RELAXED);
+		high_water = __atomic_exchange_n(&g->ring_high_water, 0, __ATOMIC_RELAXED);
+		if(drops > 0)info1("Cmd ring full, dropped %u", drops);
+		debug1("Cmd ring high-water %u/%u", high_water, CMD_RING_SIZE - 1);
+
+		while(osMutexAcquire(g->cloc_mutex, 1000) != osOK);
+		wcmd = getWinningCmd(g);
 		info("Winning cmd %u", wcmd);
-		if(wcmd > 0 && wcmd < CM_CURRENT_LOCATION)doCommand(wcmd);
-		sloc.messageID = CRANE_LOCATION_MSG;
-		sloc.senderAddr = AM_BROADCAST_ADDR; // Piggybacking destination address here
-		sloc.x_coordinate = cloc.crane_x;
-		sloc.y_coordinate = cloc.crane_y;
-		sloc.cargoPlaced = cloc.cargo_here;
-		osMessageQueuePut(smsg_qID, &sloc, 0, 0); 
-		osMutexRelease(cloc_mutex);
+		done = CM_NO_COMMAND;
+		if(wcmd > 0 && wcmd < CM_CURRENT_LOCATION && !g->idle)
+		{
+			done = doCommand(g, wcmd);
+			publishLocation(g);
+		}
+		recordRound(g, done);
+		sloc.packet.messageID = CRANE_LOCATION_MSG;
+		sloc.packet.senderAddr = AM_BROADCAST_ADDR; // Piggybacking destination address here
+		sloc.packet.x_coordinate = g->cloc.crane_x;
+		sloc.packet.y_coordinate = g->cloc.crane_y;
+		sloc.packet.cargoPlaced = g->cloc.cargo_here;
+		sloc.packet.seq = g->round_seq;
+		sloc.packet.historyLen = g->history_len;
+		memcpy(sloc.packet.history, g->history, sizeof(g->history));
+		sloc.stamp.msg_id = CRANE_LOCATION_MSG;
+		sloc.stamp.rx_time = sloc.stamp.dq_time = osKernelGetTickCount(); // Round end
+		osMessageQueuePut(g->smsg_qID, &sloc, 0, 0); 
+		osMutexRelease(g->cloc_mutex);
+
+		jround.seq = hton16(sloc.packet.seq);
+		jround.x = sloc.packet.x_coordinate;
+		jround.y = sloc.packet.y_coordinate;
+		jround.cargo = sloc.packet.cargoPlaced;
+		jround.done = (uint8_t)done;
+		journalRecord(g->game, JOURNAL_ROUND, &jround, sizeof(jround));
 		
-		info1("Crane state %u %u %u", sloc.x_coordinate, sloc.y_coordinate, sloc.cargoPlaced);
+		info1("Game %u crane state %u %u %u %u", g->game, sloc.packet.x_coordinate, sloc.packet.y_coordinate, sloc.packet.cargoPlaced, sloc.packet.seq);
 	}
 }
 
@@ -171,62 +326,108 @@ static void craneMainLoop(void *args)
  *	Message receiving
  **********************************************************************************************/
 
+// Called from the radio receive thread only, the single producer of cmd_ring.
+// 'user' selects the game, see CLG_GAME_USER.
 void craneReceiveMessage (comms_layer_t* comms, const comms_msg_t* msg, void* user)
 {
+	uint16_t head, next, used;
+	uintptr_t game = (uintptr_t)user;
+	crane_game_t* g;
+
+	if(game >= CLG_MAX_GAMES || games[game].rcv_task_id == NULL)return; // No such game
+	g = &games[game];
+
 	if (comms_get_payload_length(comms, msg) == sizeof(crane_command_msg_t))
     {
         crane_command_msg_t * packet = (crane_command_msg_t*)comms_get_payload(comms, msg, sizeof(crane_command_msg_t));
         info1("Rcv cmnd");
-        osStatus_t err = osMessageQueuePut(rmsg_qID, packet, 0, 0);
-		if(err == osOK)debug1("rc query");
-		else debug1("msgq err");
+		journalRecord(g->game, JOURNAL_CRANE_MSG, packet, sizeof(crane_command_msg_t));
+		head = g->ring_head;
+		next = (head + 1) % CMD_RING_SIZE;
+		used = (next + CMD_RING_SIZE - __atomic_load_n(&g->ring_tail, __ATOMIC_ACQUIRE)) % CMD_RING_SIZE;
+		if(used == 0)
+		{
+			__atomic_fetch_add(&g->ring_drops, 1, __ATOMIC_RELAXED);
+			debug1("ring full");
+		}
+		else
+		{
+			g->cmd_ring[head].packet = *packet;
+			g->cmd_ring[head].rx_time = osKernelGetTickCount();
+			__atomic_store_n(&g->ring_head, next, __ATOMIC_RELEASE);
+			if(used > __atomic_load_n(&g->ring_high_water, __ATOMIC_RELAXED))__atomic_store_n(&g->ring_high_water, used, __ATOMIC_RELAXED);
+			osThreadFlagsSet(g->rcv_task_id, 0x00000001U);
+			debug1("rc query");
+		}
     }
     else debug1("rcv size %d", (unsigned int)comms_get_payload_length(comms, msg));
 }
 
 static void incomingMsgHandler(void *args)
 {
-	uint8_t index;
+	crane_game_t* g = (crane_game_t*)args;
+	uint16_t index;
 	crane_command_t cmd;
-	crane_location_msg_t sloc;
+	crane_location_t loc;
+	location_out_t sloc;
 	crane_command_msg_t packet;
+	uint32_t now;
+	uint16_t head, tail = 0;
 
 	for(;;)
 	{
-		osMessageQueueGet(rmsg_qID, &packet, NULL, osWaitForever);
-		if(packet.messageID == CRANE_COMMAND_MSG)
+		osThreadFlagsWait(0x00000001U, osFlagsWaitAny, osWaitForever); // Flags are automatically cleared
+
+		// Drain everything received so far, votes of the batch are tallied under one lock
+		head = __atomic_load_n(&g->ring_head, __ATOMIC_ACQUIRE);
+		if(tail == head)continue;
+		while(osMutexAcquire(g->cmdb_mutex, 1000) != osOK);
+		for(;tail != head;tail = (tail + 1) % CMD_RING_SIZE)
 		{
-			cmd = packet.cmd;
-			if(cmd == CM_CURRENT_LOCATION)
-			{
-				info("Crane command %lu %u", ntoh16(packet.senderAddr), packet.cmd);
-				while(osMutexAcquire(cloc_mutex, 1000) != osOK);
-				sloc.messageID = CRANE_LOCATION_MSG;
-				sloc.senderAddr = ntoh16(packet.senderAddr); // Piggybacking destination address here
-				sloc.x_coordinate = cloc.crane_x;
-				sloc.y_coordinate = cloc.crane_y;
-				sloc.cargoPlaced = cloc.cargo_here;
-				osMutexRelease(cloc_mutex);
-				osMessageQueuePut(smsg_qID, &sloc, 0, 0);
-			}
-			else if(cmd > 0 && cmd < CM_CURRENT_LOCATION)
+			packet = g->cmd_ring[tail].packet;
+			now = osKernelGetTickCount();
+			latencyRecord(packet.messageID, LAT_QUEUE, g->cmd_ring[tail].rx_time, now);
+			__atomic_store_n(&g->ring_tail, (tail + 1) % CMD_RING_SIZE, __ATOMIC_RELEASE);
+			if(packet.messageID == CRANE_COMMAND_MSG)
 			{
-				// Each ship has a designated memory area in the buffer
-				// because if a ship sends multiple commands during a
-				// crane update interval, only the last must be used.
-				index = getIndex(ntoh16(packet.senderAddr));
-				if(index < MAX_SHIPS)
+				cmd = packet.cmd;
+				if(cmd == CM_CURRENT_LOCATION)
 				{
-					while(osMutexAcquire(cmdb_mutex, 1000) != osOK);
-					cmd_buf[index] = cmd;
-					info("Crane command %lu %u", ntoh16(packet.senderAddr), packet.cmd);
-					osMutexRelease(cmdb_mutex);
+					info("Crane command %u %u", ntoh16(packet.senderAddr), packet.cmd);
+					loc = readLocation(g);
+					sloc.packet.messageID = CRANE_LOCATION_MSG;
+					sloc.packet.senderAddr = ntoh16(packet.senderAddr); // Piggybacking destination address here
+					sloc.packet.x_coordinate = loc.crane_x;
+					sloc.packet.y_coordinate = loc.crane_y;
+					sloc.packet.cargoPlaced = loc.cargo_here;
+					sloc.packet.seq = __atomic_load_n(&g->round_seq, __ATOMIC_ACQUIRE); // May lag location by a round
+					sloc.packet.historyLen = 0; // Not a new round
+					sloc.stamp.msg_id = packet.messageID;
+					sloc.stamp.rx_time = g->cmd_ring[tail].rx_time;
+					sloc.stamp.dq_time = now;
+					osMessageQueuePut(g->smsg_qID, &sloc, 0, 0);
 				}
-				else info1("Cmd dropped");// Ship not in game, command dropped
+				else if(cmd > 0 && cmd < CM_CURRENT_LOCATION)
+				{
+					// Each ship has a designated memory area in the buffer
+					// because if a ship sends multiple commands during a
+					// crane update interval, only the last must be used.
+					index = getIndex(g->game, ntoh16(packet.senderAddr)); // Takes sdb_mutex, never held when cmdb_mutex is taken
+					if(index < SDB_MAX_SHIPS)
+					{
+						if(g->cmd_buf[index].epoch == g->round_epoch)g->tally[g->cmd_buf[index].cmd]--; // Ship changes its vote
+						g->cmd_buf[index].cmd = cmd;
+						g->cmd_buf[index].epoch = g->round_epoch;
+						g->tally[cmd]++;
+						info("Crane command %u %u", ntoh16(packet.senderAddr), packet.cmd);
+					}
+					else info1("Cmd dropped");// Ship not in game, command dropped
+				}
+				else if(cmd == CM_NOTHING_TO_DO) ; // This command shouldn't be sent, but no harm done, just ignore
+				else ; // Invalid command, do nothing
 			}
-			else if(cmd == CM_NOTHING_TO_DO) ; // This command shouldn't be sent, but no harm done, just ignore
-			else ; // Invalid command, do nothing
 		}
+		osMutexRelease(g->cmdb_mutex);
 	}
 }
 
@@ -236,28 +437,30 @@ static void incomingMsgHandler(void *args)
 
 static void radioSendDone(comms_layer_t * comms, comms_msg_t * msg, comms_error_t result, void * user)
 {
-	uint8_t i;
+	crane_game_t* g = (crane_game_t*)user;
+	uint32_t now = osKernelGetTickCount();
 
     logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "snt %u", result);
-	while(osMutexAcquire(cmdb_mutex, 1000) != osOK);
-	for(i=0;i<MAX_SHIPS;i++)cmd_buf[i] = CM_NO_COMMAND; // Clearing buffer for next round
-	osMutexRelease(cmdb_mutex);	
-
-	osThreadFlagsSet(snd_task_id, 0x00000001U);
+	latencyRecord(g->tx_stamp.msg_id, LAT_RADIO, g->tx_start, now);
+	latencyRecord(g->tx_stamp.msg_id, LAT_TOTAL, g->tx_stamp.rx_time, now);
+	osThreadFlagsSet(g->snd_task_id, 0x00000001U);
 }
 
 static void sendLocationMsg(void *args)
 {
+	crane_game_t* g = (crane_game_t*)args;
+	location_out_t out;
 	crane_location_msg_t packet;
 
 	for(;;)
 	{
-		osMessageQueueGet(smsg_qID, &packet, NULL, osWaitForever);
+		osMessageQueueGet(g->smsg_qID, &out, NULL, osWaitForever);
+		packet = out.packet;
 
 		osThreadFlagsWait(0x00000001U, osFlagsWaitAny, osWaitForever); // Flags are automatically cleared
 
-		comms_init_message(cradio, &m_msg);
-		crane_location_msg_t * cLMsg = comms_get_payload(cradio, &m_msg, sizeof(crane_location_msg_t));
+		comms_init_message(g->cradio, &g->m_msg);
+		crane_location_msg_t * cLMsg = comms_get_payload(g->cradio, &g->m_msg, sizeof(crane_location_msg_t));
 		if (cLMsg == NULL)
 		{
 			continue ;// Continue for(;;) loop
@@ -268,13 +471,20 @@ static void sendLocationMsg(void *args)
 		cLMsg->x_coordinate = packet.x_coordinate;
 		cLMsg->y_coordinate = packet.y_coordinate;
 		cLMsg->cargoPlaced = packet.cargoPlaced;
+		cLMsg->seq = hton16(packet.seq);
+		cLMsg->historyLen = packet.historyLen;
+		memcpy(cLMsg->history, packet.history, sizeof(cLMsg->history));
 			
 		// Send data packet
-	    comms_set_packet_type(cradio, &m_msg, AMID_CRANECOMMUNICATION);
-	    comms_am_set_destination(cradio, &m_msg, packet.senderAddr);
-	    comms_set_payload_length(cradio, &m_msg, sizeof(crane_location_msg_t));
+	    comms_set_packet_type(g->cradio, &g->m_msg, CLG_GAME_AMID(AMID_CRANECOMMUNICATION, g->game));
+	    comms_am_set_destination(g->cradio, &g->m_msg, packet.senderAddr);
+	    comms_set_payload_length(g->cradio, &g->m_msg, sizeof(crane_location_msg_t));
 
-	    comms_error_t result = comms_send(cradio, &m_msg, radioSendDone, NULL);
+		g->tx_stamp = out.stamp;
+		g->tx_start = osKernelGetTickCount();
+		latencyRecord(g->tx_stamp.msg_id, LAT_SERVICE, g->tx_stamp.dq_time, g->tx_start);
+
+	    comms_error_t result = comms_send(g->cradio, &g->m_msg, radioSendDone, g);
 	    logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "snd %u", result);
 	}
 }
@@ -283,38 +493,54 @@ static void sendLocationMsg(void *args)
  *	Utility functions
  **********************************************************************************************/
 
-loc_bundle_t getCraneLocation ()
+// Does not block, see publishLocation.
+loc_bundle_t getCraneLocation (uint8_t game)
 {
     loc_bundle_t crane_loc;
-    
-	while(osMutexAcquire(cloc_mutex, 1000) != osOK);
-	crane_loc.y = cloc.crane_y;
-	crane_loc.x = cloc.crane_x;
-	osMutexRelease(cloc_mutex);
+	crane_location_t loc = readLocation(&games[game]);
+
+	crane_loc.y = loc.crane_y;
+	crane_loc.x = loc.crane_x;
 	
 	return crane_loc;
 }
 
-static uint8_t getWinningCmd()
+// Publishes writer's copy of crane location to readers. Location is packed
+// into one 32-bit word, so readers always get a consistent location with
+// a single atomic load. Must be called with cloc_mutex held.
+static void publishLocation(crane_game_t* g)
 {
-	uint8_t votes[MAX_SHIPS], i, rnd, mcount, max;
-	crane_command_t wcmd;
-	bool atLeastOne = false;
+	uint32_t word = (uint32_t)g->cloc.crane_x | ((uint32_t)g->cloc.crane_y << 8) | ((uint32_t)g->cloc.cargo_here << 16);
+	__atomic_store_n(&g->cloc_word, word, __ATOMIC_RELEASE);
+}
+
+static crane_location_t readLocation(crane_game_t* g)
+{
+	crane_location_t loc;
+	uint32_t word = __atomic_load_n(&g->cloc_word, __ATOMIC_ACQUIRE);
 
-	for(i=0;i<6;i++)votes[i] = 0;
+	loc.crane_x = (uint8_t)word;
+	loc.crane_y = (uint8_t)(word >> 8);
+	loc.cargo_here = (word >> 16) & 1;
+	return loc;
+}
+
+static crane_command_t getWinningCmd(crane_game_t* g)
+{
+	uint16_t votes[6], i, rnd, mcount, max;
+	crane_command_t wcmd = CM_NO_COMMAND;
+	bool atLeastOne = false;
 
-	// Find most popular command
-	while(osMutexAcquire(cmdb_mutex, 1000) != osOK);
-	for(i=0;i<MAX_SHIPS;i++)
+	// Close the round, commands from now on belong to the next round
+	while(osMutexAcquire(g->cmdb_mutex, 1000) != osOK);
+	for(i=0;i<6;i++)
 	{
-		if(cmd_buf[i] != CM_NO_COMMAND)
-		{
-			votes[(uint8_t)cmd_buf[i]]++;
-			atLeastOne = true;
-		}
-		cmd_buf[i] = CM_NO_COMMAND; // Clear command buffer
+		votes[i] = g->tally[i];
+		g->tally[i] = 0;
+		if(votes[i] > 0)atLeastOne = true;
 	}
-	osMutexRelease(cmdb_mutex);
+	g->round_epoch++;
+	osMutexRelease(g->cmdb_mutex);
 
 	// If no commands from ships don't move
 	if(!atLeastOne)
@@ -337,8 +563,8 @@ static uint8_t getWinningCmd()
 	}
 	if(mcount>1)
 	{
-		// Get random modulo mcount
-		rnd = randomNumber(1, mcount);
+		// Pick one of the mcount commands
+		rnd = prngRange(&g->rng, 1, mcount);
 
 		for(i=1;i<6;i++)if(votes[i] == 1)
 		{
@@ -351,38 +577,42 @@ static uint8_t getWinningCmd()
 	return wcmd;
 }
 
-static void doCommand(crane_command_t wcmd)
+// Returns what the crane did: 'wcmd', or CM_NO_COMMAND if the move would leave the grid.
+static crane_command_t doCommand(crane_game_t* g, crane_command_t wcmd)
 {
-	static am_addr_t saddr;
-	cloc.cargo_here = false;
+	am_addr_t saddr;
+	crane_command_t done = CM_NO_COMMAND;
+	g->cloc.cargo_here = false;
 	switch(wcmd)
 	{
-		case CM_UP: if(cloc.crane_y<GRID_UPPER_BOUND)cloc.crane_y++;
+		case CM_UP: if(g->cloc.crane_y<GRID_UPPER_BOUND){g->cloc.crane_y++;done = wcmd;}
 		break;
-		case CM_DOWN: if(cloc.crane_y>GRID_LOWER_BOUND)cloc.crane_y--;
+		case CM_DOWN: if(g->cloc.crane_y>GRID_LOWER_BOUND){g->cloc.crane_y--;done = wcmd;}
 		break;
-		case CM_LEFT: if(cloc.crane_x>GRID_LOWER_BOUND)cloc.crane_x--;
+		case CM_LEFT: if(g->cloc.crane_x>GRID_LOWER_BOUND){g->cloc.crane_x--;done = wcmd;}
 		break;
-		case CM_RIGHT: if(cloc.crane_x<GRID_UPPER_BOUND)cloc.crane_x++;
+		case CM_RIGHT: if(g->cloc.crane_x<GRID_UPPER_BOUND){g->cloc.crane_x++;done = wcmd;}
 		break;
 		case CM_PLACE_CARGO: 
-			cloc.cargo_here = true;
-			saddr = isShipHere(cloc.crane_x, cloc.crane_y);
-			if(saddr != 0)markCargo(saddr);
-			info1("Cargo placed %lu", saddr);
+			g->cloc.cargo_here = true;
+			done = wcmd;
+			saddr = isShipHere(g->game, g->cloc.crane_x, g->cloc.crane_y);
+			if(saddr != 0)markCargo(g->game, saddr);
+			info1("Game %u cargo placed %u", g->game, saddr);
 		break;
 		default: 
 		break;
 	}
+	return done;
 }
 
-// Random number between rndL and rndH (rndL <= rnd <=rndH)
-// only positive values
-// user must provide correct arguments, such that 0 <= rndL < rndH
-
-static uint32_t randomNumber(uint32_t rndL, uint32_t rndH)
+// Starts a new round in which the crane did 'done'. Must be called with cloc_mutex held.
+static void recordRound(crane_game_t* g, crane_command_t done)
 {
-	uint32_t range = rndH + 1 - rndL;
-	return rand() % range + rndL;
-}
+	uint8_t i;
 
+	for(i=CRANE_HISTORY_LEN-1;i>0;i--)g->history[i] = g->history[i-1];
+	g->history[0] = (uint8_t)done;
+	if(g->history_len < CRANE_HISTORY_LEN)g->history_len++;
+	__atomic_store_n(&g->round_seq, (uint16_t)(g->round_seq + 1), __ATOMIC_RELEASE);
+}
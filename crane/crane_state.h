@@ -15,19 +15,24 @@
  *	Initialise module
  **********************************************************************************************/
 
-void initCrane(comms_layer_t* radio, am_addr_t my_addr);
-void initCraneLoc();
+// Initialises crane of game 'game' (0..CLG_MAX_GAMES-1) and starts its threads.
+void initCrane(uint8_t game, comms_layer_t* radio, am_addr_t my_addr);
+// Picks crane start location with a generator seeded with 'seed', called when the game starts.
+void initCraneLoc(uint8_t game, uint32_t seed);
+// Drops stored commands and parks the crane until the next initCraneLoc, called when the game ends.
+void resetCrane(uint8_t game);
 
 /**********************************************************************************************
  *	Message receiving
  **********************************************************************************************/
 
+// Register for CLG_GAME_AMID(AMID_CRANECOMMUNICATION, game) with user CLG_GAME_USER(game).
 void craneReceiveMessage (comms_layer_t* comms, const comms_msg_t* msg, void* user);
 
 /**********************************************************************************************
  *	Utility functions
  **********************************************************************************************/
 
-loc_bundle_t getCraneLocation();
+loc_bundle_t getCraneLocation(uint8_t game);
 
 #endif //CRANE_STATE_H_
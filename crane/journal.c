@@ -0,0 +1,131 @@
+/**
+ * 
+ * This is the event journal of crane-agent. It records everything the game
+ * engine takes in, i.e. every received crane command and system query with 
+ * the Kernel tick count it arrived at, and the game seeds (see prng.c), and
+ * what came out of it, the crane state of every round and the score of 
+ * every game. Given the seeds and the messages at their ticks the engine
+ * makes the same decisions again, so a recorded game can be replayed and
+ * the outcome of every round compared (see host/replay_main.c).
+ * 
+ * Records are put to a message queue without waiting, so recording never
+ * blocks the radio receive thread. A journal thread takes them from the 
+ * queue and passes them to the sink given to initJournal, which stores 
+ * them, e.g. in a file (see host/journal_file.c). If the queue is full the
+ * record is dropped and counted, the next record that gets through is 
+ * preceded by a JOURNAL_LOST record, so a replay knows it is incomplete.
+ * 
+ * Records are stored in a compact binary format of 7 bytes plus data,
+ * multi-byte values in network byte order (see journalEncode).
+ * 
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#include "cmsis_os2.h"
+
+#include <string.h>
+
+#include "endianness.h"
+
+#include "journal.h"
+
+#include "loglevels.h"
+#define __MODUUL__ "jrnl"
+#define __LOG_LEVEL__ (LOG_LEVEL_journal & BASE_LOG_LEVEL)
+#include "log.h"
+
+// Records waiting for the journal thread
+#ifndef JOURNAL_QUEUE_LEN
+#define JOURNAL_QUEUE_LEN 64
+#endif
+
+static osMessageQueueId_t journal_qID;
+static journal_sink_f* journal_sink;
+static void* journal_user;
+static uint16_t journal_drops;
+
+static void journalLoop(void *args);
+
+/**********************************************************************************************
+ *	Initialise module
+ **********************************************************************************************/
+
+void initJournal(journal_sink_f* sink, void* user)
+{
+	journal_sink = sink;
+	journal_user = user;
+	journal_qID = osMessageQueueNew(JOURNAL_QUEUE_LEN, sizeof(journal_record_t), NULL);
+	osThreadNew(journalLoop, NULL, NULL); // Passes records to sink
+}
+
+static void journalLoop(void *args)
+{
+	journal_record_t rec, lost;
+	uint16_t drops;
+
+	for(;;)
+	{
+		if(osMessageQueueGet(journal_qID, &rec, NULL, osWaitForever) != osOK)continue;
+
+		drops = __atomic_exchange_n(&journal_drops, 0, __ATOMIC_RELAXED);
+		if(drops > 0)
+		{
+			info1("Journal full, dropped %u", drops);
+			lost.tick = rec.tick;
+			lost.game = rec.game;
+			lost.type = JOURNAL_LOST;
+			lost.len = sizeof(uint16_t);
+			lost.data[0] = (uint8_t)(drops >> 8);
+			lost.data[1] = (uint8_t)drops;
+			journal_sink(&lost, journal_user);
+		}
+		journal_sink(&rec, journal_user);
+	}
+}
+
+/**********************************************************************************************
+ *	Utility functions
+ **********************************************************************************************/
+
+void journalRecord(uint8_t game, journal_type_t type, const void* data, uint8_t len)
+{
+	journal_record_t rec;
+
+	if(journal_qID == NULL)return; // Not recording
+
+	if(len > JOURNAL_MAX_DATA)len = JOURNAL_MAX_DATA;
+	rec.tick = osKernelGetTickCount();
+	rec.game = game;
+	rec.type = (uint8_t)type;
+	rec.len = len;
+	memcpy(rec.data, data, len);
+	if(osMessageQueuePut(journal_qID, &rec, 0, 0) != osOK)__atomic_fetch_add(&journal_drops, 1, __ATOMIC_RELAXED);
+}
+
+uint8_t journalEncode(const journal_record_t* rec, uint8_t buf[JOURNAL_RECORD_MAX])
+{
+	uint32_t tick = hton32(rec->tick);
+
+	memcpy(buf, &tick, sizeof(tick));
+	buf[4] = rec->game;
+	buf[5] = rec->type;
+	buf[6] = rec->len;
+	memcpy(&buf[7], rec->data, rec->len);
+	return 7 + rec->len;
+}
+
+uint8_t journalDecode(const uint8_t buf[], size_t len, journal_record_t* rec)
+{
+	uint32_t tick;
+
+	if(len < 7 || buf[6] > JOURNAL_MAX_DATA || len < 7U + buf[6])return 0;
+	memcpy(&tick, buf, sizeof(tick));
+	rec->tick = ntoh32(tick);
+	rec->game = buf[4];
+	rec->type = buf[5];
+	rec->len = buf[6];
+	memcpy(rec->data, &buf[7], rec->len);
+	return 7 + rec->len;
+}
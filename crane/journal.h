@@ -0,0 +1,83 @@
+/**
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Largest record data, longer data is cut
+#define JOURNAL_MAX_DATA 16
+// Largest encoded record, see journalEncode
+#define JOURNAL_RECORD_MAX (7 + JOURNAL_MAX_DATA)
+
+// Record types
+typedef enum {
+	JOURNAL_START = 0,		// Game engine started, no data. Round timer starts here.
+	JOURNAL_SEED,			// Game started, data uint32_t seed, network byte order
+	JOURNAL_CRANE_MSG,		// Received crane message, data is the payload as received
+	JOURNAL_SYSTEM_MSG,		// Received system message, data is the payload as received
+	JOURNAL_ROUND,			// Round outcome, data journal_round_t
+	JOURNAL_LOST,			// Records were dropped before this one, data uint16_t count, network byte order
+	JOURNAL_SCORE			// Game ended, data journal_score_t
+} journal_type_t;
+
+typedef struct {
+	uint32_t tick;			// Kernel tick count
+	uint8_t game;
+	uint8_t type;			// journal_type_t
+	uint8_t len;
+	uint8_t data[JOURNAL_MAX_DATA];
+} journal_record_t;
+
+#pragma pack(1)
+typedef struct {
+	uint16_t seq;			// Network byte order
+	uint8_t x;
+	uint8_t y;
+	uint8_t cargo;			// Cargo placed in this location
+	uint8_t done;			// What the crane did, see crane_location_msg_t history
+} journal_round_t;
+
+typedef struct {
+	uint16_t seq;			// Games played, network byte order
+	uint16_t ships;			// Ships that joined, network byte order
+	uint16_t loaded;		// Ships that got their cargo, network byte order
+} journal_score_t;
+#pragma pack()
+
+// Called from the journal thread for every record, in order of recording
+typedef void journal_sink_f(const journal_record_t* rec, void* user);
+
+/**********************************************************************************************
+ *	Initialise module
+ **********************************************************************************************/
+
+// Starts the journal, records are passed to 'sink'. Must be called before the game
+// modules are initialised. Without it recording does nothing.
+void initJournal(journal_sink_f* sink, void* user);
+
+/**********************************************************************************************
+ *	Utility functions
+ **********************************************************************************************/
+
+// Records 'len' bytes of 'data' as a record of 'type' for game 'game', stamped with the
+// current Kernel tick count. Does not block, can be called from radio callbacks. If the
+// journal can not keep up the record is dropped and counted, see JOURNAL_LOST.
+void journalRecord(uint8_t game, journal_type_t type, const void* data, uint8_t len);
+
+// Writes 'rec' to 'buf' in the stored format: tick (4 bytes, network byte order), game,
+// type, len, data. Returns the number of bytes written.
+uint8_t journalEncode(const journal_record_t* rec, uint8_t buf[JOURNAL_RECORD_MAX]);
+
+// Reads one stored record from 'buf' of 'len' bytes to 'rec'. Returns the number of bytes
+// used or 0 if 'buf' does not hold a whole valid record.
+uint8_t journalDecode(const uint8_t buf[], size_t len, journal_record_t* rec);
+
+#endif//JOURNAL_H_
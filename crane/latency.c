@@ -0,0 +1,126 @@
+/**
+ * 
+ * This is the latency statistics module of crane-agent. It keeps fixed 
+ * bucket latency histograms per received message ID and processing stage
+ * (see lat_stage_t), so that it can be seen where messages spend their time
+ * under load.
+ * 
+ * Bucket k holds latencies below 2^k ms, i.e. the buckets are <1, <2, <4 ...
+ * <1024 ms, the last bucket holds everything longer. Besides the buckets 
+ * every histogram keeps the sample count, sum and maximum.
+ * 
+ * Histograms are updated with atomic operations and never block, so they can
+ * be updated from radio callbacks. They are printed to log every 
+ * dump_interval seconds and can be cleared at any time with latencyReset.
+ * 
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#include "cmsis_os2.h"
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "game_types.h"
+#include "latency.h"
+
+#include "loglevels.h"
+#define __MODUUL__ "lat"
+#define __LOG_LEVEL__ (LOG_LEVEL_latency & BASE_LOG_LEVEL)
+#include "log.h"
+
+// Tracked message IDs, CRANE_COMMAND_MSG ... CARGO_MAP_QMSG
+#define LAT_FIRST_ID CRANE_COMMAND_MSG
+#define LAT_LAST_ID CARGO_MAP_QMSG
+#define LAT_ID_COUNT (LAT_LAST_ID - LAT_FIRST_ID + 1)
+
+#define LAT_BUCKETS 12
+
+typedef struct {
+	uint32_t buckets[LAT_BUCKETS];
+	uint32_t count;
+	uint32_t sum; // ms
+	uint32_t max; // ms
+} lat_hist_t;
+
+static lat_hist_t hist[LAT_ID_COUNT][LAT_STAGE_COUNT];
+static const char* stage_names[LAT_STAGE_COUNT] = {"queue", "service", "radio", "total"};
+static uint32_t dump_ticks;
+
+static void latencyDumpLoop(void *args);
+
+/**********************************************************************************************
+ *	Initialise module
+ **********************************************************************************************/
+
+void initLatency(uint32_t dump_interval)
+{
+	if(dump_interval == 0)return;
+	dump_ticks = dump_interval * osKernelGetTickFreq();
+	osThreadNew(latencyDumpLoop, NULL, NULL); // Prints histograms periodically
+}
+
+static void latencyDumpLoop(void *args)
+{
+	for(;;)
+	{
+		osDelay(dump_ticks);
+		latencyDump();
+	}
+}
+
+/**********************************************************************************************
+ *	Utility functions
+ **********************************************************************************************/
+
+void latencyRecord(uint8_t msg_id, lat_stage_t stage, uint32_t start, uint32_t end)
+{
+	uint8_t b = 0;
+	uint32_t ms, max;
+	lat_hist_t* h;
+
+	if(msg_id < LAT_FIRST_ID || msg_id > LAT_LAST_ID || stage >= LAT_STAGE_COUNT)return;
+	h = &hist[msg_id - LAT_FIRST_ID][stage];
+
+	ms = (uint32_t)((uint64_t)(end - start) * 1000 / osKernelGetTickFreq());
+	while(b < LAT_BUCKETS - 1 && ms >= (1UL << b))b++;
+
+	__atomic_fetch_add(&h->buckets[b], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, ms, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while(ms > max && !__atomic_compare_exchange_n(&h->max, &max, ms, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void latencyReset()
+{
+	uint8_t i, s, b;
+
+	for(i=0;i<LAT_ID_COUNT;i++)for(s=0;s<LAT_STAGE_COUNT;s++)
+	{
+		lat_hist_t* h = &hist[i][s];
+		for(b=0;b<LAT_BUCKETS;b++)__atomic_store_n(&h->buckets[b], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&h->sum, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+	}
+	info1("Latency reset");
+}
+
+void latencyDump()
+{
+	uint8_t i, s;
+	const uint32_t* b;
+
+	for(i=0;i<LAT_ID_COUNT;i++)for(s=0;s<LAT_STAGE_COUNT;s++)
+	{
+		lat_hist_t* h = &hist[i][s];
+		if(h->count == 0)continue;
+		b = h->buckets;
+		info1("Lat %u %s n=%"PRIu32" avg=%"PRIu32" max=%"PRIu32" ms |%"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32,
+			i + LAT_FIRST_ID, stage_names[s], h->count, h->sum / h->count, h->max,
+			b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10], b[11]);
+	}
+}
@@ -0,0 +1,50 @@
+/**
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+// Message processing stages
+typedef enum {
+	LAT_QUEUE = 0,		// Receive to dequeue by handler thread
+	LAT_SERVICE,		// Dequeue to send start of response
+	LAT_RADIO,			// Send start to send done
+	LAT_TOTAL,			// Receive to send done
+	LAT_STAGE_COUNT
+} lat_stage_t;
+
+// Timestamps of a message that is being processed, Kernel tick count
+typedef struct {
+	uint8_t msg_id;
+	uint32_t rx_time;
+	uint32_t dq_time;
+} lat_stamp_t;
+
+/**********************************************************************************************
+ *	Initialise module
+ **********************************************************************************************/
+
+// Starts periodic histogram dump every 'dump_interval' seconds, 0 disables the dump.
+void initLatency(uint32_t dump_interval);
+
+/**********************************************************************************************
+ *	Utility functions
+ **********************************************************************************************/
+
+// Adds time from 'start' to 'end' (Kernel tick count) to the 'stage' histogram of message ID 'msg_id'.
+// Does not block, can be called from any thread.
+void latencyRecord(uint8_t msg_id, lat_stage_t stage, uint32_t start, uint32_t end);
+
+// Clears all histograms. Does not block, can be called from any thread.
+void latencyReset();
+
+// Prints all non-empty histograms to log.
+void latencyDump();
+
+#endif//LATENCY_H_
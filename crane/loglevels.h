@@ -4,5 +4,7 @@
 #define LOG_LEVEL_crane_main 			(LOG_INFO1 + LOG_DEBUG1)
 #define LOG_LEVEL_crane_state 			(LOG_INFO1 + LOG_DEBUG1)
 #define LOG_LEVEL_system_state			(LOG_INFO1 + LOG_DEBUG1)
+#define LOG_LEVEL_latency				(LOG_INFO1 + LOG_DEBUG1)
+#define LOG_LEVEL_journal				(LOG_INFO1 + LOG_DEBUG1)
 
 #endif//LOGLEVELS_H_
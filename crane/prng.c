@@ -0,0 +1,69 @@
+/**
+ * 
+ * This is the pseudo random number generator of crane-agent, PCG32 
+ * (XSH RR 64/32, see https://www.pcg-random.org). It replaces rand() so 
+ * that every game has its own generator, seeded explicitly, and a game 
+ * played with the same seed makes the same random choices (crane start 
+ * location, game length, ship placement and deadlines, tie breaks).
+ * 
+ * Bounded numbers are drawn with the multiply-shift method (D. Lemire, 
+ * "Fast Random Integer Generation in an Interval", 2019): the 32 bit random
+ * number is multiplied by the size of the range and the high word is the 
+ * result. Draws from the low end, that would make some values more likely
+ * than others, are rejected. The division needed to find them is only done
+ * when the low word is below the range size, i.e. almost never for the 
+ * small ranges of the game, so unlike rand() % range no division is needed
+ * in the common case.
+ * 
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#include "prng.h"
+
+#define PRNG_MULTIPLIER 6364136223846793005ULL
+
+/**********************************************************************************************
+ *	Initialise module
+ **********************************************************************************************/
+
+void prngSeed(prng_t* rng, uint64_t seed, uint64_t stream)
+{
+	rng->state = 0;
+	rng->inc = (stream << 1) | 1;
+	prngNext(rng);
+	rng->state += seed;
+	prngNext(rng);
+}
+
+/**********************************************************************************************
+ *	Utility functions
+ **********************************************************************************************/
+
+uint32_t prngNext(prng_t* rng)
+{
+	uint64_t old = rng->state;
+	uint32_t xorshifted, rot;
+
+	rng->state = old * PRNG_MULTIPLIER + rng->inc;
+	xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+	rot = (uint32_t)(old >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+uint32_t prngRange(prng_t* rng, uint32_t low, uint32_t high)
+{
+	uint32_t range = high - low + 1;
+	uint64_t m;
+
+	if(range == 0)return prngNext(rng); // Full 32 bit range
+
+	m = (uint64_t)prngNext(rng) * range;
+	if((uint32_t)m < range)
+	{
+		uint32_t threshold = -range % range; // 2^32 % range
+		while((uint32_t)m < threshold)m = (uint64_t)prngNext(rng) * range;
+	}
+	return low + (uint32_t)(m >> 32);
+}
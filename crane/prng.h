@@ -0,0 +1,38 @@
+/**
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef PRNG_H_
+#define PRNG_H_
+
+#include <stdint.h>
+
+// Generator state, see prng.c. Not thread safe, every user keeps its own.
+typedef struct {
+	uint64_t state;
+	uint64_t inc;	// Stream selector, always odd
+} prng_t;
+
+/**********************************************************************************************
+ *	Initialise module
+ **********************************************************************************************/
+
+// Seeds 'rng' with 'seed'. Generators with the same seed but different 'stream' produce
+// independent sequences.
+void prngSeed(prng_t* rng, uint64_t seed, uint64_t stream);
+
+/**********************************************************************************************
+ *	Utility functions
+ **********************************************************************************************/
+
+// Returns next 32 bit random number.
+uint32_t prngNext(prng_t* rng);
+
+// Returns random number between 'low' and 'high' (low <= rnd <= high), every value
+// being equally likely. User must provide correct arguments, such that low <= high.
+uint32_t prngRange(prng_t* rng, uint32_t low, uint32_t high);
+
+#endif//PRNG_H_
@@ -16,10 +16,14 @@
  * 		-ship data
  * 		-ships in game
  * 		-all ships with cargo
+ * - retire ships whose loading deadline has passed or that leave the game
+ * - end the game, announce its score and start the next one
  * 
- * The first radio message to arrive triggers random number generator
- * initialisation (seed) and also starts the game (starts game time 
- * count). Ships enter the game by sending a welcome message. When a 
+ * The first radio message to arrive starts the game (starts game time 
+ * count) and seeds the random number generators of the game (see prng.c)
+ * with the seed given with setGameSeed or, if none was given, with the 
+ * Kernel tick count. The seed is logged, a game can be replayed by giving
+ * the same seed again. Ships enter the game by sending a welcome message. When a 
  * welcome message is received, the ship is registered and its 
  * location coordinates and cargo loading deadline is randomly chosen. 
  * The ship is then informed of registration with a welcome response 
@@ -29,11 +33,94 @@
  * See clg_comm.h about message structures and game_types.h about 
  * default initial values and message identifiers.
  * 
+ * The ship database is laid out as parallel arrays (address, location,
+ * deadline) indexed by slot, and two bitsets: slots in use and ships that
+ * have their cargo. Scans over the roster (ship lists, cargo map, free slot
+ * search) walk the bitsets a word at a time and jump from one set bit to the
+ * next with count trailing zeros, so their cost follows the number of ships
+ * in the game and not the database size.
+ * 
+ * Ships are looked up through two indexes kept next to the ship database,
+ * so that the cost of a lookup does not depend on the number of ships:
+ * 
+ * - an open addressing hash table (linear probing) from ship address to
+ *   database slot
+ * - a grid cell occupancy map from location to database slot
+ * 
+ * A free slot is the lowest clear bit of the slots in use bitset. Both 
+ * indexes are protected by sdb_mutex together with the database itself.
+ * 
+ * A ship departs when its loading deadline (ltime) passes or when it sends
+ * LEAVE_QMSG. Its slot, grid cell and address index entry are freed (the
+ * address index deletes by shifting later entries of the probe sequence 
+ * back), the roster changes and the departure is broadcast with 
+ * DEPART_RMSG, telling whether the ship got its cargo. Deadlines are kept
+ * in a binary min-heap of slots, so the next deadline is always at the top
+ * and a ship is added or removed in O(log n). The message handler thread
+ * waits for queries no longer than until the next deadline and retires 
+ * the expired ships when it wakes up.
+ * 
+ * New ships are placed in a free grid cell at Manhattan distance 
+ * SHIP_MIN_DIST..SHIP_MAX_DIST from the crane. The free cells of this 
+ * annulus are kept in an array, from which a random cell is picked and 
+ * removed in constant time. The array is rebuilt when the crane has moved
+ * since it was last built, i.e. at most once per crane update interval.
+ * If the annulus is full, the ship is refused immediately.
+ * 
+ * Responses are queued per class (welcome responses, ship and time query
+ * responses, ship list responses) and sent by one thread from a pool of
+ * SYS_TX_POOL_SIZE message buffers, so several responses can be in flight
+ * at once. The send thread serves the class queues in weighted round robin
+ * order (see class_weight), so no class can starve the others.
+ * 
+ * Ship list responses (AS_QRMSG, ACARGO_QRMSG) are kept as ready made, 
+ * network byte order images with a version number. A list is marked stale
+ * and its version changes when a ship registers or gets its cargo; the
+ * image is rebuilt on the first request after that. Requests for the same
+ * list that arrive within LIST_REQUEST_WINDOW of the first one are 
+ * answered together: with a unicast if there was one requester, with one
+ * broadcast (shipAddr AM_BROADCAST_ADDR) otherwise.
+ * 
+ * A ship list holds at most MAX_SHIPS addresses. For large fleets the cargo
+ * map (CARGO_MAP_QRMSG) refers to ships by registration slot, i.e. database
+ * index, which is given in WELCOME_RMSG and SHIP_QRMSG. It lists the
+ * occupied slot ranges and one cargo bit per occupied slot, one frame
+ * covers up to about 900 ships. Slots are handed out lowest first, so the
+ * roster is usually a single range. The map is cached like the ship lists
+ * and changes whenever either of them does. As slots are given out again
+ * after departures, the map and the responses that give a slot carry the
+ * roster version the slots refer to.
+ * 
+ * The roster can also be read in pages of ROSTER_PAGE_SLOTS slots 
+ * (AS_PAGE_QMSG). Every page remembers the roster version (the version of
+ * the all ships list) of its last change. A paged query carries a cursor
+ * and the roster version the ship is up to date with, and is answered with
+ * the first page at or after the cursor that changed since, together with
+ * the cursor of the next such page. A ship that keeps up with the roster
+ * only fetches the pages that changed.
+ * 
+ * Received queries and the game seed are recorded in the event journal, see
+ * journal.c.
+ * 
+ * The first game starts on the first query received. When its global 
+ * loading deadline passes, the last ships have departed (their deadlines 
+ * are never later) and the game ends: the scoreboard, the ships that got 
+ * their cargo before their loading deadline, is logged, recorded in the 
+ * journal and broadcast in SCOREBOARD_MSG frames, the ship database is 
+ * emptied and the crane is reset (see resetCrane). After a lobby of 
+ * GAME_LOBBY_TIME, in which no ships are registered, the next game starts 
+ * with a seed drawn from the generator of the last one, so a series of 
+ * games is given by the first seed. Ships that want to play again send a
+ * new WELCOME_MSG.
+ * 
+ * All of the above is kept per game in a system_game_t, one crane-agent can
+ * host up to CLG_MAX_GAMES independent games (see crane_state.c). Each game
+ * has its own threads.
+ * 
  * TODO CRANE_ADDR and SYSYEM_ADDR are still used to identify crane-agent. This
  * 		however does not solve crane-agent identity theft and impersonation problem
  * 		so in this regard it is redundant. Suggested for removal.
  * 
- * TODO Mechanism to leave the game.
  * TODO get rid of magic numbers.
  * 
  * Copyright Proactivity Lab 2020
@@ -44,6 +131,9 @@
 #include "cmsis_os2.h"
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
 
 #include "mist_comm_am.h"
 #include "radio.h"
@@ -53,111 +143,320 @@
 #include "crane_state.h"
 #include "clg_comm.h"
 #include "game_types.h"
+#include "latency.h"
+#include "prng.h"
+#include "journal.h"
 
 #include "loglevels.h"
 #define __MODUUL__ "csys"
 #define __LOG_LEVEL__ (LOG_LEVEL_system_state & BASE_LOG_LEVEL)
 #include "log.h"
 
-// Global cargo loading deadline expressed as Kernel tick count, i.e. game end time
-static uint32_t global_load_deadline;
-
-static sdb_t ship_db[MAX_SHIPS];
-static bool first_msg = true;
-
-static comms_msg_t msg;
-static comms_layer_t* sradio;
-static am_addr_t my_address;
+// New ship distance from crane, Manhattan distance
+#define SHIP_MIN_DIST 10
+#define SHIP_MAX_DIST 25
+// Number of cells in the new ship annulus, if not cut by grid bounds
+#define ANNULUS_SIZE (2 * (SHIP_MIN_DIST + SHIP_MAX_DIST) * (SHIP_MAX_DIST - SHIP_MIN_DIST + 1))
+
+// Random number stream of the system module, see initCraneLoc about the crane stream
+#define SYS_PRNG_STREAM 0
+
+// Address index size, kept at load factor <= 0.5
+#define SDB_HASH_SIZE (2 * SDB_MAX_SHIPS + 1)
+
+// Ship database bitsets
+typedef uint32_t sdb_word_t;
+#define SDB_WORD_BITS 32
+#define SDB_WORDS ((SDB_MAX_SHIPS + SDB_WORD_BITS - 1) / SDB_WORD_BITS)
+
+// Ship database, one entry per slot in every array
+typedef struct {
+	am_addr_t addr[SDB_MAX_SHIPS];
+	uint8_t x[SDB_MAX_SHIPS];
+	uint8_t y[SDB_MAX_SHIPS];
+	uint32_t ltime[SDB_MAX_SHIPS];		// Cargo loading deadline expressed as Kernel tick count
+	sdb_word_t in_game[SDB_WORDS];		// Slot is in use
+	sdb_word_t cargo[SDB_WORDS];		// Ship has its cargo, only set for slots in use
+} ship_table_t;
+
+// Response transmit buffers
+#define SYS_TX_POOL_SIZE 4
+// Response classes, in order of service
+enum {
+	TX_CLASS_WELCOME = 0,
+	TX_CLASS_QUERY,
+	TX_CLASS_LIST,
+	TX_CLASS_COUNT
+};
+// Responses sent from one class before moving to the next one
+static const uint8_t class_weight[TX_CLASS_COUNT] = {4, 2, 1};
+#define RESPONSE_QUEUED_FLAG 0x00000001U
+
+#define GAME_LOBBY_TIME 10UL	// Time between games, seconds
+// Scoreboard length, cargo is placed at most once a round and a game lasts at most
+// 3 * (GRID_UPPER_BOUND - GRID_LOWER_BOUND) rounds, see initGame
+#define SCORE_MAX_SHIPS (3 * (GRID_UPPER_BOUND - GRID_LOWER_BOUND) + 1)
+
+// Game lifecycle, see advanceGame
+enum {
+	GAME_WAITING = 0,	// For the first query
+	GAME_RUNNING,
+	GAME_LOBBY			// Between games
+};
+
+// Roster pages, see roster_page_msg_t
+#define ROSTER_PAGES ((SDB_MAX_SHIPS + ROSTER_PAGE_SLOTS - 1) / ROSTER_PAGE_SLOTS)
+
+// Ship list responses
+#define LIST_REQUEST_WINDOW 100UL	// Time to collect requests for the same list, ms
+enum {
+	LIST_ALL_SHIPS = 0,	// AS_QRMSG
+	LIST_ALL_CARGO,		// ACARGO_QRMSG
+	LIST_CARGO_MAP,		// CARGO_MAP_QRMSG
+	LIST_COUNT
+};
+
+// Both start with messageID, senderAddr and shipAddr
+typedef union {
+	query_response_buf_t list;	// LIST_ALL_SHIPS, LIST_ALL_CARGO
+	cargo_map_msg_t map;		// LIST_CARGO_MAP
+	roster_page_msg_t page;		// Paged roster, not cached
+	scoreboard_msg_t score;		// Scoreboard frame, not cached
+} list_image_t;
+
+typedef struct {
+	list_image_t image;			// Network byte order, shipAddr is set when sent
+	uint8_t len;				// Payload length of image
+	bool stale;					// Ship database changed since image was built
+	uint16_t version;
+	uint16_t requests;			// Requests in current window
+	am_addr_t requester;		// First requester in current window
+	uint32_t window_end;		// Kernel tick count
+	lat_stamp_t stamp;			// First request in current window
+} list_cache_t;
+
+typedef struct {
+	am_addr_t dest;
+	list_image_t image;	// Network byte order
+	uint8_t len;
+	lat_stamp_t stamp;
+} list_response_t;
 
-static osMutexId_t sdb_mutex;
-static osMessageQueueId_t rcv_msg_qID, snd_msg_qID, snd_buf_qID;
-static osEventFlagsId_t snd_event_id;
+typedef struct {
+	query_response_msg_t packet;
+	lat_stamp_t stamp;
+} query_response_t;
+
+typedef struct {
+	query_page_msg_t packet; // Shorter queries leave cursor and since 0
+	uint32_t rx_time; // Kernel tick count
+} query_entry_t;
+
+// System state of one game
+typedef struct {
+	uint8_t game;
+	bool seed_given;
+	uint32_t seed;
+	prng_t rng;		// Used by incomingMsgHandler only
+	uint32_t global_load_deadline; // Global cargo loading deadline expressed as Kernel tick count, i.e. game end time
+
+	// Game lifecycle, used by incomingMsgHandler only
+	uint8_t phase;
+	uint16_t game_seq;		// Games started
+	uint32_t lobby_end;		// Kernel tick count
+	uint16_t score_ships;	// Ships that joined the current game, protected by sdb_mutex
+	uint8_t score_len;		// Ships that departed with cargo, protected by sdb_mutex
+	am_addr_t score[SCORE_MAX_SHIPS];
+
+	ship_table_t sdb;
+	uint16_t sdb_hash[SDB_HASH_SIZE];	// Ship address -> sdb slot, SDB_MAX_SHIPS if empty
+	uint16_t sdb_grid[GRID_UPPER_BOUND + 1][GRID_UPPER_BOUND + 1];	// Location -> sdb slot, SDB_MAX_SHIPS if empty
+	uint16_t dl_heap[SDB_MAX_SHIPS];	// Slots in game, min-heap on ltime
+	uint16_t dl_pos[SDB_MAX_SHIPS];		// Slot -> position in dl_heap
+	uint16_t dl_count;
+	loc_bundle_t annulus_cells[ANNULUS_SIZE];	// Free cells around annulus_center
+	uint16_t annulus_count;
+	loc_bundle_t annulus_center;
+	bool annulus_valid;
+
+	list_cache_t list_cache[LIST_COUNT]; // Image and version protected by sdb_mutex
+	uint16_t page_version[ROSTER_PAGES]; // Roster version of last change of each page, 0 if never, protected by sdb_mutex
+
+	comms_msg_t tx_pool[SYS_TX_POOL_SIZE];
+	lat_stamp_t tx_stamp[SYS_TX_POOL_SIZE];	// Message being sent from each buffer
+	uint32_t tx_start[SYS_TX_POOL_SIZE];
+	uint8_t tx_class, tx_credit;	// Weighted round robin state, see nextTxClass
+	comms_layer_t* sradio;
+	am_addr_t my_address;
+
+	osMutexId_t sdb_mutex;
+	osMessageQueueId_t rcv_msg_qID, tx_free_qID;
+	osMessageQueueId_t tx_class_qID[TX_CLASS_COUNT];
+	osEventFlagsId_t snd_event_id;
+	osThreadId_t rcv_task_id;
+} system_game_t;
+
+static system_game_t games[CLG_MAX_GAMES];
 
 static void incomingMsgHandler(void *arg);
-static void sendResponseMsg(void *arg);
-static void sendResponseBuf(void *arg);
-
-static uint8_t registerNewShip(am_addr_t shipAddr);
-static void genNewCoordinates(uint8_t index);
-static void genLoadTime(uint8_t index);
-static uint8_t getEmptySlot();
-static uint8_t getAllShips(am_addr_t buf[], uint8_t len);
-static uint8_t getAllCargo(am_addr_t buf[], uint8_t len);
-static uint32_t randomNumber(uint32_t rndL, uint32_t rndH);
-static uint32_t distToCrane(uint32_t x, uint32_t y);
+static void sendResponses(void *arg);
+static void queueResponse(system_game_t* g, uint8_t tx_class, const void* packet);
+static void queueQueryResponse(system_game_t* g, uint8_t tx_class, const query_response_msg_t* packet, const lat_stamp_t* stamp);
+static void requestList(system_game_t* g, uint8_t list, am_addr_t requester, const lat_stamp_t* stamp);
+static uint32_t sendDueLists(system_game_t* g);
+static void listChanged(system_game_t* g, uint8_t list);
+static void rebuildCargoMap(system_game_t* g, list_cache_t* c);
+static void rosterChanged(system_game_t* g, uint16_t index);
+static void buildRosterPage(system_game_t* g, roster_page_msg_t* page, uint16_t cursor, uint16_t since);
+
+static void initGame(system_game_t* g);
+static uint32_t advanceGame(system_game_t* g);
+static void endGame(system_game_t* g);
+static void resetShips(system_game_t* g);
+static uint16_t registerNewShip(system_game_t* g, am_addr_t shipAddr);
+static void departShip(system_game_t* g, uint16_t index, const lat_stamp_t* stamp);
+static uint32_t retireExpired(system_game_t* g);
+static void deadlineAdd(system_game_t* g, uint16_t index);
+static void deadlineRemove(system_game_t* g, uint16_t index);
+static void deadlineSift(system_game_t* g, uint16_t pos);
+static bool genNewCoordinates(system_game_t* g, uint16_t index);
+static void buildAnnulus(system_game_t* g, loc_bundle_t center);
+static void genLoadTime(system_game_t* g, uint16_t index);
+static uint16_t getEmptySlot(system_game_t* g);
+static uint16_t hashHome(am_addr_t addr);
+static uint16_t hashSlot(system_game_t* g, am_addr_t addr);
+static void addToIndex(system_game_t* g, uint16_t index);
+static void removeFromIndex(system_game_t* g, uint16_t index);
+static bool testBit(const sdb_word_t set[], uint16_t i);
+static void setBit(sdb_word_t set[], uint16_t i);
+static void clearBit(sdb_word_t set[], uint16_t i);
+static uint8_t getShipsIn(system_game_t* g, const sdb_word_t set[], am_addr_t buf[], uint8_t len);
+static uint8_t getAllShips(system_game_t* g, am_addr_t buf[], uint8_t len);
+static uint8_t getAllCargo(system_game_t* g, am_addr_t buf[], uint8_t len);
+static uint32_t distToCrane(system_game_t* g, uint32_t x, uint32_t y);
 
 /**********************************************************************************************
  *	Initialise module
  **********************************************************************************************/
 
-static void initGame()
+static void initGame(system_game_t* g)
 {
-    static uint32_t max_dist, min_g_time, max_g_time, game_duration;
+    uint32_t max_dist, min_g_time, max_g_time, game_duration, jseed;
     
-	srand(osKernelGetTickCount()); // Initialise random number generator
+	if(g->game_seq > 0)g->seed = prngNext(&g->rng); // Follows from the seed of the first game
+	else if(!g->seed_given)g->seed = osKernelGetTickCount();
+	g->game_seq++;
+	g->phase = GAME_RUNNING;
+	g->score_ships = g->score_len = 0; // Only this thread writes, no need to lock
+	info1("Game %u #%u seed %"PRIu32, g->game, g->game_seq, g->seed);
+	jseed = hton32(g->seed);
+	journalRecord(g->game, JOURNAL_SEED, &jseed, sizeof(jseed));
+	prngSeed(&g->rng, g->seed, SYS_PRNG_STREAM);
 	
-	initCraneLoc(); // Crane location
+	initCraneLoc(g->game, g->seed); // Crane location
 	
 	max_dist = GRID_UPPER_BOUND - GRID_LOWER_BOUND;
 	min_g_time = 2 * max_dist * CRANE_UPDATE_INTERVAL; //TODO magic numbers!
 	max_g_time = 3 * max_dist * CRANE_UPDATE_INTERVAL; //TODO magic numbers!
-	game_duration = randomNumber(min_g_time, max_g_time);
-	global_load_deadline = osKernelGetTickCount() + game_duration * osKernelGetTickFreq();
-	info1("Game time: %lu s", (uint32_t)((global_load_deadline - osKernelGetTickCount()) / osKernelGetTickFreq()));
+	game_duration = prngRange(&g->rng, min_g_time, max_g_time);
+	g->global_load_deadline = osKernelGetTickCount() + game_duration * osKernelGetTickFreq();
+	info1("Game %u time: %"PRIu32" s", g->game, (uint32_t)((g->global_load_deadline - osKernelGetTickCount()) / osKernelGetTickFreq()));
 }
 
-void initSystem(comms_layer_t* radio, am_addr_t my_addr)
+void initSystem(uint8_t game, comms_layer_t* radio, am_addr_t my_addr)
 {
-	uint8_t i=0;
+	uint16_t i=0;
+	system_game_t* g = &games[game];
+
+	g->game = game;
+	g->seed_given = false;
+	g->phase = GAME_WAITING;
+	g->game_seq = 0;
+	g->sdb_mutex = osMutexNew(NULL); // Protects registered ship database
+
+	while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+	resetShips(g);
+	for(i=0;i<LIST_COUNT;i++)
+	{
+		g->list_cache[i].stale = true;
+		g->list_cache[i].version = 1; // 0 means not versioned
+		g->list_cache[i].requests = 0;
+	}
+	for(i=0;i<ROSTER_PAGES;i++)g->page_version[i] = 0;
+	osMutexRelease(g->sdb_mutex);
 
-	sdb_mutex = osMutexNew(NULL); // Protects registered ship database
+	g->sradio = radio;
+	g->my_address = my_addr;
 
-	while(osMutexAcquire(sdb_mutex, 1000) != osOK);
-	for(i=0;i<MAX_SHIPS;i++)
+	g->rcv_msg_qID = osMessageQueueNew(SDB_MAX_SHIPS + 3, sizeof(query_entry_t), NULL);	// For received messages
+	g->tx_class_qID[TX_CLASS_WELCOME] = osMessageQueueNew(SDB_MAX_SHIPS + 3, sizeof(query_response_t), NULL);	// For response messages
+	g->tx_class_qID[TX_CLASS_QUERY] = osMessageQueueNew(SDB_MAX_SHIPS + 3, sizeof(query_response_t), NULL);	// For response messages
+	g->tx_class_qID[TX_CLASS_LIST] = osMessageQueueNew(SDB_MAX_SHIPS + 3, sizeof(list_response_t), NULL);	// For response messages
+
+	g->tx_free_qID = osMessageQueueNew(SYS_TX_POOL_SIZE, sizeof(uint8_t), NULL);	// Free transmit buffers
+	for(i=0;i<SYS_TX_POOL_SIZE;i++)
 	{
-		ship_db[i].shipInGame = false;
-		ship_db[i].shipAddr = 0;
-		ship_db[i].x_coordinate = DEFAULT_LOC;
-		ship_db[i].y_coordinate = DEFAULT_LOC;
-		ship_db[i].ltime = osKernelGetTickCount() + DEFAULT_TIME * osKernelGetTickFreq();
-		ship_db[i].isCargoLoaded = false;
+		uint8_t buf = i;
+		osMessageQueuePut(g->tx_free_qID, &buf, 0, 0);
 	}
-	osMutexRelease(sdb_mutex);
 
-	sradio = radio;
-	my_address = my_addr;
+	g->snd_event_id = osEventFlagsNew(NULL); // Signals queued responses to send thread
+	g->tx_class = TX_CLASS_WELCOME;
+	g->tx_credit = 0;
+
+	g->rcv_task_id = osThreadNew(incomingMsgHandler, g, NULL);	// Handles incoming messages and responses to
+	osThreadNew(sendResponses, g, NULL);	// Sends all response messages
+}
 
-	rcv_msg_qID = osMessageQueueNew(MAX_SHIPS + 3, sizeof(query_msg_t), NULL);	// For received messages
-	snd_msg_qID = osMessageQueueNew(MAX_SHIPS + 3, sizeof(query_response_msg_t), NULL);	// For response messages
-	snd_buf_qID = osMessageQueueNew(MAX_SHIPS + 3, sizeof(query_response_buf_t), NULL);	// For response messages
+// Empties ship database and its indexes. Must be called with sdb_mutex held.
+static void resetShips(system_game_t* g)
+{
+	uint16_t i;
+	uint8_t x, y;
 
-	snd_event_id = osEventFlagsNew(NULL); // Using one event flag for two send threads. Possible starvation??
-	osEventFlagsSet(snd_event_id, 0x00000001U); // Sets send threads to ready-to-send state
+	for(i=0;i<SDB_MAX_SHIPS;i++)
+	{
+		g->sdb.addr[i] = 0;
+		g->sdb.x[i] = DEFAULT_LOC;
+		g->sdb.y[i] = DEFAULT_LOC;
+		g->sdb.ltime[i] = osKernelGetTickCount() + DEFAULT_TIME * osKernelGetTickFreq();
+	}
+	for(i=0;i<SDB_WORDS;i++)g->sdb.in_game[i] = g->sdb.cargo[i] = 0;
+	g->dl_count = 0;
+	g->annulus_valid = false;
+	for(i=0;i<SDB_HASH_SIZE;i++)g->sdb_hash[i] = SDB_MAX_SHIPS;
+	for(x=0;x<=GRID_UPPER_BOUND;x++)for(y=0;y<=GRID_UPPER_BOUND;y++)g->sdb_grid[x][y] = SDB_MAX_SHIPS;
+}
 
-	osThreadNew(incomingMsgHandler, NULL, NULL);	// Handles incoming messages and responses to
-	osThreadNew(sendResponseMsg, NULL, NULL);	// Sends query_response_msg_t response messages
-	osThreadNew(sendResponseBuf, NULL, NULL);	// Sends query_response_buf_t response messages
+void setGameSeed(uint8_t game, uint32_t seed)
+{
+	games[game].seed = seed;
+	games[game].seed_given = true;
 }
 
 /**********************************************************************************************
  *	Message receiving
  **********************************************************************************************/
 
+// 'user' selects the game, see CLG_GAME_USER.
 void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* user)
 {
-	// First message that is received triggers random number generator init
-	// and subsequently starts the game
-	if(first_msg)
-	{
-		initGame();
-		first_msg = false;
-	}
+	uintptr_t game = (uintptr_t)user;
+	system_game_t* g;
 
-	if (comms_get_payload_length(comms, msg) == sizeof(query_msg_t))
+	if(game >= CLG_MAX_GAMES || games[game].rcv_task_id == NULL)return; // No such game
+	g = &games[game];
+
+	uint8_t len = comms_get_payload_length(comms, msg);
+	if (len == sizeof(query_msg_t) || len == sizeof(query_page_msg_t))
 	{
-	    query_msg_t * packet = (query_msg_t*)comms_get_payload(comms, msg, sizeof(query_msg_t));
+	    query_entry_t entry;
+		journalRecord(g->game, JOURNAL_SYSTEM_MSG, comms_get_payload(comms, msg, len), len);
+		memset(&entry.packet, 0, sizeof(entry.packet));
+		memcpy(&entry.packet, comms_get_payload(comms, msg, len), len);
+		entry.rx_time = osKernelGetTickCount();
 		info1("Rcv qry");		
-		osStatus_t err = osMessageQueuePut(rcv_msg_qID, packet, 0, 0);
+		osStatus_t err = osMessageQueuePut(g->rcv_msg_qID, &entry, 0, 0);
 		if(err == osOK)debug1("rc query");
 		else debug1("msgq err");
 	}
@@ -166,37 +465,56 @@ void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* us
 
 static void incomingMsgHandler(void *arg)
 {
-	uint8_t ndx;
-	query_msg_t packet; 
+	system_game_t* g = (system_game_t*)arg;
+	uint16_t ndx;
+	query_entry_t entry;
+	query_page_msg_t packet;
+	list_response_t lpacket; 
 	query_response_msg_t rpacket;
-	query_response_buf_t bpacket;
+	lat_stamp_t stamp;
+	uint32_t wait, next_deadline;
 
 	for(;;)
 	{
-		osMessageQueueGet(rcv_msg_qID, &packet, NULL, osWaitForever);
+		// Wait for queries, but not past the end of an open list request window, the next loading deadline,
+		// the end of the game or the end of the lobby
+		wait = sendDueLists(g);
+		next_deadline = retireExpired(g);
+		if(next_deadline < wait)wait = next_deadline;
+		next_deadline = advanceGame(g);
+		if(next_deadline < wait)wait = next_deadline;
+		if(osMessageQueueGet(g->rcv_msg_qID, &entry, NULL, wait) != osOK)continue;
+		if(g->phase == GAME_WAITING)initGame(g); // First query starts the first game
+		packet = entry.packet;
+		stamp.msg_id = packet.messageID;
+		stamp.rx_time = entry.rx_time;
+		stamp.dq_time = osKernelGetTickCount();
+		latencyRecord(stamp.msg_id, LAT_QUEUE, stamp.rx_time, stamp.dq_time);
 		switch(packet.messageID)
 		{
 			case WELCOME_MSG:
-				while(osMutexAcquire(sdb_mutex, 1000) != osOK);
-				ndx = registerNewShip(ntoh16(packet.senderAddr));
-				if(ndx >= MAX_SHIPS)
+				while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+				ndx = registerNewShip(g, ntoh16(packet.senderAddr));
+				if(ndx >= SDB_MAX_SHIPS)
 				{
 					info1("No room");
 				}
 				else 
 				{
-					info1("New ship %lu %u %u %u %lu", (uint16_t) ship_db[ndx].shipAddr, ship_db[ndx].x_coordinate, ship_db[ndx].y_coordinate, (uint8_t) ship_db[ndx].isCargoLoaded, (uint16_t)((ship_db[ndx].ltime - osKernelGetTickCount()) / osKernelGetTickFreq()));
+					info1("New ship %u %u %u %u %u", (uint16_t) g->sdb.addr[ndx], g->sdb.x[ndx], g->sdb.y[ndx], (uint8_t) testBit(g->sdb.cargo, ndx), (uint16_t)((g->sdb.ltime[ndx] - osKernelGetTickCount()) / osKernelGetTickFreq()));
 
 					rpacket.messageID = WELCOME_RMSG;
-					rpacket.senderAddr = ship_db[ndx].shipAddr; // Piggybacking destination address here
-					rpacket.shipAddr = ship_db[ndx].shipAddr;
-					rpacket.loadingDeadline = (uint16_t)((ship_db[ndx].ltime - osKernelGetTickCount()) / osKernelGetTickFreq());
-					rpacket.x_coordinate = ship_db[ndx].x_coordinate;
-					rpacket.y_coordinate = ship_db[ndx].y_coordinate;
-					rpacket.isCargoLoaded = ship_db[ndx].isCargoLoaded;
-					osMessageQueuePut(snd_msg_qID, &rpacket, 0, 0);
+					rpacket.senderAddr = g->sdb.addr[ndx]; // Piggybacking destination address here
+					rpacket.shipAddr = g->sdb.addr[ndx];
+					rpacket.loadingDeadline = (uint16_t)((g->sdb.ltime[ndx] - osKernelGetTickCount()) / osKernelGetTickFreq());
+					rpacket.x_coordinate = g->sdb.x[ndx];
+					rpacket.y_coordinate = g->sdb.y[ndx];
+					rpacket.isCargoLoaded = testBit(g->sdb.cargo, ndx);
+					rpacket.slot = ndx;
+					rpacket.rosterVersion = g->list_cache[LIST_ALL_SHIPS].version;
+					queueQueryResponse(g, TX_CLASS_WELCOME, &rpacket, &stamp);
 				}
-				osMutexRelease(sdb_mutex);
+				osMutexRelease(g->sdb_mutex);
 
 			break;
 
@@ -204,52 +522,74 @@ static void incomingMsgHandler(void *arg)
 				rpacket.messageID = GTIME_QRMSG;
 				rpacket.senderAddr = ntoh16(packet.senderAddr); // Piggybacking destination address here
 				rpacket.shipAddr = ntoh16(packet.senderAddr);
-				rpacket.loadingDeadline = (uint16_t)((global_load_deadline - osKernelGetTickCount()) / osKernelGetTickFreq());
+				rpacket.loadingDeadline = 0; // Game over
+				if(g->phase == GAME_RUNNING)rpacket.loadingDeadline = (uint16_t)((g->global_load_deadline - osKernelGetTickCount()) / osKernelGetTickFreq());
 				rpacket.x_coordinate = DEFAULT_LOC;
 				rpacket.y_coordinate = DEFAULT_LOC;
 				rpacket.isCargoLoaded = false;
-				osMessageQueuePut(snd_msg_qID, &rpacket, 0, 0);
+				rpacket.slot = 0;
+				rpacket.rosterVersion = 0;
+				queueQueryResponse(g, TX_CLASS_QUERY, &rpacket, &stamp);
 
 			break;
 
 			case SHIP_QMSG:
-				info1("Ship qry %lu %lu", ntoh16(packet.senderAddr), ntoh16(packet.shipAddr));
-				while(osMutexAcquire(sdb_mutex, 1000) != osOK);
-				ndx = getIndex(ntoh16(packet.shipAddr));
+				info1("Ship qry %u %u", ntoh16(packet.senderAddr), ntoh16(packet.shipAddr));
+				while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+				ndx = g->sdb_hash[hashSlot(g, ntoh16(packet.shipAddr))];
+				if(ndx >= SDB_MAX_SHIPS)
+				{
+					osMutexRelease(g->sdb_mutex);
+					break; // No such ship
+				}
 				rpacket.messageID = SHIP_QRMSG;
 				rpacket.senderAddr = ntoh16(packet.senderAddr); // Piggybacking destination address here
-				rpacket.shipAddr = ship_db[ndx].shipAddr;
-				rpacket.loadingDeadline = (uint16_t)((ship_db[ndx].ltime - osKernelGetTickCount()) / osKernelGetTickFreq());
-				rpacket.x_coordinate = ship_db[ndx].x_coordinate;
-				rpacket.y_coordinate = ship_db[ndx].y_coordinate;
-				rpacket.isCargoLoaded = ship_db[ndx].isCargoLoaded;
-				osMessageQueuePut(snd_msg_qID, &rpacket, 0, 0);
-				osMutexRelease(sdb_mutex);
+				rpacket.shipAddr = g->sdb.addr[ndx];
+				rpacket.loadingDeadline = (uint16_t)((g->sdb.ltime[ndx] - osKernelGetTickCount()) / osKernelGetTickFreq());
+				rpacket.x_coordinate = g->sdb.x[ndx];
+				rpacket.y_coordinate = g->sdb.y[ndx];
+				rpacket.isCargoLoaded = testBit(g->sdb.cargo, ndx);
+				rpacket.slot = ndx;
+				rpacket.rosterVersion = g->list_cache[LIST_ALL_SHIPS].version;
+				queueQueryResponse(g, TX_CLASS_QUERY, &rpacket, &stamp);
+				osMutexRelease(g->sdb_mutex);
 
 			break;
 
 			case AS_QMSG:
-				info1("AShip qry %lu", ntoh16(packet.senderAddr));
-				bpacket.messageID = AS_QRMSG;
-				bpacket.senderAddr = SYSTEM_ADDR;
-				bpacket.shipAddr = ntoh16(packet.senderAddr);
-				while(osMutexAcquire(sdb_mutex, 1000) != osOK);
-				bpacket.len = getAllShips(bpacket.ships, MAX_SHIPS);
-				osMutexRelease(sdb_mutex);			
-				
-				osMessageQueuePut(snd_buf_qID, &bpacket, 0, 0);
+				info1("AShip qry %u", ntoh16(packet.senderAddr));
+				requestList(g, LIST_ALL_SHIPS, ntoh16(packet.senderAddr), &stamp);
 
 			break;
 
 			case ACARGO_QMSG:
-				bpacket.messageID = ACARGO_QRMSG;
-				bpacket.senderAddr = SYSTEM_ADDR;
-				bpacket.shipAddr = ntoh16(packet.senderAddr);
-				while(osMutexAcquire(sdb_mutex, 1000) != osOK);
-				bpacket.len = getAllCargo(bpacket.ships, MAX_SHIPS);
-				osMutexRelease(sdb_mutex);
+				requestList(g, LIST_ALL_CARGO, ntoh16(packet.senderAddr), &stamp);
+
+			break;
+
+			case CARGO_MAP_QMSG:
+				requestList(g, LIST_CARGO_MAP, ntoh16(packet.senderAddr), &stamp);
+
+			break;
+
+			case LEAVE_QMSG:
+				while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+				ndx = g->sdb_hash[hashSlot(g, ntoh16(packet.senderAddr))];
+				if(ndx < SDB_MAX_SHIPS)departShip(g, ndx, &stamp);
+				osMutexRelease(g->sdb_mutex);
+
+			break;
 
-				osMessageQueuePut(snd_buf_qID, &bpacket, 0, 0);
+			case AS_PAGE_QMSG:
+				while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+				buildRosterPage(g, &lpacket.image.page, ntoh16(packet.cursor), ntoh16(packet.since));
+				osMutexRelease(g->sdb_mutex);
+				lpacket.dest = ntoh16(packet.senderAddr);
+				lpacket.image.page.shipAddr = packet.senderAddr;
+				lpacket.len = sizeof(roster_page_msg_t);
+				lpacket.stamp = stamp;
+				debug1("Page %u to %04X", ntoh16(lpacket.image.page.firstSlot), lpacket.dest);
+				queueResponse(g, TX_CLASS_LIST, &lpacket);
 
 			break;
 
@@ -264,79 +604,308 @@ static void incomingMsgHandler(void *arg)
  **********************************************************************************************/
 static void radioSendDone(comms_layer_t * comms, comms_msg_t * msg, comms_error_t result, void * user)
 {
+	system_game_t* g = (system_game_t*)user;
+	uint8_t buf = (uint8_t)(msg - g->tx_pool);
+	uint32_t now = osKernelGetTickCount();
+
+	latencyRecord(g->tx_stamp[buf].msg_id, LAT_RADIO, g->tx_start[buf], now);
+	latencyRecord(g->tx_stamp[buf].msg_id, LAT_TOTAL, g->tx_stamp[buf].rx_time, now);
     logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "snt %u", result);
-	osEventFlagsSet(snd_event_id, 0x00000001U);
+	osMessageQueuePut(g->tx_free_qID, &buf, 0, 0); // Buffer can be reused
 }
 
-static void sendResponseMsg(void *arg)
+static void queueResponse(system_game_t* g, uint8_t tx_class, const void* packet)
 {
-	query_response_msg_t packet;
-	am_addr_t dest;
+	if(osMessageQueuePut(g->tx_class_qID[tx_class], packet, 0, 0) == osOK)osEventFlagsSet(g->snd_event_id, RESPONSE_QUEUED_FLAG);
+	else debug1("txq %u full", tx_class);
+}
+
+static void queueQueryResponse(system_game_t* g, uint8_t tx_class, const query_response_msg_t* packet, const lat_stamp_t* stamp)
+{
+	query_response_t r;
+
+	r.packet = *packet;
+	r.stamp = *stamp;
+	queueResponse(g, tx_class, &r);
+}
+
+// Returns the class to send from next or TX_CLASS_COUNT if all class queues are empty.
+static uint8_t nextTxClass(system_game_t* g)
+{
+	uint8_t k;
+
+	for(k=0;k<=TX_CLASS_COUNT;k++)
+	{
+		if(g->tx_credit > 0 && osMessageQueueGetCount(g->tx_class_qID[g->tx_class]) > 0)
+		{
+			g->tx_credit--;
+			return g->tx_class;
+		}
+		// Out of credit or nothing to send, next class gets its full share
+		g->tx_class = (g->tx_class + 1) % TX_CLASS_COUNT;
+		g->tx_credit = class_weight[g->tx_class];
+	}
+	return TX_CLASS_COUNT;
+}
+
+static bool buildResponseMsg(system_game_t* g, comms_msg_t* msg, const query_response_msg_t* packet)
+{
+	comms_init_message(g->sradio, msg);
+	query_response_msg_t * qRMsg = comms_get_payload(g->sradio, msg, sizeof(query_response_msg_t));
+	if (qRMsg == NULL)
+	{
+		return false;
+	}
+
+	qRMsg->messageID = packet->messageID;
+	qRMsg->senderAddr = hton16((uint16_t)SYSTEM_ADDR);
+	qRMsg->shipAddr = hton16(packet->shipAddr);
+	qRMsg->loadingDeadline = hton16(packet->loadingDeadline); // hton16() ensures correct endianness
+	qRMsg->x_coordinate = packet->x_coordinate;
+	qRMsg->y_coordinate = packet->y_coordinate;
+	qRMsg->isCargoLoaded = packet->isCargoLoaded;
+	qRMsg->slot = hton16(packet->slot);
+	qRMsg->rosterVersion = hton16(packet->rosterVersion);
+
+    comms_set_packet_type(g->sradio, msg, CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, g->game));
+    comms_am_set_destination(g->sradio, msg, packet->senderAddr); // Destination address was piggybacked here
+    comms_set_payload_length(g->sradio, msg, sizeof(query_response_msg_t));
+	return true;
+}
+
+static bool buildResponseBuf(system_game_t* g, comms_msg_t* msg, const list_response_t* packet)
+{
+	comms_init_message(g->sradio, msg);
+	uint8_t * qRMsg = comms_get_payload(g->sradio, msg, packet->len);
+	if (qRMsg == NULL)
+	{
+		return false;
+	}
+
+	memcpy(qRMsg, &packet->image, packet->len); // Already in network byte order
+
+    comms_set_packet_type(g->sradio, msg, CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, g->game));
+    comms_am_set_destination(g->sradio, msg, packet->dest);
+    comms_set_payload_length(g->sradio, msg, packet->len);
+	return true;
+}
+
+static void sendResponses(void *arg)
+{
+	system_game_t* g = (system_game_t*)arg;
+	uint8_t buf, tx_class;
+	bool built;
+	query_response_t rpacket;
+	list_response_t bpacket;
 
 	for(;;)
 	{
-		osMessageQueueGet(snd_msg_qID, &packet, NULL, osWaitForever);
+		osMessageQueueGet(g->tx_free_qID, &buf, NULL, osWaitForever); // Wait for a free transmit buffer
+
+		while((tx_class = nextTxClass(g)) >= TX_CLASS_COUNT)
+		{
+			osEventFlagsWait(g->snd_event_id, RESPONSE_QUEUED_FLAG, osFlagsWaitAny, osWaitForever); // Flags automatically cleared
+		}
 
-		osEventFlagsWait(snd_event_id, 0x00000001U, osFlagsWaitAny, osWaitForever); // Flags automatically cleared
+		if(tx_class == TX_CLASS_LIST)
+		{
+			osMessageQueueGet(g->tx_class_qID[tx_class], &bpacket, NULL, 0);
+			built = buildResponseBuf(g, &g->tx_pool[buf], &bpacket);
+			g->tx_stamp[buf] = bpacket.stamp;
+		}
+		else
+		{
+			osMessageQueueGet(g->tx_class_qID[tx_class], &rpacket, NULL, 0);
+			built = buildResponseMsg(g, &g->tx_pool[buf], &rpacket.packet);
+			g->tx_stamp[buf] = rpacket.stamp;
+		}
 
-		comms_init_message(sradio, &msg);
-		query_response_msg_t * qRMsg = comms_get_payload(sradio, &msg, sizeof(query_response_msg_t));
-		if (qRMsg == NULL)
+		if(!built)
 		{
+			osMessageQueuePut(g->tx_free_qID, &buf, 0, 0);
 			continue ; // Continue for(;;) loop
 		}
-		dest = packet.senderAddr;
-		qRMsg->messageID = packet.messageID;
-		qRMsg->senderAddr = hton16((uint16_t)SYSTEM_ADDR);
-		qRMsg->shipAddr = hton16(packet.shipAddr);
-		qRMsg->loadingDeadline = hton16(packet.loadingDeadline); // hton16() ensures correct endianness
-		qRMsg->x_coordinate = packet.x_coordinate;
-		qRMsg->y_coordinate = packet.y_coordinate;
-		qRMsg->isCargoLoaded = packet.isCargoLoaded;
-	
+
 		// Send data packet
-	    comms_set_packet_type(sradio, &msg, AMID_SYSTEMCOMMUNICATION);
-	    comms_am_set_destination(sradio, &msg, dest);
-	    comms_set_payload_length(sradio, &msg, sizeof(query_response_msg_t));
+		g->tx_start[buf] = osKernelGetTickCount();
+		latencyRecord(g->tx_stamp[buf].msg_id, LAT_SERVICE, g->tx_stamp[buf].dq_time, g->tx_start[buf]);
+	    comms_error_t result = comms_send(g->sradio, &g->tx_pool[buf], radioSendDone, g);
+	    logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "snd %u %u", tx_class, result);
+		if(result != COMMS_SUCCESS)osMessageQueuePut(g->tx_free_qID, &buf, 0, 0); // No send done event will follow
+	}
+}
+
+/**********************************************************************************************
+ *	Ship list responses
+ **********************************************************************************************/
+
+// Adds a request for 'list', opens a request window if none is open.
+// Latency of the response is accounted to the request that opened the window.
+static void requestList(system_game_t* g, uint8_t list, am_addr_t requester, const lat_stamp_t* stamp)
+{
+	list_cache_t* c = &g->list_cache[list];
 
-	    comms_error_t result = comms_send(sradio, &msg, radioSendDone, NULL);
-	    logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "snd %u", result);
+	if(c->requests == 0)
+	{
+		c->requester = requester;
+		c->stamp = *stamp;
+		c->window_end = osKernelGetTickCount() + LIST_REQUEST_WINDOW * osKernelGetTickFreq() / 1000;
+		c->requests = 1;
 	}
+	else if(requester != c->requester)c->requests++;
+	else ; // Same ship asking again, one answer will do
 }
 
-static void sendResponseBuf(void *arg)
+// Must be called with sdb_mutex held.
+static void rebuildList(system_game_t* g, uint8_t list)
 {
-	uint8_t i=0;
-	query_response_buf_t packet;
-	for(;;)
+	uint8_t i;
+	list_cache_t* c = &g->list_cache[list];
+	query_response_buf_t* image = &c->image.list;
+	am_addr_t ships[MAX_SHIPS];
+
+	c->stale = false;
+	if(list == LIST_CARGO_MAP)
 	{
-		osMessageQueueGet(snd_buf_qID, &packet, NULL, osWaitForever);
+		rebuildCargoMap(g, c);
+		return;
+	}
 
-		osEventFlagsWait(snd_event_id, 0x00000001U, osFlagsWaitAny, osWaitForever); // Flags automatically cleared
+	image->messageID = list == LIST_ALL_SHIPS ? AS_QRMSG : ACARGO_QRMSG;
+	image->senderAddr = hton16((uint16_t)SYSTEM_ADDR);
+	image->len = list == LIST_ALL_SHIPS ? getAllShips(g, ships, MAX_SHIPS) : getAllCargo(g, ships, MAX_SHIPS);
+	for(i=0;i<MAX_SHIPS;i++)image->ships[i] = i < image->len ? hton16(ships[i]) : 0;
+	image->version = hton16(c->version);
+	c->len = sizeof(query_response_buf_t);
+}
 
-		comms_init_message(sradio, &msg);
-		query_response_buf_t * qRMsg = comms_get_payload(sradio, &msg, sizeof(query_response_buf_t));
-		if (qRMsg == NULL)
+// Builds the cargo map image, see cargo_map_msg_t. Must be called with sdb_mutex held.
+static void rebuildCargoMap(system_game_t* g, list_cache_t* c)
+{
+	cargo_map_msg_t* map = &c->image.map;
+	uint16_t first[CARGO_MAP_DATA_SIZE / 4], count[CARGO_MAP_DATA_SIZE / 4];
+	uint8_t bits[CARGO_MAP_DATA_SIZE];
+	uint16_t i, w, ships = 0, v;
+	uint8_t ranges = 0, r;
+	sdb_word_t set;
+	bool extend, full = false;
+
+	memset(bits, 0, sizeof(bits));
+	for(w=0;w<SDB_WORDS && !full;w++)
+	{
+		for(set=g->sdb.in_game[w];set != 0;set &= set - 1)
 		{
-			continue ;//continue for(;;) loop
+			i = w * SDB_WORD_BITS + __builtin_ctz(set);
+			extend = ranges > 0 && first[ranges-1] + count[ranges-1] == i;
+			if(4 * (ranges + (extend ? 0 : 1)) + (ships + 8) / 8 > CARGO_MAP_DATA_SIZE)
+			{
+				full = true;
+				break;
+			}
+			if(!extend)
+			{
+				first[ranges] = i;
+				count[ranges++] = 0;
+			}
+			count[ranges-1]++;
+			if(testBit(g->sdb.cargo, i))bits[ships / 8] |= 1 << (ships % 8);
+			ships++;
 		}
+	}
+
+	map->messageID = CARGO_MAP_QRMSG;
+	map->senderAddr = hton16((uint16_t)SYSTEM_ADDR);
+	map->version = hton16(c->version);
+	map->rosterVersion = hton16(g->list_cache[LIST_ALL_SHIPS].version);
+	map->rangeCount = ranges;
+	for(r=0;r<ranges;r++)
+	{
+		v = hton16(first[r]);
+		memcpy(&map->data[4 * r], &v, sizeof(v));
+		v = hton16(count[r]);
+		memcpy(&map->data[4 * r + 2], &v, sizeof(v));
+	}
+	memcpy(&map->data[4 * ranges], bits, (ships + 7) / 8);
+	c->len = offsetof(cargo_map_msg_t, data) + 4 * ranges + (ships + 7) / 8;
+}
+
+// Queues responses for lists whose request window has ended.
+// Returns ticks until the next open window ends, osWaitForever if none is open.
+static uint32_t sendDueLists(system_game_t* g)
+{
+	uint8_t list;
+	uint32_t now = osKernelGetTickCount(), wait = osWaitForever;
+	list_response_t r;
 
-		qRMsg->messageID = packet.messageID;
-		qRMsg->senderAddr = hton16(packet.senderAddr);
-		qRMsg->shipAddr = hton16(packet.shipAddr);
-		qRMsg->len = packet.len;
-		for(i=0;i<packet.len;i++)
+	for(list=0;list<LIST_COUNT;list++)
+	{
+		list_cache_t* c = &g->list_cache[list];
+		if(c->requests == 0)continue;
+		if((int32_t)(c->window_end - now) > 0)
 		{
-			qRMsg->ships[i]=hton16(packet.ships[i]);
+			if(c->window_end - now < wait)wait = c->window_end - now;
+			continue;
 		}
 
-		// Send data packet
-	    comms_set_packet_type(sradio, &msg, AMID_SYSTEMCOMMUNICATION);
-	    comms_am_set_destination(sradio, &msg, packet.shipAddr);
-	    comms_set_payload_length(sradio, &msg, sizeof(query_response_buf_t));
+		while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+		if(c->stale)rebuildList(g, list);
+		r.image = c->image;
+		r.len = c->len;
+		osMutexRelease(g->sdb_mutex);
+
+		r.dest = c->requests == 1 ? c->requester : AM_BROADCAST_ADDR;
+		r.image.list.shipAddr = hton16(r.dest);
+		r.stamp = c->stamp;
+		debug1("List %u len %u to %04X, %u req", list, r.len, r.dest, c->requests);
+		queueResponse(g, TX_CLASS_LIST, &r);
+		c->requests = 0;
+	}
+	return wait;
+}
+
+// Marks 'list' and the cargo map changed, must be called with sdb_mutex held.
+static void listChanged(system_game_t* g, uint8_t list)
+{
+	g->list_cache[list].stale = true;
+	if(++g->list_cache[list].version == 0)g->list_cache[list].version = 1;
+	if(list != LIST_CARGO_MAP)listChanged(g, LIST_CARGO_MAP); // Map covers both ship lists
+}
+
+// Marks roster page of slot 'index' changed, must be called with sdb_mutex held.
+static void rosterChanged(system_game_t* g, uint16_t index)
+{
+	listChanged(g, LIST_ALL_SHIPS);
+	g->page_version[index / ROSTER_PAGE_SLOTS] = g->list_cache[LIST_ALL_SHIPS].version;
+}
 
-	    comms_error_t result = comms_send(sradio, &msg, radioSendDone, NULL);
-	    logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "sndb %u", result);
+// Fills 'page' with the first roster page at or after slot 'cursor' that has changed after
+// roster version 'since', 0 meaning any page that ever had a ship. Must be called with sdb_mutex held.
+static void buildRosterPage(system_game_t* g, roster_page_msg_t* page, uint16_t cursor, uint16_t since)
+{
+	uint16_t p, i, first = ROSTER_END, next = ROSTER_END;
+	uint16_t pv;
+
+	for(p=cursor/ROSTER_PAGE_SLOTS;p<ROSTER_PAGES;p++)
+	{
+		pv = g->page_version[p];
+		if(pv == 0 || (since != 0 && (int16_t)(pv - since) <= 0))continue; // Not changed
+		if(first == ROSTER_END)first = p * ROSTER_PAGE_SLOTS;
+		else
+		{
+			next = p * ROSTER_PAGE_SLOTS;
+			break;
+		}
+	}
+
+	page->messageID = AS_PAGE_QRMSG;
+	page->senderAddr = hton16((uint16_t)SYSTEM_ADDR);
+	page->version = hton16(g->list_cache[LIST_ALL_SHIPS].version);
+	page->firstSlot = hton16(first);
+	page->next = hton16(next);
+	for(i=0;i<ROSTER_PAGE_SLOTS;i++)
+	{
+		p = first + i;
+		page->ships[i] = first != ROSTER_END && p < SDB_MAX_SHIPS && testBit(g->sdb.in_game, p) ? hton16(g->sdb.addr[p]) : 0;
 	}
 }
 
@@ -344,167 +913,449 @@ static void sendResponseBuf(void *arg)
  *	Utility functions
  **********************************************************************************************/
 
-// Returns buffer index of ship with address 'id' or value MAX_SHIPS if no such ship.
-uint8_t getIndex(am_addr_t id)
+// Returns buffer index of ship with address 'id' or value SDB_MAX_SHIPS if no such ship.
+// This function can block.
+uint16_t getIndex(uint8_t game, am_addr_t id)
 {
-	uint8_t k;
-	for(k=0;k<MAX_SHIPS;k++)if(ship_db[k].shipInGame && ship_db[k].shipAddr == id)break;
-	return k;
+	uint16_t i;
+	system_game_t* g = &games[game];
+
+	while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+	i = g->sdb_hash[hashSlot(g, id)];
+	if(i < SDB_MAX_SHIPS && (!testBit(g->sdb.in_game, i) || g->sdb.addr[i] != id))i = SDB_MAX_SHIPS; // Slots are reused after departures
+	osMutexRelease(g->sdb_mutex);
+	return i;
 }
 
 // Returns address of ship in location 'x', 'y' or 0 if no ship in this location.
 // This function can block.
-am_addr_t isShipHere(uint8_t x, uint8_t y)
+am_addr_t isShipHere(uint8_t game, uint8_t x, uint8_t y)
 {
 	am_addr_t addr = 0;
-	uint8_t i;
+	uint16_t i;
+	system_game_t* g = &games[game];
 
-	while(osMutexAcquire(sdb_mutex, 1000) != osOK);
-	for(i=0;i<MAX_SHIPS;i++)
+	if(x > GRID_UPPER_BOUND || y > GRID_UPPER_BOUND)return 0;
+
+	while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+	i = g->sdb_grid[x][y];
+	if(i < SDB_MAX_SHIPS && testBit(g->sdb.in_game, i))addr = g->sdb.addr[i];
+	osMutexRelease(g->sdb_mutex);
+	return addr;
+}
+
+// Copies database record of ship with address 'addr' to 'ship'.
+// Returns false if no such ship. This function can block.
+bool getShip(uint8_t game, am_addr_t addr, sdb_t* ship)
+{
+	uint16_t i;
+	system_game_t* g = &games[game];
+
+	while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+	i = g->sdb_hash[hashSlot(g, addr)];
+	if(i < SDB_MAX_SHIPS)
 	{
-		if(ship_db[i].x_coordinate == x && ship_db[i].y_coordinate == y && ship_db[i].shipInGame)	
-		{
-			addr = ship_db[i].shipAddr;
-			break;
-		}
+		ship->shipInGame = testBit(g->sdb.in_game, i);
+		ship->shipAddr = g->sdb.addr[i];
+		ship->x_coordinate = g->sdb.x[i];
+		ship->y_coordinate = g->sdb.y[i];
+		ship->ltime = g->sdb.ltime[i];
+		ship->isCargoLoaded = testBit(g->sdb.cargo, i);
 	}
-	osMutexRelease(sdb_mutex);
-	return addr;
+	osMutexRelease(g->sdb_mutex);
+	return i < SDB_MAX_SHIPS;
 }
 
 // Marks cargo status as true for ship with address 'addr', if such a ship is found.
 // Use with care! There is no revers command to mark cargo status false.
 // This function can block.
-void markCargo(am_addr_t addr)
+void markCargo(uint8_t game, am_addr_t addr)
 {
-	uint8_t i;
-	while(osMutexAcquire(sdb_mutex, 1000) != osOK);
-	for(i=0;i<MAX_SHIPS;i++)if(ship_db[i].shipAddr == addr && ship_db[i].shipInGame)
+	uint16_t i;
+	system_game_t* g = &games[game];
+	while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+	i = g->sdb_hash[hashSlot(g, addr)];
+	// Too late if the loading deadline has passed, the ship is about to depart
+	if(i < SDB_MAX_SHIPS && !testBit(g->sdb.cargo, i) && (int32_t)(g->sdb.ltime[i] - osKernelGetTickCount()) > 0)
 	{
-		ship_db[i].isCargoLoaded = true;
-		break;
+		setBit(g->sdb.cargo, i);
+		listChanged(g, LIST_ALL_CARGO);
 	}
-	osMutexRelease(sdb_mutex);
+	osMutexRelease(g->sdb_mutex);
 }
 
-static uint8_t registerNewShip(am_addr_t shipAddr)
+static uint16_t registerNewShip(system_game_t* g, am_addr_t shipAddr)
 {
-	uint8_t index = getIndex(shipAddr);
+	uint16_t index = g->sdb_hash[hashSlot(g, shipAddr)];
 
-	if(index >= MAX_SHIPS)
+	if(index >= SDB_MAX_SHIPS)
 	{
-		index = getEmptySlot();
+		// A ship joining after the end of the game would depart at once
+		if((int32_t)(g->global_load_deadline - osKernelGetTickCount()) <= 0)return SDB_MAX_SHIPS;
+		index = getEmptySlot(g);
+	
+		if(index < SDB_MAX_SHIPS && !genNewCoordinates(g, index))index = SDB_MAX_SHIPS; // No free location
 	
-		if(index < MAX_SHIPS)
+		if(index < SDB_MAX_SHIPS)
 		{
-			genNewCoordinates(index);
-			genLoadTime(index);
-			ship_db[index].isCargoLoaded = false;
-			ship_db[index].shipAddr = shipAddr;
-			ship_db[index].shipInGame = true;
+			genLoadTime(g, index);
+			clearBit(g->sdb.cargo, index);
+			g->sdb.addr[index] = shipAddr;
+			setBit(g->sdb.in_game, index);
+			addToIndex(g, index);
+			deadlineAdd(g, index);
+			rosterChanged(g, index);
+			g->score_ships++;
 		}
 	}
 	else ; // Ship already registered
 	return index;
 }
 
-static void genNewCoordinates(uint8_t index)
+/**********************************************************************************************
+ *	Game lifecycle
+ **********************************************************************************************/
+
+// Ends the game when its global loading deadline has passed and starts the next one after the lobby.
+// Returns ticks until the next of these events, osWaitForever if the first game has not started.
+static uint32_t advanceGame(system_game_t* g)
 {
-	uint8_t k;
-	uint32_t xloc, yloc, dist;
+	uint32_t now = osKernelGetTickCount();
+
+	if(g->phase == GAME_RUNNING && (int32_t)(g->global_load_deadline - now) <= 0)
+	{
+		endGame(g);
+		g->phase = GAME_LOBBY;
+		g->lobby_end = now + GAME_LOBBY_TIME * osKernelGetTickFreq();
+	}
+	if(g->phase == GAME_LOBBY && (int32_t)(g->lobby_end - now) <= 0)initGame(g);
+
+	if(g->phase == GAME_RUNNING)return g->global_load_deadline - now;
+	if(g->phase == GAME_LOBBY)return g->lobby_end - now;
+	return osWaitForever;
+}
+
+// Publishes the scoreboard, empties the ship database and parks the crane.
+static void endGame(system_game_t* g)
+{
+	list_response_t lpacket;
+	journal_score_t jscore;
+	lat_stamp_t stamp;
+	uint16_t first = 0, i;
+	uint8_t len;
+
+	stamp.msg_id = 0; // Not a response to a message
+	stamp.rx_time = stamp.dq_time = osKernelGetTickCount();
+
+	while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+	while(g->dl_count > 0)departShip(g, g->dl_heap[0], &stamp); // None left, deadlines are not later than the game end
+	resetShips(g);
+
+	info1("Game %u #%u over, ships %u loaded %u", g->game, g->game_seq, g->score_ships, g->score_len);
+	for(i=0;i<g->score_len;i++)info1("Game %u #%u winner %u", g->game, g->game_seq, g->score[i]);
+	jscore.seq = hton16(g->game_seq);
+	jscore.ships = hton16(g->score_ships);
+	jscore.loaded = hton16(g->score_len);
+	journalRecord(g->game, JOURNAL_SCORE, &jscore, sizeof(jscore));
+
+	// At least one frame, also if nobody got cargo
+	do
+	{
+		len = g->score_len - first < SCOREBOARD_FRAME_SHIPS ? g->score_len - first : SCOREBOARD_FRAME_SHIPS;
+		lpacket.image.score.messageID = SCOREBOARD_MSG;
+		lpacket.image.score.senderAddr = hton16((uint16_t)SYSTEM_ADDR);
+		lpacket.image.score.gameSeq = hton16(g->game_seq);
+		lpacket.image.score.ships = hton16(g->score_ships);
+		lpacket.image.score.loaded = hton16(g->score_len);
+		lpacket.image.score.first = first;
+		lpacket.image.score.len = len;
+		for(i=0;i<len;i++)lpacket.image.score.winners[i] = hton16(g->score[first + i]);
+		lpacket.len = offsetof(scoreboard_msg_t, winners) + len * sizeof(am_addr_t);
+		lpacket.dest = AM_BROADCAST_ADDR;
+		lpacket.stamp = stamp;
+		queueResponse(g, TX_CLASS_LIST, &lpacket);
+		first += len;
+	}
+	while(first < g->score_len);
+	osMutexRelease(g->sdb_mutex);
+
+	resetCrane(g->game); // Not under sdb_mutex, the crane takes it while holding its own
+}
+
+// Removes ship in slot 'index' from the game and broadcasts its departure.
+// Must be called with sdb_mutex held.
+static void departShip(system_game_t* g, uint16_t index, const lat_stamp_t* stamp)
+{
+	query_response_msg_t rpacket;
+	bool cargo = testBit(g->sdb.cargo, index);
+	uint8_t x = g->sdb.x[index], y = g->sdb.y[index];
+
+	info1("Ship %u departs %u", g->sdb.addr[index], (uint8_t)cargo);
+	if(cargo && g->score_len < SCORE_MAX_SHIPS)g->score[g->score_len++] = g->sdb.addr[index];
+	rpacket.messageID = DEPART_RMSG;
+	rpacket.senderAddr = AM_BROADCAST_ADDR; // Piggybacking destination address here
+	rpacket.shipAddr = g->sdb.addr[index];
+	rpacket.loadingDeadline = 0;
+	rpacket.x_coordinate = x;
+	rpacket.y_coordinate = y;
+	rpacket.isCargoLoaded = cargo;
+	rpacket.slot = index;
+	rpacket.rosterVersion = 0; // Slot is free after this
+	queueQueryResponse(g, TX_CLASS_WELCOME, &rpacket, stamp);
+
+	deadlineRemove(g, index);
+	removeFromIndex(g, index);
+	clearBit(g->sdb.in_game, index);
+	clearBit(g->sdb.cargo, index);
+	g->sdb.addr[index] = 0;
+	rosterChanged(g, index);
+	if(cargo)listChanged(g, LIST_ALL_CARGO);
+
+	// Cell can be handed out again, if it is in the current annulus
+	if(g->annulus_valid && g->annulus_count < ANNULUS_SIZE
+	   && abs(g->annulus_center.x - x) + abs(g->annulus_center.y - y) >= SHIP_MIN_DIST
+	   && abs(g->annulus_center.x - x) + abs(g->annulus_center.y - y) <= SHIP_MAX_DIST)
+	{
+		g->annulus_cells[g->annulus_count].x = x;
+		g->annulus_cells[g->annulus_count].y = y;
+		g->annulus_count++;
+	}
+}
+
+// Departs all ships whose loading deadline has passed.
+// Returns ticks until the next loading deadline, osWaitForever if there is none.
+static uint32_t retireExpired(system_game_t* g)
+{
+	uint32_t now = osKernelGetTickCount(), wait = osWaitForever;
+	lat_stamp_t stamp;
+
+	stamp.msg_id = 0; // Not a response to a message
+	stamp.rx_time = stamp.dq_time = now;
+
+	while(osMutexAcquire(g->sdb_mutex, 1000) != osOK);
+	while(g->dl_count > 0 && (int32_t)(g->sdb.ltime[g->dl_heap[0]] - now) <= 0)departShip(g, g->dl_heap[0], &stamp);
+	if(g->dl_count > 0)wait = g->sdb.ltime[g->dl_heap[0]] - now;
+	osMutexRelease(g->sdb_mutex);
+	return wait;
+}
+
+// True if slot 'a' has an earlier loading deadline than slot 'b'.
+static bool deadlineBefore(system_game_t* g, uint16_t a, uint16_t b)
+{
+	return (int32_t)(g->sdb.ltime[a] - g->sdb.ltime[b]) < 0;
+}
+
+static void deadlineSwap(system_game_t* g, uint16_t p, uint16_t q)
+{
+	uint16_t s = g->dl_heap[p];
+
+	g->dl_heap[p] = g->dl_heap[q];
+	g->dl_heap[q] = s;
+	g->dl_pos[g->dl_heap[p]] = p;
+	g->dl_pos[g->dl_heap[q]] = q;
+}
 
+// Moves the slot at heap position 'pos' up or down until the heap order holds.
+static void deadlineSift(system_game_t* g, uint16_t pos)
+{
+	uint16_t c;
+
+	while(pos > 0 && deadlineBefore(g, g->dl_heap[pos], g->dl_heap[(pos - 1) / 2]))
+	{
+		deadlineSwap(g, pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
 	for(;;)
 	{
-		xloc = randomNumber(GRID_LOWER_BOUND, GRID_UPPER_BOUND);
-		yloc = randomNumber(GRID_LOWER_BOUND, GRID_UPPER_BOUND);
-
-        dist = distToCrane(xloc, yloc);
-        if(dist >= 10 && dist <= 25) //TODO get rid of magic numbers.
-        {
-
-		    // Check that no other ship is in this location
-		    for(k=0;k<MAX_SHIPS;k++)
-		    {
-			    if(ship_db[k].shipInGame)
-			    {
-				    if(ship_db[k].x_coordinate == xloc && ship_db[k].y_coordinate == yloc)
-				    {
-					    break ; // Found a matching ship, get new coordinates
-				    }
-			    }
-		    }
-
-		    if(k>=MAX_SHIPS)break; // Unique coordinates, break loop
-		    else ; // Another ship already in this location, do loop again
-		}
-		else ; // Too close to crane or too far from crane, do loop again
+		c = 2 * pos + 1;
+		if(c >= g->dl_count)break;
+		if(c + 1 < g->dl_count && deadlineBefore(g, g->dl_heap[c + 1], g->dl_heap[c]))c++;
+		if(!deadlineBefore(g, g->dl_heap[c], g->dl_heap[pos]))break;
+		deadlineSwap(g, pos, c);
+		pos = c;
 	}
+}
+
+static void deadlineAdd(system_game_t* g, uint16_t index)
+{
+	g->dl_heap[g->dl_count] = index;
+	g->dl_pos[index] = g->dl_count;
+	deadlineSift(g, g->dl_count++);
+}
+
+static void deadlineRemove(system_game_t* g, uint16_t index)
+{
+	uint16_t pos = g->dl_pos[index];
+
+	if(--g->dl_count == pos)return; // Was last
+	deadlineSwap(g, pos, g->dl_count);
+	deadlineSift(g, pos);
+}
+
+// Picks a random free location in the annulus around the crane for ship in slot 'index'.
+// Returns false if there is no free location.
+static bool genNewCoordinates(system_game_t* g, uint16_t index)
+{
+	uint16_t k;
+	loc_bundle_t center = getCraneLocation(g->game);
+
+	if(!g->annulus_valid || center.x != g->annulus_center.x || center.y != g->annulus_center.y)buildAnnulus(g, center);
+	if(g->annulus_count == 0)return false;
+
+	k = prngRange(&g->rng, 0, g->annulus_count - 1);
+	g->sdb.x[index] = g->annulus_cells[k].x;
+	g->sdb.y[index] = g->annulus_cells[k].y;
+	g->annulus_cells[k] = g->annulus_cells[--g->annulus_count]; // Cell is taken
+	return true;
+}
 
-	ship_db[index].x_coordinate = xloc;
-	ship_db[index].y_coordinate = yloc;		
+// Collects all free grid cells at distance SHIP_MIN_DIST..SHIP_MAX_DIST from 'center'.
+static void buildAnnulus(system_game_t* g, loc_bundle_t center)
+{
+	int16_t d, k, i, x, y;
+	// Ring sides start at the top, right, bottom and left corner and run clockwise
+	const int8_t sx[4] = {0, 1, 0, -1}, sy[4] = {1, 0, -1, 0};
+	const int8_t dx[4] = {1, -1, -1, 1}, dy[4] = {-1, -1, 1, 1};
+
+	g->annulus_count = 0;
+	for(d=SHIP_MIN_DIST;d<=SHIP_MAX_DIST;d++)
+	{
+		for(i=0;i<4;i++)for(k=0;k<d;k++)
+		{
+			x = center.x + sx[i] * d + dx[i] * k;
+			y = center.y + sy[i] * d + dy[i] * k;
+			if(x < GRID_LOWER_BOUND || x > GRID_UPPER_BOUND || y < GRID_LOWER_BOUND || y > GRID_UPPER_BOUND)continue;
+			if(g->sdb_grid[x][y] < SDB_MAX_SHIPS)continue; // Another ship already in this location
+			g->annulus_cells[g->annulus_count].x = x;
+			g->annulus_cells[g->annulus_count].y = y;
+			g->annulus_count++;
+		}
+	}
+	g->annulus_center = center;
+	g->annulus_valid = true;
 }
 
-static void genLoadTime(uint8_t index)
+static void genLoadTime(system_game_t* g, uint16_t index)
 {
 	//TODO magic numbers!
 	uint32_t ldkt, dist, min_d_time, max_d_time;
 
-    dist = distToCrane(ship_db[index].x_coordinate, ship_db[index].y_coordinate);
+    dist = distToCrane(g, g->sdb.x[index], g->sdb.y[index]);
     
     min_d_time = 3 * dist * CRANE_UPDATE_INTERVAL;
     max_d_time = 4 * dist * CRANE_UPDATE_INTERVAL;
     	
-	ldkt = randomNumber(min_d_time, max_d_time) * osKernelGetTickFreq();
+	ldkt = prngRange(&g->rng, min_d_time, max_d_time) * osKernelGetTickFreq();
 	ldkt += osKernelGetTickCount();
 
-	if(ldkt > global_load_deadline)ldkt = global_load_deadline; // Sry, your time is cut short
-	ship_db[index].ltime = ldkt;
+	if(ldkt > g->global_load_deadline)ldkt = g->global_load_deadline; // Sry, your time is cut short
+	g->sdb.ltime[index] = ldkt;
 }
 
-static uint8_t getEmptySlot()
+// Returns the lowest free slot or SDB_MAX_SHIPS if the database is full.
+static uint16_t getEmptySlot(system_game_t* g)
 {
-	uint8_t k;
-	for(k=0;k<MAX_SHIPS;k++)if(!(ship_db[k].shipInGame))break;
-	return k;
+	uint16_t w, i;
+
+	for(w=0;w<SDB_WORDS;w++)if(~g->sdb.in_game[w] != 0)
+	{
+		i = w * SDB_WORD_BITS + __builtin_ctz(~g->sdb.in_game[w]);
+		return i < SDB_MAX_SHIPS ? i : SDB_MAX_SHIPS;
+	}
+	return SDB_MAX_SHIPS;
 }
 
-static uint8_t getAllShips(am_addr_t buf[], uint8_t len)
+// Returns the address index slot where the probe sequence for 'addr' starts.
+static uint16_t hashHome(am_addr_t addr)
 {
-	uint8_t i, u=0;
-	for(i=0;i<MAX_SHIPS;i++)if(ship_db[i].shipInGame)
+	return (uint16_t)((((uint32_t)addr * 2654435761UL) >> 16) % SDB_HASH_SIZE);
+}
+
+// Returns address index slot of ship with address 'addr' or the empty slot where it would be added.
+static uint16_t hashSlot(system_game_t* g, am_addr_t addr)
+{
+	uint16_t h = hashHome(addr);
+
+	while(g->sdb_hash[h] < SDB_MAX_SHIPS && g->sdb.addr[g->sdb_hash[h]] != addr)
 	{
-		if(u<len)buf[u++]=ship_db[i].shipAddr;
-		else break;
+		if(++h >= SDB_HASH_SIZE)h = 0;
 	}
-	return u;
+	return h;
+}
+
+// Adds ship in database slot 'index' to address index and location map.
+static void addToIndex(system_game_t* g, uint16_t index)
+{
+	g->sdb_grid[g->sdb.x[index]][g->sdb.y[index]] = index;
+	g->sdb_hash[hashSlot(g, g->sdb.addr[index])] = index;
+}
+
+// Removes ship in database slot 'index' from address index and location map. Entries
+// further along the probe sequence are shifted back, so that no lookup stops early.
+static void removeFromIndex(system_game_t* g, uint16_t index)
+{
+	uint16_t hole = hashSlot(g, g->sdb.addr[index]), j = hole, home;
+
+	g->sdb_grid[g->sdb.x[index]][g->sdb.y[index]] = SDB_MAX_SHIPS;
+	for(;;)
+	{
+		if(++j >= SDB_HASH_SIZE)j = 0;
+		if(g->sdb_hash[j] >= SDB_MAX_SHIPS)break; // End of probe sequence
+		home = hashHome(g->sdb.addr[g->sdb_hash[j]]);
+		// Entry at 'j' stays if its home is cyclically in (hole, j]
+		if(hole <= j ? (hole < home && home <= j) : (hole < home || home <= j))continue;
+		g->sdb_hash[hole] = g->sdb_hash[j];
+		hole = j;
+	}
+	g->sdb_hash[hole] = SDB_MAX_SHIPS;
+}
+
+static bool testBit(const sdb_word_t set[], uint16_t i)
+{
+	return (set[i / SDB_WORD_BITS] >> (i % SDB_WORD_BITS)) & 1;
+}
+
+static void setBit(sdb_word_t set[], uint16_t i)
+{
+	set[i / SDB_WORD_BITS] |= (sdb_word_t)1 << (i % SDB_WORD_BITS);
 }
 
-static uint8_t getAllCargo(am_addr_t buf[], uint8_t len)
+static void clearBit(sdb_word_t set[], uint16_t i)
 {
-	uint8_t i, u=0;
-	for(i=0;i<MAX_SHIPS;i++)if(ship_db[i].shipInGame && ship_db[i].isCargoLoaded)
+	set[i / SDB_WORD_BITS] &= ~((sdb_word_t)1 << (i % SDB_WORD_BITS));
+}
+
+// Fills 'buf' with addresses of ships in slots set in bitset 'set', lowest slot first.
+static uint8_t getShipsIn(system_game_t* g, const sdb_word_t set[], am_addr_t buf[], uint8_t len)
+{
+	uint8_t u=0;
+	uint16_t w;
+	sdb_word_t bits;
+	for(w=0;w<SDB_WORDS && u<len;w++)
 	{
-		if(u<len)buf[u++]=ship_db[i].shipAddr;
-		else break;
+		for(bits=set[w];bits != 0 && u<len;bits &= bits - 1) // Clear lowest set bit
+		{
+			buf[u++] = g->sdb.addr[w * SDB_WORD_BITS + __builtin_ctz(bits)];
+		}
 	}
 	return u;
 }
 
-// Random number between rndL and rndH (rndL <= rnd <=rndH)
-// Only positive values
-// User must provide correct arguments, such that 0 <= rndL < rndH
+static uint8_t getAllShips(system_game_t* g, am_addr_t buf[], uint8_t len)
+{
+	return getShipsIn(g, g->sdb.in_game, buf, len);
+}
 
-static uint32_t randomNumber(uint32_t rndL, uint32_t rndH)
+static uint8_t getAllCargo(system_game_t* g, am_addr_t buf[], uint8_t len)
 {
-	uint32_t range = rndH + 1 - rndL;
-	return rand() % range + rndL;
+	return getShipsIn(g, g->sdb.cargo, buf, len); // Cargo is only set for ships in game
 }
 
-static uint32_t distToCrane(uint32_t x, uint32_t y)
+static uint32_t distToCrane(system_game_t* g, uint32_t x, uint32_t y)
 {
-	static uint16_t dist;
+	uint16_t dist;
 	loc_bundle_t cloc;
-    cloc = getCraneLocation();
+    cloc = getCraneLocation(g->game);
 	dist = abs(cloc.x - x) + abs(cloc.y - y);
 	return dist;
 }
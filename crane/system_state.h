@@ -8,7 +8,19 @@
 #ifndef SYSTEM_STATE_H_
 #define SYSTEM_STATE_H_
 
-// Ship database
+// Capacity of the ship database. Defaults to MAX_SHIPS, can be raised at
+// compile time for large fleets. Ship list responses still carry at most
+// MAX_SHIPS addresses.
+#ifndef SDB_MAX_SHIPS
+#define SDB_MAX_SHIPS MAX_SHIPS
+#endif
+
+// Number of independent games one crane-agent can host, see CLG_GAME_AMID.
+#ifndef CLG_MAX_GAMES
+#define CLG_MAX_GAMES 1
+#endif
+
+// Ship record, see getShip
 typedef struct {
 	bool shipInGame;
 	am_addr_t shipAddr;
@@ -22,28 +34,40 @@ typedef struct {
  *	Initialise module
  **********************************************************************************************/
 
-void initSystem(comms_layer_t* radio, am_addr_t my_addr);
+// Initialises ship database of game 'game' (0..CLG_MAX_GAMES-1) and starts its threads.
+void initSystem(uint8_t game, comms_layer_t* radio, am_addr_t my_addr);
+
+// Sets the random number seed of game 'game', call after initSystem and before the game
+// starts. Without it the
+// game is seeded with the Kernel tick count of its first message.
+void setGameSeed(uint8_t game, uint32_t seed);
 
 /**********************************************************************************************
  *	Message receiving
  **********************************************************************************************/
 
+// Register for CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, game) with user CLG_GAME_USER(game).
 void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* user);
 
 /**********************************************************************************************
  *	Utility functions
  **********************************************************************************************/
 
-// Returns buffer index of ship with address 'id' or value MAX_SHIPS if no such ship.
-uint8_t getIndex(am_addr_t ship_addr);
+// Returns buffer index of ship with address 'id' or value SDB_MAX_SHIPS if no such ship.
+// This function can block.
+uint16_t getIndex(uint8_t game, am_addr_t ship_addr);
 
 // Marks cargo status as true for ship with address 'addr', if such a ship is found.
 // Use with care! There is no revers command to mark cargo status false.
 // This function can block.
-void markCargo(am_addr_t addr);
+void markCargo(uint8_t game, am_addr_t addr);
 
 // Returns address of ship in location 'x', 'y' or 0 if no ship in this location.
 // This function can block.
-am_addr_t isShipHere(uint8_t x, uint8_t y);
+am_addr_t isShipHere(uint8_t game, uint8_t x, uint8_t y);
+
+// Copies database record of ship with address 'addr' to 'ship'.
+// Returns false if no such ship. This function can block.
+bool getShip(uint8_t game, am_addr_t addr, sdb_t* ship);
 
 #endif//SYSTEM_STATE_H_
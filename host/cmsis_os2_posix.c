@@ -0,0 +1,724 @@
+/**
+ *
+ * This is a pthread backed implementation of the CMSIS-RTOS2 calls used by
+ * the crane-agent and ship-agent modules. It allows the agents to be built
+ * and run as ordinary Linux processes (see host/Makefile).
+ *
+ * All kernel objects are protected by a single kernel lock, much like an
+ * RTOS protects its ready and wait lists by disabling the scheduler. A thread
+ * that has to block is linked into the wait list of the object it is waiting
+ * for and sleeps on its own condition variable. Whoever changes the object
+ * state wakes up all threads on the object wait list, those threads then
+ * re-check the condition they were waiting for.
+ *
+ * Kernel tick frequency is 1000 Hz, tick count starts from zero at
+ * osKernelInitialize.
+ *
+ * Threads created before osKernelStart do not run until the kernel is
+ * started, same as on the target.
+ *
+ * Virtual time (see osHostSetVirtualTime in cmsis_os2_host.h):
+ * 		The tick count is not taken from the system clock but is advanced by
+ * 		the kernel itself, discrete-event style. The kernel keeps count of
+ * 		threads that are not blocked. When the last running thread blocks,
+ * 		the tick count jumps straight to the nearest deadline of a blocked
+ * 		thread (osDelay or a wait timeout) and the threads whose deadline it
+ * 		is are woken up. Time passes only while everybody waits, so the same
+ * 		thread interactions take place as in real time, only without the
+ * 		idle periods in between. All threads that interact with the agents
+ * 		must be kernel threads for this to work, i.e. use the local radio bus.
+ *
+ * Limitations:
+ * 		- thread priorities are ignored
+ * 		- osThreadTerminate can only terminate the calling thread
+ * 		- message priorities are ignored, messages are always FIFO
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "cmsis_os2.h"
+#include "cmsis_os2_host.h"
+
+#define K_TICK_FREQ 1000U
+
+typedef struct k_thread k_thread_t;
+
+typedef struct {
+	k_thread_t *head;
+} k_waitq_t;
+
+struct k_thread {
+	pthread_t pt;
+	pthread_cond_t cv;
+	const char *name;
+	osThreadFunc_t func;
+	void *arg;
+
+	k_waitq_t *wq;				// Wait list this thread is currently linked into
+	k_thread_t *wprev, *wnext;
+	bool woken;
+	bool expired;				// Woken because deadline passed
+
+	uint32_t deadline;			// Virtual time wakeup tick, if linked into k_timed
+	k_thread_t *tprev, *tnext;
+	bool timed;
+
+	uint32_t flags;				// Thread flags
+	k_waitq_t flags_wq;
+};
+
+typedef struct {
+	k_thread_t *owner;
+	uint32_t count;
+	bool recursive;
+	k_waitq_t wq;
+} k_mutex_t;
+
+typedef struct {
+	uint32_t flags;
+	k_waitq_t wq;
+} k_evflags_t;
+
+typedef struct {
+	uint32_t msg_count;
+	uint32_t msg_size;
+	uint32_t head, count;
+	uint8_t *buf;
+	k_waitq_t wq;
+} k_msgq_t;
+
+static pthread_mutex_t k_lock = PTHREAD_MUTEX_INITIALIZER;
+static osKernelState_t k_state = osKernelInactive;
+static struct timespec k_epoch;
+static k_waitq_t k_start_wq;	// Threads waiting for osKernelStart
+static k_waitq_t k_delay_wq;	// Threads in osDelay, never woken explicitly
+
+static bool k_virtual = false;	// Virtual time mode
+static uint32_t k_vticks;		// Virtual time tick count
+static uint32_t k_running;		// Kernel threads that are not blocked
+static k_thread_t *k_timed;		// Blocked threads with a deadline, virtual time only
+
+static __thread k_thread_t *k_current;
+
+/**********************************************************************************************
+ *	Internal functions, k_lock must be held
+ **********************************************************************************************/
+
+static uint32_t k_ticks()
+{
+	struct timespec now;
+	if(k_virtual)return k_vticks;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)((now.tv_sec - k_epoch.tv_sec) * 1000LL + (now.tv_nsec - k_epoch.tv_nsec) / 1000000LL);
+}
+
+static void k_tick_to_timespec(uint32_t tick, struct timespec *ts)
+{
+	uint64_t ns = (uint64_t)k_epoch.tv_nsec + (uint64_t)tick * 1000000ULL;
+	ts->tv_sec = k_epoch.tv_sec + (time_t)(ns / 1000000000ULL);
+	ts->tv_nsec = (long)(ns % 1000000000ULL);
+}
+
+static k_thread_t* k_thread_alloc(const char *name)
+{
+	pthread_condattr_t ca;
+	k_thread_t *t = calloc(1, sizeof(k_thread_t));
+	if(t == NULL)return NULL;
+
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->cv, &ca);
+	pthread_condattr_destroy(&ca);
+	t->name = name;
+	return t;
+}
+
+// Threads that were not created with osThreadNew (main thread, radio socket
+// threads) get a control block the first time they need one.
+static k_thread_t* k_self()
+{
+	if(k_current == NULL)
+	{
+		k_current = k_thread_alloc("foreign");
+		if(k_current != NULL)k_current->pt = pthread_self();
+	}
+	return k_current;
+}
+
+static void k_untime(k_thread_t *t)
+{
+	if(!t->timed)return;
+	if(t->tprev != NULL)t->tprev->tnext = t->tnext;
+	else k_timed = t->tnext;
+	if(t->tnext != NULL)t->tnext->tprev = t->tprev;
+	t->timed = false;
+	t->tprev = t->tnext = NULL;
+}
+
+static void k_unlink(k_thread_t *t)
+{
+	k_untime(t);
+	if(t->wq == NULL)return;
+	if(t->wprev != NULL)t->wprev->wnext = t->wnext;
+	else t->wq->head = t->wnext;
+	if(t->wnext != NULL)t->wnext->wprev = t->wprev;
+	t->wq = NULL;
+	t->wprev = t->wnext = NULL;
+}
+
+static void k_wake_all(k_waitq_t *wq)
+{
+	k_thread_t *t;
+	while((t = wq->head) != NULL)
+	{
+		k_unlink(t);
+		t->woken = true;
+		k_running++;
+		pthread_cond_signal(&t->cv);
+	}
+}
+
+// Virtual time: called when no thread is running, moves the tick count to the
+// nearest deadline and wakes up all threads that are due.
+static void k_advance()
+{
+	k_thread_t *t, *next;
+	uint32_t nearest;
+
+	if(k_timed == NULL)return; // Everybody waits forever, nothing will ever happen
+
+	nearest = k_timed->deadline;
+	for(t = k_timed->tnext;t != NULL;t = t->tnext)
+	{
+		if((int32_t)(t->deadline - nearest) < 0)nearest = t->deadline;
+	}
+	if((int32_t)(nearest - k_vticks) > 0)k_vticks = nearest;
+
+	for(t = k_timed;t != NULL;t = next)
+	{
+		next = t->tnext;
+		if((int32_t)(t->deadline - k_vticks) <= 0)
+		{
+			k_unlink(t);
+			t->woken = true;
+			t->expired = true;
+			k_running++;
+			pthread_cond_signal(&t->cv);
+		}
+	}
+}
+
+// A thread stops running, either blocks or exits
+static void k_stop_running()
+{
+	k_running--;
+	if(k_virtual && k_running == 0)k_advance();
+}
+
+// Blocks calling thread on wait list 'wq' until it is woken or the kernel tick
+// count reaches 'deadline'. Returns false if the deadline passed.
+static bool k_block(k_waitq_t *wq, uint32_t deadline, bool forever)
+{
+	struct timespec ts;
+	k_thread_t *t = k_self();
+
+	t->woken = false;
+	t->expired = false;
+	t->wq = wq;
+	t->wprev = NULL;
+	t->wnext = wq->head;
+	if(wq->head != NULL)wq->head->wprev = t;
+	wq->head = t;
+
+	if(k_virtual)
+	{
+		if(!forever)
+		{
+			t->deadline = deadline;
+			t->timed = true;
+			t->tprev = NULL;
+			t->tnext = k_timed;
+			if(k_timed != NULL)k_timed->tprev = t;
+			k_timed = t;
+		}
+		k_stop_running();
+		while(!t->woken)pthread_cond_wait(&t->cv, &k_lock);
+		return !t->expired;
+	}
+
+	k_running--;
+	if(!forever)k_tick_to_timespec(deadline, &ts);
+	while(!t->woken)
+	{
+		if(forever)pthread_cond_wait(&t->cv, &k_lock);
+		else if(pthread_cond_timedwait(&t->cv, &k_lock, &ts) == ETIMEDOUT && !t->woken)
+		{
+			k_unlink(t);
+			k_running++;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Converts a relative timeout to an absolute deadline for k_block
+static uint32_t k_deadline(uint32_t timeout)
+{
+	return k_ticks() + timeout;
+}
+
+static bool k_expired(uint32_t deadline)
+{
+	return (int32_t)(deadline - k_ticks()) <= 0;
+}
+
+static void* k_thread_start(void *arg)
+{
+	k_thread_t *t = (k_thread_t*)arg;
+
+	k_current = t;
+	pthread_mutex_lock(&k_lock);
+	while(k_state != osKernelRunning)k_block(&k_start_wq, 0, true);
+	pthread_mutex_unlock(&k_lock);
+
+	t->func(t->arg);
+
+	pthread_mutex_lock(&k_lock);
+	k_stop_running();
+	pthread_mutex_unlock(&k_lock);
+	return NULL;
+}
+
+// Common flags wait logic for thread flags and event flags
+static uint32_t k_flags_wait(uint32_t *word, k_waitq_t *wq, uint32_t flags, uint32_t options, uint32_t timeout)
+{
+	uint32_t deadline = k_deadline(timeout);
+	uint32_t current;
+	bool match;
+
+	for(;;)
+	{
+		current = *word;
+		if(options & osFlagsWaitAll)match = (current & flags) == flags;
+		else match = (current & flags) != 0;
+
+		if(match)
+		{
+			if(!(options & osFlagsNoClear))*word &= ~flags;
+			return current;
+		}
+
+		if(timeout == 0)return osFlagsErrorResource;
+		if(timeout != osWaitForever && k_expired(deadline))return osFlagsErrorTimeout;
+		if(!k_block(wq, deadline, timeout == osWaitForever))return osFlagsErrorTimeout;
+	}
+}
+
+/**********************************************************************************************
+ *	Kernel
+ **********************************************************************************************/
+
+osStatus_t osKernelInitialize(void)
+{
+	pthread_mutex_lock(&k_lock);
+	if(k_state != osKernelInactive)
+	{
+		pthread_mutex_unlock(&k_lock);
+		return osError;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &k_epoch);
+	k_vticks = 0;
+	k_self(); // Calling thread becomes a kernel thread
+	k_running = 1;
+	k_state = osKernelReady;
+	pthread_mutex_unlock(&k_lock);
+	return osOK;
+}
+
+osKernelState_t osKernelGetState(void)
+{
+	osKernelState_t state;
+	pthread_mutex_lock(&k_lock);
+	state = k_state;
+	pthread_mutex_unlock(&k_lock);
+	return state;
+}
+
+// Releases all threads created so far and blocks the caller forever,
+// the same way the target never returns from osKernelStart.
+osStatus_t osKernelStart(void)
+{
+	pthread_mutex_lock(&k_lock);
+	if(k_state != osKernelReady)
+	{
+		pthread_mutex_unlock(&k_lock);
+		return osError;
+	}
+	k_state = osKernelRunning;
+	k_wake_all(&k_start_wq);
+	for(;;)k_block(&k_delay_wq, 0, true);
+}
+
+uint32_t osKernelGetTickCount(void)
+{
+	uint32_t ticks;
+	pthread_mutex_lock(&k_lock);
+	ticks = k_ticks();
+	pthread_mutex_unlock(&k_lock);
+	return ticks;
+}
+
+uint32_t osKernelGetTickFreq(void)
+{
+	return K_TICK_FREQ;
+}
+
+/**********************************************************************************************
+ *	Threads
+ **********************************************************************************************/
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr)
+{
+	pthread_attr_t pa;
+	k_thread_t *t;
+
+	if(func == NULL)return NULL;
+
+	t = k_thread_alloc(attr != NULL ? attr->name : NULL);
+	if(t == NULL)return NULL;
+	t->func = func;
+	t->arg = argument;
+
+	pthread_mutex_lock(&k_lock);
+	k_running++; // Counted as running from creation, so time does not move while it starts up
+	pthread_mutex_unlock(&k_lock);
+
+	pthread_attr_init(&pa);
+	pthread_attr_setdetachstate(&pa, PTHREAD_CREATE_DETACHED);
+	if(attr != NULL && attr->stack_size != 0)pthread_attr_setstacksize(&pa, attr->stack_size < 16384 ? 16384 : attr->stack_size);
+	if(pthread_create(&t->pt, &pa, k_thread_start, t) != 0)
+	{
+		pthread_mutex_lock(&k_lock);
+		k_stop_running();
+		pthread_mutex_unlock(&k_lock);
+		pthread_attr_destroy(&pa);
+		pthread_cond_destroy(&t->cv);
+		free(t);
+		return NULL;
+	}
+	pthread_attr_destroy(&pa);
+	return (osThreadId_t)t;
+}
+
+osThreadId_t osThreadGetId(void)
+{
+	osThreadId_t id;
+	pthread_mutex_lock(&k_lock);
+	id = (osThreadId_t)k_self();
+	pthread_mutex_unlock(&k_lock);
+	return id;
+}
+
+osStatus_t osThreadTerminate(osThreadId_t thread_id)
+{
+	if(thread_id == NULL)return osErrorParameter;
+	if(thread_id != (osThreadId_t)k_current)return osErrorResource; // Only self termination is supported
+
+	pthread_mutex_lock(&k_lock);
+	k_stop_running();
+	pthread_mutex_unlock(&k_lock);
+	pthread_exit(NULL);
+}
+
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags)
+{
+	k_thread_t *t = (k_thread_t*)thread_id;
+	uint32_t current;
+
+	if(t == NULL || (flags & osFlagsError))return osFlagsErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	t->flags |= flags;
+	current = t->flags;
+	k_wake_all(&t->flags_wq);
+	pthread_mutex_unlock(&k_lock);
+	return current;
+}
+
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout)
+{
+	k_thread_t *t;
+	uint32_t ret;
+
+	if(flags & osFlagsError)return osFlagsErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	t = k_self();
+	ret = k_flags_wait(&t->flags, &t->flags_wq, flags, options, timeout);
+	pthread_mutex_unlock(&k_lock);
+	return ret;
+}
+
+osStatus_t osDelay(uint32_t ticks)
+{
+	uint32_t deadline;
+
+	if(ticks == 0)return osErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	deadline = k_deadline(ticks);
+	while(k_block(&k_delay_wq, deadline, false)); // Nobody wakes the delay list, but be safe
+	pthread_mutex_unlock(&k_lock);
+	return osOK;
+}
+
+/**********************************************************************************************
+ *	Mutexes
+ **********************************************************************************************/
+
+osMutexId_t osMutexNew(const osMutexAttr_t *attr)
+{
+	k_mutex_t *m = calloc(1, sizeof(k_mutex_t));
+	if(m == NULL)return NULL;
+	m->recursive = (attr != NULL) && (attr->attr_bits & osMutexRecursive);
+	return (osMutexId_t)m;
+}
+
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout)
+{
+	k_mutex_t *m = (k_mutex_t*)mutex_id;
+	k_thread_t *t;
+	uint32_t deadline;
+
+	if(m == NULL)return osErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	t = k_self();
+	deadline = k_deadline(timeout);
+	for(;;)
+	{
+		if(m->owner == NULL)
+		{
+			m->owner = t;
+			m->count = 1;
+			break;
+		}
+		if(m->owner == t)
+		{
+			if(!m->recursive)
+			{
+				pthread_mutex_unlock(&k_lock);
+				return osErrorResource;
+			}
+			m->count++;
+			break;
+		}
+		if(timeout == 0)
+		{
+			pthread_mutex_unlock(&k_lock);
+			return osErrorResource;
+		}
+		if(!k_block(&m->wq, deadline, timeout == osWaitForever))
+		{
+			pthread_mutex_unlock(&k_lock);
+			return osErrorTimeout;
+		}
+	}
+	pthread_mutex_unlock(&k_lock);
+	return osOK;
+}
+
+osStatus_t osMutexRelease(osMutexId_t mutex_id)
+{
+	k_mutex_t *m = (k_mutex_t*)mutex_id;
+
+	if(m == NULL)return osErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	if(m->owner != k_self())
+	{
+		pthread_mutex_unlock(&k_lock);
+		return osErrorResource;
+	}
+	if(--m->count == 0)
+	{
+		m->owner = NULL;
+		k_wake_all(&m->wq);
+	}
+	pthread_mutex_unlock(&k_lock);
+	return osOK;
+}
+
+/**********************************************************************************************
+ *	Event flags
+ **********************************************************************************************/
+
+osEventFlagsId_t osEventFlagsNew(const osEventFlagsAttr_t *attr)
+{
+	return (osEventFlagsId_t)calloc(1, sizeof(k_evflags_t));
+}
+
+uint32_t osEventFlagsSet(osEventFlagsId_t ef_id, uint32_t flags)
+{
+	k_evflags_t *ef = (k_evflags_t*)ef_id;
+	uint32_t current;
+
+	if(ef == NULL || (flags & osFlagsError))return osFlagsErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	ef->flags |= flags;
+	current = ef->flags;
+	k_wake_all(&ef->wq);
+	pthread_mutex_unlock(&k_lock);
+	return current;
+}
+
+uint32_t osEventFlagsClear(osEventFlagsId_t ef_id, uint32_t flags)
+{
+	k_evflags_t *ef = (k_evflags_t*)ef_id;
+	uint32_t current;
+
+	if(ef == NULL || (flags & osFlagsError))return osFlagsErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	current = ef->flags;
+	ef->flags &= ~flags;
+	pthread_mutex_unlock(&k_lock);
+	return current;
+}
+
+uint32_t osEventFlagsWait(osEventFlagsId_t ef_id, uint32_t flags, uint32_t options, uint32_t timeout)
+{
+	k_evflags_t *ef = (k_evflags_t*)ef_id;
+	uint32_t ret;
+
+	if(ef == NULL || (flags & osFlagsError))return osFlagsErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	ret = k_flags_wait(&ef->flags, &ef->wq, flags, options, timeout);
+	pthread_mutex_unlock(&k_lock);
+	return ret;
+}
+
+/**********************************************************************************************
+ *	Message queues
+ **********************************************************************************************/
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t *attr)
+{
+	k_msgq_t *q;
+
+	if(msg_count == 0 || msg_size == 0)return NULL;
+
+	q = calloc(1, sizeof(k_msgq_t));
+	if(q == NULL)return NULL;
+	q->buf = malloc((size_t)msg_count * msg_size);
+	if(q->buf == NULL)
+	{
+		free(q);
+		return NULL;
+	}
+	q->msg_count = msg_count;
+	q->msg_size = msg_size;
+	return (osMessageQueueId_t)q;
+}
+
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void *msg_ptr, uint8_t msg_prio, uint32_t timeout)
+{
+	k_msgq_t *q = (k_msgq_t*)mq_id;
+	uint32_t deadline;
+
+	if(q == NULL || msg_ptr == NULL)return osErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	deadline = k_deadline(timeout);
+	while(q->count >= q->msg_count)
+	{
+		if(timeout == 0)
+		{
+			pthread_mutex_unlock(&k_lock);
+			return osErrorResource;
+		}
+		if(!k_block(&q->wq, deadline, timeout == osWaitForever))
+		{
+			pthread_mutex_unlock(&k_lock);
+			return osErrorTimeout;
+		}
+	}
+	memcpy(q->buf + (size_t)((q->head + q->count) % q->msg_count) * q->msg_size, msg_ptr, q->msg_size);
+	q->count++;
+	k_wake_all(&q->wq);
+	pthread_mutex_unlock(&k_lock);
+	return osOK;
+}
+
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void *msg_ptr, uint8_t *msg_prio, uint32_t timeout)
+{
+	k_msgq_t *q = (k_msgq_t*)mq_id;
+	uint32_t deadline;
+
+	if(q == NULL || msg_ptr == NULL)return osErrorParameter;
+
+	pthread_mutex_lock(&k_lock);
+	deadline = k_deadline(timeout);
+	while(q->count == 0)
+	{
+		if(timeout == 0)
+		{
+			pthread_mutex_unlock(&k_lock);
+			return osErrorResource;
+		}
+		if(!k_block(&q->wq, deadline, timeout == osWaitForever))
+		{
+			pthread_mutex_unlock(&k_lock);
+			return osErrorTimeout;
+		}
+	}
+	memcpy(msg_ptr, q->buf + (size_t)q->head * q->msg_size, q->msg_size);
+	q->head = (q->head + 1) % q->msg_count;
+	q->count--;
+	if(msg_prio != NULL)*msg_prio = 0;
+	k_wake_all(&q->wq);
+	pthread_mutex_unlock(&k_lock);
+	return osOK;
+}
+
+uint32_t osMessageQueueGetCount(osMessageQueueId_t mq_id)
+{
+	k_msgq_t *q = (k_msgq_t*)mq_id;
+	uint32_t count;
+
+	if(q == NULL)return 0;
+
+	pthread_mutex_lock(&k_lock);
+	count = q->count;
+	pthread_mutex_unlock(&k_lock);
+	return count;
+}
+
+/**********************************************************************************************
+ *	Host extensions
+ **********************************************************************************************/
+
+osStatus_t osHostSetVirtualTime(bool enable)
+{
+	osStatus_t status = osOK;
+	pthread_mutex_lock(&k_lock);
+	if(k_state == osKernelInactive)k_virtual = enable;
+	else status = osError;
+	pthread_mutex_unlock(&k_lock);
+	return status;
+}
+
+bool osHostIsVirtualTime(void)
+{
+	return k_virtual;
+}
@@ -0,0 +1,145 @@
+/**
+ *
+ * This is the main function of the host (Linux) build of the crane-agent.
+ * It composes the same game engine and crane state handler as the target
+ * build (see crane/crane_main.c), but runs on the POSIX CMSIS-RTOS2 shim
+ * and the loopback radio.
+ *
+ * Usage: clg-crane-host [address] [journal]
+ *
+ * 'address' is the node address in hex, default is CRANE_ADDR. If 'journal'
+ * is given, the games are recorded to that journal file, see clg-replay. The loopback
+ * bus directory can be changed with environment variable CLG_BUS_DIR.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "cmsis_os2.h"
+
+#include "mist_comm_am.h"
+#include "radio.h"
+
+#include "host_loglevels.h"
+#define __MODUUL__ "cmain"
+#define __LOG_LEVEL__ (LOG_LEVEL_crane_host & BASE_LOG_LEVEL)
+#include "log.h"
+
+#include "system_state.h"
+#include "crane_state.h"
+#include "latency.h"
+#include "clg_comm.h"
+#include "journal_file.h"
+
+#define M_HEARTBEAT_INTERVAL 60		// Heartbeat interval, seconds
+#define M_LATENCY_DUMP_INTERVAL 60	// Latency histogram dump interval, seconds
+
+static am_addr_t node_addr = CRANE_ADDR;
+static const char* journal_path;
+
+static void radio_start_done (comms_layer_t * comms, comms_status_t status, void * user)
+{
+    debug1("Radio started %d", status);
+}
+
+// Perform basic radio setup
+static comms_layer_t* radio_setup (am_addr_t node_addr)
+{
+    static comms_receiver_t rcvr[CLG_MAX_GAMES], rcvr2[CLG_MAX_GAMES];
+    uint8_t game;
+    comms_layer_t * radio = radio_init(DEFAULT_RADIO_CHANNEL, 0x22, node_addr);
+    if (NULL == radio)
+    {
+        return NULL;
+    }
+
+    if (COMMS_SUCCESS != comms_start(radio, radio_start_done, NULL))
+    {
+        return NULL;
+    }
+
+    // Wait for radio to start
+    while(COMMS_STARTED != comms_status(radio))
+    {
+        osDelay(1);
+    }
+
+    for (game = 0; game < CLG_MAX_GAMES; game++)
+    {
+        comms_register_recv(radio, &rcvr[game], craneReceiveMessage, CLG_GAME_USER(game), CLG_GAME_AMID(AMID_CRANECOMMUNICATION, game));
+        comms_register_recv(radio, &rcvr2[game], systemReceiveMessage, CLG_GAME_USER(game), CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, game));
+    }
+
+    debug1("Radio rdy");
+    return radio;
+}
+
+// Setup loop - init radio, crane and system, print heartbeat
+static void setup_loop (void * arg)
+{
+    info1("ADDR:%04"PRIX16, node_addr);
+
+    // Initialize radio
+    comms_layer_t* radio = radio_setup(node_addr);
+    if (NULL == radio)
+    {
+        err1("Radio error");
+        exit(1);
+    }
+
+	if(journal_path != NULL && !initJournalFile(journal_path))
+	{
+		err1("Journal %s", journal_path);
+		exit(1);
+	}
+	initLatency(M_LATENCY_DUMP_INTERVAL);
+	for (uint8_t game = 0; game < CLG_MAX_GAMES; game++)
+	{
+		initCrane(game, radio, node_addr);
+		initSystem(game, radio, node_addr);
+	}
+
+    // Loop forever
+    for (;;)
+    {
+        osDelay(M_HEARTBEAT_INTERVAL*osKernelGetTickFreq());
+		info1("HB"); // Heartbeat
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc > 1)
+    {
+        node_addr = (am_addr_t)strtoul(argv[1], NULL, 16);
+    }
+    if (argc > 2)
+    {
+        journal_path = argv[2];
+    }
+
+    // Initialize OS kernel
+    osKernelInitialize();
+
+    info1("Cargo loading game host "VERSION_STR" (%d.%d.%d)", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
+
+    // Create a thread
+    const osThreadAttr_t setup_thread_attr = { .name = "setup" };
+    osThreadNew(setup_loop, NULL, &setup_thread_attr);
+
+    if (osKernelReady == osKernelGetState())
+    {
+        osKernelStart(); // This should never return
+    }
+    else
+    {
+        err1("!osKernelReady");
+    }
+
+    return 1;
+}
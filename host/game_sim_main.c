@@ -0,0 +1,203 @@
+/**
+ *
+ * This is the main function of the single process game simulator. It runs
+ * the crane-agent game engine (crane_state.c, system_state.c) and a simulated
+ * fleet of ships (ship_sim.c) in one process, connected by the local radio
+ * bus.
+ *
+ * By default the kernel runs in virtual time: whenever all threads wait, the
+ * tick count jumps straight to the next deadline, so a game runs as fast as
+ * the host can process its messages. Game semantics are unchanged, the crane
+ * still updates every CRANE_UPDATE_INTERVAL ticks of kernel time.
+ *
+ * After 'duration' seconds of game time the fleet statistics, the wall clock
+ * time used and the speed-up compared to real time are printed and the
+ * process exits.
+ *
+ * Usage: clg-game-sim [-n ships] [-g games] [-t duration] [-s seed] [-j journal] [-r]
+ *
+ * -g runs 'games' independent games (at most CLG_MAX_GAMES) on the same
+ * crane-agent, each with its own fleet of 'ships' ships.
+ * -s seeds game 'g' with 'seed' + g, so that runs can be repeated. By default
+ * every game is seeded when it starts, see setGameSeed.
+ * -j records the games to journal file 'journal', see clg-replay.
+ * -r runs the simulation in real time instead.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "cmsis_os2.h"
+#include "cmsis_os2_host.h"
+
+#include "mist_comm_am.h"
+#include "radio.h"
+
+#include "host_loglevels.h"
+#define __MODUUL__ "gsim"
+#define __LOG_LEVEL__ (LOG_LEVEL_game_sim & BASE_LOG_LEVEL)
+#include "log.h"
+
+#include "system_state.h"
+#include "crane_state.h"
+#include "latency.h"
+#include "clg_comm.h"
+#include "ship_sim.h"
+#include "journal_file.h"
+
+#define SIM_DEFAULT_SHIPS MAX_SHIPS
+#define SIM_DEFAULT_DURATION 1200	// Seconds of game time
+#define SIM_FIRST_SHIP_ADDR 0x0100
+
+static uint16_t fleet_size = SIM_DEFAULT_SHIPS;
+static uint8_t game_count = 1;
+static uint32_t duration = SIM_DEFAULT_DURATION;
+static bool seed_given;
+static uint32_t seed;
+static const char* journal_path;
+static struct timespec wall_start;
+
+static void radio_start_done (comms_layer_t * comms, comms_status_t status, void * user)
+{
+	debug1("Radio started %d", status);
+}
+
+static comms_layer_t* radio_setup (am_addr_t node_addr)
+{
+	static comms_receiver_t rcvr[CLG_MAX_GAMES], rcvr2[CLG_MAX_GAMES];
+	uint8_t game;
+	comms_layer_t * radio = radio_init(DEFAULT_RADIO_CHANNEL, 0x22, node_addr);
+	if (NULL == radio)
+	{
+		return NULL;
+	}
+
+	if (COMMS_SUCCESS != comms_start(radio, radio_start_done, NULL))
+	{
+		return NULL;
+	}
+
+	while(COMMS_STARTED != comms_status(radio))
+	{
+		osDelay(1);
+	}
+
+	for(game=0;game<game_count;game++)
+	{
+		comms_register_recv(radio, &rcvr[game], craneReceiveMessage, CLG_GAME_USER(game), CLG_GAME_AMID(AMID_CRANECOMMUNICATION, game));
+		comms_register_recv(radio, &rcvr2[game], systemReceiveMessage, CLG_GAME_USER(game), CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, game));
+	}
+	return radio;
+}
+
+static void setup_loop (void * arg)
+{
+	ship_sim_stats_t stats;
+	sim_fleet_t* fleets[CLG_MAX_GAMES] = {NULL};
+	uint32_t registered = 0, loaded = 0, departed = 0, delivered = 0, games = 0;
+	struct timespec wall_end;
+	double wall;
+	uint8_t game;
+
+	comms_layer_t* radio = radio_setup(CRANE_ADDR);
+	if (NULL == radio)
+	{
+		err1("Radio error");
+		exit(1);
+	}
+
+	if(journal_path != NULL && !initJournalFile(journal_path))
+	{
+		err1("Journal %s", journal_path);
+		exit(1);
+	}
+	initLatency(0); // Dumped once at the end
+	for(game=0;game<game_count;game++)
+	{
+		initCrane(game, radio, CRANE_ADDR);
+		initSystem(game, radio, CRANE_ADDR);
+		if(seed_given)setGameSeed(game, seed + game);
+	}
+
+	for(game=0;game<game_count;game++)
+	{
+		fleets[game] = initShipSim(game, fleet_size, SIM_FIRST_SHIP_ADDR + game * fleet_size, CRANE_ADDR);
+		if(fleets[game] == NULL)exit(1);
+	}
+
+	osDelay(duration * osKernelGetTickFreq());
+
+	latencyDump();
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	info1("Game time %"PRIu32" s, wall time %.3f s, speed-up %.1f", duration, wall, duration / wall);
+	for(game=0;game<game_count;game++)
+	{
+		getShipSimStats(fleets[game], &stats);
+		info1("Game %u fleet %u registered %u loaded %u departed %"PRIu32" delivered %"PRIu32" rounds %"PRIu32" games %"PRIu32,
+			game, stats.ships, stats.registered, stats.loaded, stats.departed, stats.delivered, stats.rounds, stats.games);
+		registered += stats.registered;
+		loaded += stats.loaded;
+		departed += stats.departed;
+		delivered += stats.delivered;
+		games += stats.games;
+	}
+	if(game_count > 1)info1("Games %u ships %"PRIu32" registered %"PRIu32" loaded %"PRIu32" departed %"PRIu32" delivered %"PRIu32" games ended %"PRIu32,
+		game_count, (uint32_t)game_count * fleet_size, registered, loaded, departed, delivered, games);
+	info1("Games per hour %.1f", games * 3600.0 / duration);
+	exit(0);
+}
+
+int main (int argc, char* argv[])
+{
+	bool virtual_time = true;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:g:t:s:j:r")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n': fleet_size = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+			case 'g': game_count = (uint8_t)strtoul(optarg, NULL, 0);
+			break;
+			case 't': duration = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+			case 's':
+				seed = (uint32_t)strtoul(optarg, NULL, 0);
+				seed_given = true;
+			break;
+			case 'j': journal_path = optarg;
+			break;
+			case 'r': virtual_time = false;
+			break;
+			default:
+				fprintf(stderr, "Usage: %s [-n ships] [-g games] [-t duration] [-s seed] [-j journal] [-r]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(game_count == 0 || game_count > CLG_MAX_GAMES)
+	{
+		fprintf(stderr, "Games must be 1..%u, see CLG_MAX_GAMES\n", CLG_MAX_GAMES);
+		return 1;
+	}
+
+	osHostSetVirtualTime(virtual_time);
+	radio_set_bus(RADIO_BUS_LOCAL);
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+	osKernelInitialize();
+
+	const osThreadAttr_t setup_thread_attr = { .name = "setup" };
+	osThreadNew(setup_loop, NULL, &setup_thread_attr);
+	osKernelStart(); // This should never return
+
+	return 1;
+}
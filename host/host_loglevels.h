@@ -0,0 +1,11 @@
+#ifndef HOST_LOGLEVELS_H_
+#define HOST_LOGLEVELS_H_
+
+#define LOG_LEVEL_radio_loopback 		(LOG_INFO1 + LOG_WARN1 + LOG_ERR1 + LOG_DEBUG1)
+#define LOG_LEVEL_crane_host 			(LOG_INFO1 + LOG_ERR1 + LOG_DEBUG1)
+#define LOG_LEVEL_ship_sim 				(LOG_INFO1 + LOG_ERR1 + LOG_DEBUG1)
+#define LOG_LEVEL_game_sim 				(LOG_INFO1 + LOG_ERR1 + LOG_DEBUG1)
+#define LOG_LEVEL_tournament 			(LOG_INFO1 + LOG_ERR1 + LOG_DEBUG1)
+#define LOG_LEVEL_replay 				(LOG_INFO1 + LOG_ERR1 + LOG_DEBUG1)
+
+#endif//HOST_LOGLEVELS_H_
@@ -0,0 +1,167 @@
+/**
+ *
+ * Host (Linux) stand-in for the CMSIS-RTOS2 API. Only the subset of
+ * calls used by the crane-agent and ship-agent modules is provided, the
+ * implementation is in cmsis_os2_posix.c and is backed by pthreads.
+ *
+ * Types, constants and function signatures follow the CMSIS-RTOS2
+ * cmsis_os2.h header so that module sources compile unchanged.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef CMSIS_OS2_H_
+#define CMSIS_OS2_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define osWaitForever 0xFFFFFFFFU	// Wait forever timeout value
+
+// Flags options (\ref osThreadFlagsWait and \ref osEventFlagsWait)
+#define osFlagsWaitAny 0x00000000U	// Wait for any flag (default)
+#define osFlagsWaitAll 0x00000001U	// Wait for all flags
+#define osFlagsNoClear 0x00000002U	// Do not clear flags which have been specified to wait for
+
+// Flags errors (returned by osThreadFlagsXxxx and osEventFlagsXxxx)
+#define osFlagsError			0x80000000U
+#define osFlagsErrorUnknown		0xFFFFFFFFU
+#define osFlagsErrorTimeout		0xFFFFFFFEU
+#define osFlagsErrorResource	0xFFFFFFFDU
+#define osFlagsErrorParameter	0xFFFFFFFCU
+#define osFlagsErrorISR			0xFFFFFFFAU
+
+// Mutex attributes
+#define osMutexRecursive		0x00000001U
+#define osMutexPrioInherit		0x00000002U
+#define osMutexRobust			0x00000008U
+
+typedef enum {
+	osOK					=  0,
+	osError					= -1,
+	osErrorTimeout			= -2,
+	osErrorResource			= -3,
+	osErrorParameter		= -4,
+	osErrorNoMemory			= -5,
+	osErrorISR				= -6,
+	osStatusReserved		= 0x7FFFFFFF
+} osStatus_t;
+
+typedef enum {
+	osKernelInactive		=  0,
+	osKernelReady			=  1,
+	osKernelRunning			=  2,
+	osKernelLocked			=  3,
+	osKernelSuspended		=  4,
+	osKernelError			= -1,
+	osKernelReserved		= 0x7FFFFFFF
+} osKernelState_t;
+
+typedef enum {
+	osPriorityNone			= 0,
+	osPriorityIdle			= 1,
+	osPriorityLow			= 8,
+	osPriorityBelowNormal	= 16,
+	osPriorityNormal		= 24,
+	osPriorityAboveNormal	= 32,
+	osPriorityHigh			= 40,
+	osPriorityRealtime		= 48,
+	osPriorityISR			= 56,
+	osPriorityError			= -1,
+	osPriorityReserved		= 0x7FFFFFFF
+} osPriority_t;
+
+typedef void (*osThreadFunc_t) (void *argument);
+
+typedef void *osThreadId_t;
+typedef void *osMutexId_t;
+typedef void *osMessageQueueId_t;
+typedef void *osEventFlagsId_t;
+
+typedef struct {
+	const char *name;
+	uint32_t attr_bits;
+	void *cb_mem;
+	uint32_t cb_size;
+	void *stack_mem;
+	uint32_t stack_size;
+	osPriority_t priority;
+	uint32_t tz_module;
+	uint32_t reserved;
+} osThreadAttr_t;
+
+typedef struct {
+	const char *name;
+	uint32_t attr_bits;
+	void *cb_mem;
+	uint32_t cb_size;
+} osMutexAttr_t;
+
+typedef struct {
+	const char *name;
+	uint32_t attr_bits;
+	void *cb_mem;
+	uint32_t cb_size;
+} osEventFlagsAttr_t;
+
+typedef struct {
+	const char *name;
+	uint32_t attr_bits;
+	void *cb_mem;
+	uint32_t cb_size;
+	void *mq_mem;
+	uint32_t mq_size;
+} osMessageQueueAttr_t;
+
+/**********************************************************************************************
+ *	Kernel
+ **********************************************************************************************/
+
+osStatus_t osKernelInitialize(void);
+osKernelState_t osKernelGetState(void);
+osStatus_t osKernelStart(void);
+uint32_t osKernelGetTickCount(void);
+uint32_t osKernelGetTickFreq(void);
+
+/**********************************************************************************************
+ *	Threads
+ **********************************************************************************************/
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr);
+osThreadId_t osThreadGetId(void);
+osStatus_t osThreadTerminate(osThreadId_t thread_id);
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags);
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout);
+
+osStatus_t osDelay(uint32_t ticks);
+
+/**********************************************************************************************
+ *	Mutexes
+ **********************************************************************************************/
+
+osMutexId_t osMutexNew(const osMutexAttr_t *attr);
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout);
+osStatus_t osMutexRelease(osMutexId_t mutex_id);
+
+/**********************************************************************************************
+ *	Event flags
+ **********************************************************************************************/
+
+osEventFlagsId_t osEventFlagsNew(const osEventFlagsAttr_t *attr);
+uint32_t osEventFlagsSet(osEventFlagsId_t ef_id, uint32_t flags);
+uint32_t osEventFlagsClear(osEventFlagsId_t ef_id, uint32_t flags);
+uint32_t osEventFlagsWait(osEventFlagsId_t ef_id, uint32_t flags, uint32_t options, uint32_t timeout);
+
+/**********************************************************************************************
+ *	Message queues
+ **********************************************************************************************/
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t *attr);
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void *msg_ptr, uint8_t msg_prio, uint32_t timeout);
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void *msg_ptr, uint8_t *msg_prio, uint32_t timeout);
+uint32_t osMessageQueueGetCount(osMessageQueueId_t mq_id);
+
+#endif//CMSIS_OS2_H_
@@ -0,0 +1,25 @@
+/**
+ *
+ * Host (Linux) only extensions of the POSIX CMSIS-RTOS2 shim.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef CMSIS_OS2_HOST_H_
+#define CMSIS_OS2_HOST_H_
+
+#include <stdbool.h>
+
+#include "cmsis_os2.h"
+
+// Selects virtual time mode, where the kernel tick count is advanced by the
+// kernel whenever all threads are blocked, instead of following the system
+// clock. Must be called before osKernelInitialize.
+osStatus_t osHostSetVirtualTime(bool enable);
+
+// Returns true if the kernel runs in virtual time mode.
+bool osHostIsVirtualTime(void);
+
+#endif//CMSIS_OS2_HOST_H_
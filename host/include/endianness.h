@@ -0,0 +1,41 @@
+/**
+ *
+ * Host (Linux) stand-in for endianness.h. Network byte order is big endian.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef ENDIANNESS_H_
+#define ENDIANNESS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define hton16(x) ((uint16_t)__builtin_bswap16((uint16_t)(x)))
+#define hton32(x) ((uint32_t)__builtin_bswap32((uint32_t)(x)))
+#define hton64(x) ((uint64_t)__builtin_bswap64((uint64_t)(x)))
+#else
+#define hton16(x) ((uint16_t)(x))
+#define hton32(x) ((uint32_t)(x))
+#define hton64(x) ((uint64_t)(x))
+#endif
+
+#define ntoh16(x) hton16(x)
+#define ntoh32(x) hton32(x)
+#define ntoh64(x) hton64(x)
+
+static inline float htonf(float f)
+{
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	v = hton32(v);
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+#define ntohf(x) htonf(x)
+
+#endif//ENDIANNESS_H_
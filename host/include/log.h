@@ -0,0 +1,68 @@
+/**
+ *
+ * Host (Linux) stand-in for the lll logging macros. Each source file defines
+ * __MODUUL__ and __LOG_LEVEL__ before including this header, same as for the
+ * target build. Output goes to stdout through log_host.c.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdint.h>
+
+#define LOG_DEBUG1 0x0001
+#define LOG_DEBUG2 0x0002
+#define LOG_DEBUG3 0x0004
+#define LOG_DEBUG4 0x0008
+#define LOG_INFO1  0x0010
+#define LOG_INFO2  0x0020
+#define LOG_INFO3  0x0040
+#define LOG_INFO4  0x0080
+#define LOG_WARN1  0x0100
+#define LOG_WARN2  0x0200
+#define LOG_WARN3  0x0400
+#define LOG_WARN4  0x0800
+#define LOG_ERR1   0x1000
+#define LOG_ERR2   0x2000
+#define LOG_ERR3   0x4000
+#define LOG_ERR4   0x8000
+
+#define LOG_MASK_DEBUG 0xFFFF
+#define LOG_MASK_INFO  0xFFF0
+#define LOG_MASK_WARN  0xFF00
+#define LOG_MASK_ERR   0xF000
+
+#ifndef __LOG_LEVEL__
+#define __LOG_LEVEL__ 0
+#endif
+
+#ifndef __MODUUL__
+#define __MODUUL__ "?"
+#endif
+
+void log_host(uint16_t level, const char* module, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+void log_host_buf(uint16_t level, const char* module, const uint8_t* buf, uint16_t len, const char* fmt, ...) __attribute__((format(printf, 5, 6)));
+
+#define logger(lvl, fmt, ...) do { if((__LOG_LEVEL__) & (lvl))log_host((lvl), __MODUUL__, fmt, ##__VA_ARGS__); } while(0)
+#define loggerb(lvl, fmt, buf, len, ...) do { if((__LOG_LEVEL__) & (lvl))log_host_buf((lvl), __MODUUL__, (const uint8_t*)(buf), (len), fmt, ##__VA_ARGS__); } while(0)
+
+#define debug1(fmt, ...) logger(LOG_DEBUG1, fmt, ##__VA_ARGS__)
+#define debug2(fmt, ...) logger(LOG_DEBUG2, fmt, ##__VA_ARGS__)
+#define info1(fmt, ...)  logger(LOG_INFO1, fmt, ##__VA_ARGS__)
+#define info2(fmt, ...)  logger(LOG_INFO2, fmt, ##__VA_ARGS__)
+#define warn1(fmt, ...)  logger(LOG_WARN1, fmt, ##__VA_ARGS__)
+#define err1(fmt, ...)   logger(LOG_ERR1, fmt, ##__VA_ARGS__)
+
+#define debug(fmt, ...)  debug1(fmt, ##__VA_ARGS__)
+#define info(fmt, ...)   info1(fmt, ##__VA_ARGS__)
+#define warn(fmt, ...)   warn1(fmt, ##__VA_ARGS__)
+#define err(fmt, ...)    err1(fmt, ##__VA_ARGS__)
+
+#define infob1(fmt, buf, len, ...) loggerb(LOG_INFO1, fmt, buf, len, ##__VA_ARGS__)
+#define debugb1(fmt, buf, len, ...) loggerb(LOG_DEBUG1, fmt, buf, len, ##__VA_ARGS__)
+
+#endif//LOG_H_
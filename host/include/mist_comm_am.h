@@ -0,0 +1,94 @@
+/**
+ *
+ * Host (Linux) stand-in for the mist-comm ActiveMessage API. Provides the
+ * comms_xxx calls used by the crane-agent and ship-agent modules, frames are
+ * carried by the loopback radio in radio_loopback.c.
+ *
+ * Message buffer sizes are taken from platform_msg.h in the common
+ * directory, same as for the target build.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef MIST_COMM_AM_H_
+#define MIST_COMM_AM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "platform_msg.h"
+
+typedef enum {
+	COMMS_UNINITIALIZED = 0,
+	COMMS_STOPPED,
+	COMMS_STARTING,
+	COMMS_STARTED,
+	COMMS_STOPPING
+} comms_status_t;
+
+typedef enum {
+	COMMS_SUCCESS = 0,
+	COMMS_FAIL = -1,
+	COMMS_EBUSY = -4,
+	COMMS_EINVAL = -5,
+	COMMS_EOFF = -9,
+	COMMS_ESIZE = -12,
+	COMMS_ENOACK = -16,
+	COMMS_ENOMEM = -17
+} comms_error_t;
+
+typedef struct {
+	am_id_t type;
+	am_addr_t source;
+	am_addr_t destination;
+	uint8_t length;
+	uint8_t payload[COMMS_MSG_PAYLOAD_SIZE];
+	comms_am_msg_metadata_t metadata;
+} comms_msg_t;
+
+typedef struct comms_layer comms_layer_t;
+typedef struct comms_receiver comms_receiver_t;
+
+typedef void comms_status_change_f(comms_layer_t* comms, comms_status_t status, void* user);
+typedef void comms_send_done_f(comms_layer_t* comms, comms_msg_t* msg, comms_error_t result, void* user);
+typedef void comms_receive_f(comms_layer_t* comms, const comms_msg_t* msg, void* user);
+
+struct comms_receiver {
+	am_id_t type;
+	comms_receive_f* callback;
+	void* user;
+	comms_receiver_t* next;
+};
+
+/**********************************************************************************************
+ *	Layer control
+ **********************************************************************************************/
+
+comms_error_t comms_start(comms_layer_t* comms, comms_status_change_f* start_done, void* user);
+comms_status_t comms_status(comms_layer_t* comms);
+
+comms_error_t comms_register_recv(comms_layer_t* comms, comms_receiver_t* rcvr, comms_receive_f* func, void* user, am_id_t amid);
+
+/**********************************************************************************************
+ *	Message manipulation and sending
+ **********************************************************************************************/
+
+void comms_init_message(comms_layer_t* comms, comms_msg_t* msg);
+
+void* comms_get_payload(comms_layer_t* comms, const comms_msg_t* msg, uint8_t length);
+uint8_t comms_get_payload_length(comms_layer_t* comms, const comms_msg_t* msg);
+void comms_set_payload_length(comms_layer_t* comms, comms_msg_t* msg, uint8_t length);
+uint8_t comms_get_payload_max_length(comms_layer_t* comms);
+
+am_id_t comms_get_packet_type(comms_layer_t* comms, const comms_msg_t* msg);
+void comms_set_packet_type(comms_layer_t* comms, comms_msg_t* msg, am_id_t ptype);
+
+am_addr_t comms_am_get_source(comms_layer_t* comms, const comms_msg_t* msg);
+am_addr_t comms_am_get_destination(comms_layer_t* comms, const comms_msg_t* msg);
+void comms_am_set_destination(comms_layer_t* comms, comms_msg_t* msg, am_addr_t dest);
+
+comms_error_t comms_send(comms_layer_t* comms, comms_msg_t* msg, comms_send_done_f* sdf, void* user);
+
+#endif//MIST_COMM_AM_H_
@@ -0,0 +1,29 @@
+/**
+ *
+ * Host (Linux) stand-in for mist_comm_am_msg.h, ActiveMessage addressing
+ * and metadata types. Included by platform_msg.h in the common directory.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef MIST_COMM_AM_MSG_H_
+#define MIST_COMM_AM_MSG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint16_t am_addr_t;
+typedef uint8_t am_id_t;
+
+#define AM_BROADCAST_ADDR 0xFFFF
+
+typedef struct {
+	uint32_t timestamp;		// Kernel tick count at reception or transmission
+	uint8_t lqi;
+	int8_t rssi;
+	bool ack_received;
+} comms_am_msg_metadata_t;
+
+#endif//MIST_COMM_AM_MSG_H_
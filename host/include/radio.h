@@ -0,0 +1,38 @@
+/**
+ *
+ * Host (Linux) loopback radio. Each radio instance is a node on a local
+ * datagram bus: a directory of Unix domain sockets, one socket per node
+ * address. Unicast frames go to the socket of the destination node,
+ * broadcast frames go to every socket in the bus directory.
+ *
+ * The bus directory is given by environment variable CLG_BUS_DIR, default
+ * is RADIO_DEFAULT_BUS_DIR. Channel and PAN ID arguments are accepted for
+ * compatibility with the target radio_init and are otherwise ignored.
+ *
+ * Alternatively all radio instances of one process can be connected to a
+ * local in-process bus, see radio_set_bus. The local bus is carried entirely
+ * by kernel objects, which is required for virtual time.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef RADIO_H_
+#define RADIO_H_
+
+#include "mist_comm_am.h"
+
+#define RADIO_DEFAULT_BUS_DIR "/tmp/clg-bus"
+
+typedef enum {
+	RADIO_BUS_SOCKET = 0,	// Unix domain socket bus, shared between processes
+	RADIO_BUS_LOCAL			// In-process bus
+} radio_bus_t;
+
+// Selects the bus for all radio instances created after this call.
+void radio_set_bus(radio_bus_t bus);
+
+comms_layer_t* radio_init(uint16_t channel, uint16_t pan_id, am_addr_t address);
+
+#endif//RADIO_H_
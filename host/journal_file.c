@@ -0,0 +1,68 @@
+/**
+ *
+ * Journal file sink and reader of the host build. The sink writes records
+ * with stdio and flushes the file every round, so a crane-agent that is 
+ * killed loses at most the records of its last round.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal_file.h"
+
+static void fileSink(const journal_record_t* rec, void* user)
+{
+	FILE* f = (FILE*)user;
+	uint8_t buf[JOURNAL_RECORD_MAX];
+
+	fwrite(buf, journalEncode(rec, buf), 1, f);
+	if(rec->type == JOURNAL_ROUND || rec->type == JOURNAL_SEED || rec->type == JOURNAL_SCORE)fflush(f);
+}
+
+bool initJournalFile(const char* path)
+{
+	const uint8_t version = JOURNAL_FILE_VERSION;
+	FILE* f = fopen(path, "wb");
+
+	if(f == NULL)return false;
+	fwrite(JOURNAL_FILE_MAGIC, strlen(JOURNAL_FILE_MAGIC), 1, f);
+	fwrite(&version, sizeof(version), 1, f);
+	fflush(f);
+	initJournal(fileSink, f);
+	return true;
+}
+
+journal_record_t* readJournalFile(const char* path, size_t* count)
+{
+	const size_t head = strlen(JOURNAL_FILE_MAGIC) + 1;
+	journal_record_t* recs = NULL;
+	uint8_t* buf = NULL;
+	size_t len = 0, pos, n = 0;
+	long size;
+	uint8_t used;
+	FILE* f = fopen(path, "rb");
+
+	if(f == NULL)return NULL;
+	if(fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= (long)head && fseek(f, 0, SEEK_SET) == 0)
+	{
+		len = (size_t)size;
+		buf = malloc(len);
+		if(buf != NULL && fread(buf, len, 1, f) != 1)len = 0;
+	}
+	fclose(f);
+
+	if(buf != NULL && len >= head && memcmp(buf, JOURNAL_FILE_MAGIC, head - 1) == 0 && buf[head - 1] == JOURNAL_FILE_VERSION)
+	{
+		// Every record takes at least 7 bytes
+		recs = malloc(((len - head) / 7 + 1) * sizeof(journal_record_t));
+		for(pos=head;recs != NULL && (used = journalDecode(buf + pos, len - pos, &recs[n])) > 0;pos+=used)n++;
+	}
+	free(buf);
+	*count = n;
+	return recs;
+}
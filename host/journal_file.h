@@ -0,0 +1,32 @@
+/**
+ *
+ * Journal files of the host build, see crane/journal.c. A journal file starts
+ * with JOURNAL_FILE_MAGIC and a format version byte, followed by records in
+ * the format of journalEncode.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef JOURNAL_FILE_H_
+#define JOURNAL_FILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "journal.h"
+
+#define JOURNAL_FILE_MAGIC "CLGJ"
+#define JOURNAL_FILE_VERSION 1
+
+// Starts the journal (see initJournal) with file 'path' as the sink, an existing file is
+// truncated. Returns false if the file can not be created.
+bool initJournalFile(const char* path);
+
+// Reads all records of journal file 'path' to a new array and sets 'count' to the number of
+// records. Returns NULL if the file can not be read or is not a journal file. A record cut
+// short at the end of the file, e.g. by a crash, is ignored.
+journal_record_t* readJournalFile(const char* path, size_t* count);
+
+#endif//JOURNAL_FILE_H_
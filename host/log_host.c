@@ -0,0 +1,73 @@
+/**
+ *
+ * Host (Linux) log output for the lll logging macros in include/log.h.
+ * Every record is prefixed with the kernel tick count, level and module
+ * name and is written to stdout with a single write, so records from
+ * different threads do not interleave.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "cmsis_os2.h"
+
+#include "log.h"
+
+#define LOG_HOST_LINE_LENGTH 512
+
+static char levelChar(uint16_t level)
+{
+	if(level & (LOG_ERR1 | LOG_ERR2 | LOG_ERR3 | LOG_ERR4))return 'E';
+	if(level & (LOG_WARN1 | LOG_WARN2 | LOG_WARN3 | LOG_WARN4))return 'W';
+	if(level & (LOG_INFO1 | LOG_INFO2 | LOG_INFO3 | LOG_INFO4))return 'I';
+	return 'D';
+}
+
+static int logPrefix(char* line, uint16_t level, const char* module)
+{
+	uint32_t t = osKernelGetTickCount();
+	return snprintf(line, LOG_HOST_LINE_LENGTH, "%02"PRIu32":%02"PRIu32":%02"PRIu32".%03"PRIu32" %c|%s: ",
+	                t / 3600000U, t / 60000U % 60, t / 1000U % 60, t % 1000U, levelChar(level), module);
+}
+
+static void logWrite(char* line, int len)
+{
+	if(len >= LOG_HOST_LINE_LENGTH - 1)len = LOG_HOST_LINE_LENGTH - 2;
+	line[len++] = '\n';
+	fwrite(line, (size_t)len, 1, stdout);
+	fflush(stdout);
+}
+
+void log_host(uint16_t level, const char* module, const char* fmt, ...)
+{
+	char line[LOG_HOST_LINE_LENGTH];
+	va_list args;
+	int len = logPrefix(line, level, module);
+
+	va_start(args, fmt);
+	len += vsnprintf(line + len, LOG_HOST_LINE_LENGTH - len, fmt, args);
+	va_end(args);
+	logWrite(line, len);
+}
+
+void log_host_buf(uint16_t level, const char* module, const uint8_t* buf, uint16_t len, const char* fmt, ...)
+{
+	char line[LOG_HOST_LINE_LENGTH];
+	va_list args;
+	uint16_t i;
+	int l = logPrefix(line, level, module);
+
+	va_start(args, fmt);
+	l += vsnprintf(line + l, LOG_HOST_LINE_LENGTH - l, fmt, args);
+	va_end(args);
+	for(i=0;i<len && l < LOG_HOST_LINE_LENGTH - 4;i++)
+	{
+		l += snprintf(line + l, LOG_HOST_LINE_LENGTH - l, "%02X", buf[i]);
+	}
+	logWrite(line, l);
+}
@@ -0,0 +1,475 @@
+/**
+ *
+ * This is the host (Linux) loopback radio and mist-comm stand-in. It carries
+ * comms_msg_t frames between agents running as Linux processes, or between
+ * several radio instances in one process.
+ *
+ * The bus is a directory of Unix domain datagram sockets, one socket per
+ * node, named after the node address in hex (e.g. /tmp/clg-bus/000D). A
+ * unicast frame is sent to the socket of the destination node. A broadcast
+ * frame is sent to every socket in the bus directory except our own. A frame
+ * that cannot be delivered (no such node, receiver queue full) is lost, the
+ * same way it would be lost over the air; for unicast frames this is reported
+ * as COMMS_ENOACK in the send done callback.
+ *
+ * With the local bus (radio_set_bus) frames are delivered to the receive
+ * queue of the destination radio instance in the same process instead.
+ *
+ * Each radio instance has two threads:
+ * - transmit thread takes frames from the transmit queue, puts them on the
+ *   bus and calls the send done callback
+ * - receive thread reads frames from the socket or local receive queue and
+ *   calls the receivers registered for the frame AM type
+ * Callbacks are therefore called from radio thread context, like on the
+ * target.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cmsis_os2.h"
+
+#include "mist_comm_am.h"
+#include "radio.h"
+#include "endianness.h"
+
+#include "host_loglevels.h"
+#define __MODUUL__ "radio"
+#define __LOG_LEVEL__ (LOG_LEVEL_radio_loopback & BASE_LOG_LEVEL)
+#include "log.h"
+
+#define RADIO_TX_QUEUE_LENGTH 8
+#define RADIO_LOCAL_RX_QUEUE_LENGTH 256
+#define RADIO_SOCKET_BUFFER_SIZE (256 * 1024)
+#define RADIO_NODE_NAME_LENGTH 4 // Node socket name is the address as 4 hex digits
+
+#pragma pack(push, 1)
+typedef struct {
+	am_id_t type;
+	am_addr_t source;
+	am_addr_t destination;
+	uint8_t length;
+	uint8_t payload[COMMS_MSG_PAYLOAD_SIZE];
+} radio_frame_t;
+#pragma pack(pop)
+
+#define RADIO_FRAME_HEADER_SIZE (sizeof(radio_frame_t) - COMMS_MSG_PAYLOAD_SIZE)
+
+typedef struct {
+	comms_msg_t* msg;
+	comms_send_done_f* sdf;
+	void* user;
+	radio_frame_t frame;
+} radio_tx_t;
+
+struct comms_layer {
+	radio_bus_t bus;
+	am_addr_t address;
+	comms_status_t status;
+	int sock;
+	char bus_dir[sizeof(((struct sockaddr_un*)0)->sun_path) - RADIO_NODE_NAME_LENGTH - 2];
+
+	comms_receiver_t* receivers;
+	osMutexId_t rcvr_mutex;
+
+	osMessageQueueId_t tx_qID;
+	osMessageQueueId_t rx_qID;	// Local bus only
+	comms_layer_t* next;		// Local bus only
+	comms_status_change_f* start_done;
+	void* start_user;
+};
+
+static radio_bus_t radio_bus = RADIO_BUS_SOCKET;
+
+// Local bus nodes, both as a list for broadcast and indexed by address for unicast
+static comms_layer_t* local_nodes;
+static comms_layer_t** local_table;
+static osMutexId_t local_mutex;
+
+static void radioTxLoop(void *args);
+static void radioRxLoop(void *args);
+
+/**********************************************************************************************
+ *	Radio bus
+ **********************************************************************************************/
+
+static void nodePath(struct sockaddr_un* sa, const char* dir, am_addr_t addr)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	snprintf(sa->sun_path, sizeof(sa->sun_path), "%s/%04X", dir, addr);
+}
+
+static bool sendToNode(comms_layer_t* radio, const radio_frame_t* frame, am_addr_t dest)
+{
+	struct sockaddr_un sa;
+	size_t len = RADIO_FRAME_HEADER_SIZE + frame->length;
+
+	nodePath(&sa, radio->bus_dir, dest);
+	return sendto(radio->sock, frame, len, MSG_DONTWAIT, (struct sockaddr*)&sa, sizeof(sa)) == (ssize_t)len;
+}
+
+static bool isNodeName(const char* name, am_addr_t* addr)
+{
+	char* end;
+	unsigned long val;
+
+	if(strlen(name) != RADIO_NODE_NAME_LENGTH)return false;
+	val = strtoul(name, &end, 16);
+	if(*end != '\0' || val == AM_BROADCAST_ADDR)return false;
+	*addr = (am_addr_t)val;
+	return true;
+}
+
+static void broadcastFrame(comms_layer_t* radio, const radio_frame_t* frame)
+{
+	DIR* dir;
+	struct dirent* ent;
+	am_addr_t addr;
+
+	dir = opendir(radio->bus_dir);
+	if(dir == NULL)return;
+	while((ent = readdir(dir)) != NULL)
+	{
+		if(isNodeName(ent->d_name, &addr) && addr != radio->address)sendToNode(radio, frame, addr);
+	}
+	closedir(dir);
+}
+
+static bool sendToLocalNode(comms_layer_t* node, const radio_frame_t* frame)
+{
+	return node != NULL && osMessageQueuePut(node->rx_qID, frame, 0, 0) == osOK;
+}
+
+// Returns false if a unicast frame was not delivered
+static bool transmitFrame(comms_layer_t* radio, const radio_frame_t* frame, am_addr_t dest)
+{
+	comms_layer_t* node;
+	bool delivered = true;
+
+	if(radio->bus == RADIO_BUS_SOCKET)
+	{
+		if(dest == AM_BROADCAST_ADDR)broadcastFrame(radio, frame);
+		else delivered = sendToNode(radio, frame, dest);
+		return delivered;
+	}
+
+	while(osMutexAcquire(local_mutex, 1000) != osOK);
+	if(dest == AM_BROADCAST_ADDR)
+	{
+		for(node = local_nodes;node != NULL;node = node->next)
+		{
+			if(node != radio)sendToLocalNode(node, frame);
+		}
+	}
+	else delivered = sendToLocalNode(local_table[dest], frame);
+	osMutexRelease(local_mutex);
+	return delivered;
+}
+
+// Blocks until a frame is received, returns frame length or -1 on error
+static ssize_t receiveFrame(comms_layer_t* radio, radio_frame_t* frame)
+{
+	ssize_t len;
+
+	if(radio->bus == RADIO_BUS_LOCAL)
+	{
+		osMessageQueueGet(radio->rx_qID, frame, NULL, osWaitForever);
+		return RADIO_FRAME_HEADER_SIZE + frame->length;
+	}
+
+	len = recv(radio->sock, frame, sizeof(radio_frame_t), 0);
+	if(len < 0 && errno != EINTR)warn1("rcv err %d", errno);
+	return len;
+}
+
+/**********************************************************************************************
+ *	Radio threads
+ **********************************************************************************************/
+
+static void radioTxLoop(void *args)
+{
+	comms_layer_t* radio = (comms_layer_t*)args;
+	radio_tx_t tx;
+	comms_error_t result;
+	am_addr_t dest;
+
+	radio->status = COMMS_STARTED;
+	if(radio->start_done != NULL)radio->start_done(radio, COMMS_STARTED, radio->start_user);
+
+	for(;;)
+	{
+		osMessageQueueGet(radio->tx_qID, &tx, NULL, osWaitForever);
+
+		dest = ntoh16(tx.frame.destination);
+		if(transmitFrame(radio, &tx.frame, dest))result = COMMS_SUCCESS;
+		else result = COMMS_ENOACK;
+
+		if(tx.sdf != NULL) // Without a callback the owner may already be reusing the message
+		{
+			tx.msg->metadata.timestamp = osKernelGetTickCount();
+			tx.msg->metadata.ack_received = (result == COMMS_SUCCESS && dest != AM_BROADCAST_ADDR);
+			tx.sdf(radio, tx.msg, result, tx.user);
+		}
+	}
+}
+
+static void radioRxLoop(void *args)
+{
+	comms_layer_t* radio = (comms_layer_t*)args;
+	radio_frame_t frame;
+	comms_msg_t msg;
+	comms_receiver_t* rcvr;
+	ssize_t len;
+
+	for(;;)
+	{
+		len = receiveFrame(radio, &frame);
+		if(len < 0)continue;
+		if((size_t)len < RADIO_FRAME_HEADER_SIZE || (size_t)len != RADIO_FRAME_HEADER_SIZE + frame.length)
+		{
+			debug1("bad frame %d", (int)len);
+			continue;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.type = frame.type;
+		msg.source = ntoh16(frame.source);
+		msg.destination = ntoh16(frame.destination);
+		msg.length = frame.length;
+		memcpy(msg.payload, frame.payload, frame.length);
+		msg.metadata.timestamp = osKernelGetTickCount();
+		msg.metadata.lqi = 0xFF;
+		msg.metadata.rssi = -50;
+
+		if(msg.destination != radio->address && msg.destination != AM_BROADCAST_ADDR)continue;
+
+		while(osMutexAcquire(radio->rcvr_mutex, 1000) != osOK);
+		for(rcvr = radio->receivers;rcvr != NULL;rcvr = rcvr->next)
+		{
+			if(rcvr->type == msg.type)rcvr->callback(radio, &msg, rcvr->user);
+		}
+		osMutexRelease(radio->rcvr_mutex);
+	}
+}
+
+/**********************************************************************************************
+ *	Radio setup
+ **********************************************************************************************/
+
+void radio_set_bus(radio_bus_t bus)
+{
+	if(bus == RADIO_BUS_LOCAL && local_mutex == NULL)
+	{
+		local_mutex = osMutexNew(NULL);
+		local_table = calloc((size_t)AM_BROADCAST_ADDR + 1, sizeof(comms_layer_t*));
+	}
+	radio_bus = bus;
+}
+
+static bool localInit(comms_layer_t* radio)
+{
+	bool ok = false;
+
+	radio->rx_qID = osMessageQueueNew(RADIO_LOCAL_RX_QUEUE_LENGTH, sizeof(radio_frame_t), NULL);
+	if(radio->rx_qID == NULL || local_table == NULL)return false;
+
+	while(osMutexAcquire(local_mutex, 1000) != osOK);
+	if(local_table[radio->address] == NULL)
+	{
+		local_table[radio->address] = radio;
+		radio->next = local_nodes;
+		local_nodes = radio;
+		ok = true;
+	}
+	osMutexRelease(local_mutex);
+
+	if(!ok)err1("address %04X in use", radio->address);
+	else debug1("radio %04X on local bus", radio->address);
+	return ok;
+}
+
+static bool socketInit(comms_layer_t* radio)
+{
+	struct sockaddr_un sa;
+	const char* dir = getenv("CLG_BUS_DIR");
+	int bufsize = RADIO_SOCKET_BUFFER_SIZE;
+
+	if(dir == NULL || dir[0] == '\0')dir = RADIO_DEFAULT_BUS_DIR;
+	if(strlen(dir) >= sizeof(radio->bus_dir))
+	{
+		err1("bus dir too long");
+		return false;
+	}
+	strcpy(radio->bus_dir, dir);
+
+	if(mkdir(radio->bus_dir, 0777) != 0 && errno != EEXIST)
+	{
+		err1("bus dir %s err %d", radio->bus_dir, errno);
+		return false;
+	}
+
+	radio->sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if(radio->sock < 0)return false;
+	setsockopt(radio->sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	setsockopt(radio->sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+	nodePath(&sa, radio->bus_dir, radio->address);
+	unlink(sa.sun_path); // Stale socket from an earlier run
+	if(bind(radio->sock, (struct sockaddr*)&sa, sizeof(sa)) != 0)
+	{
+		err1("bind %s err %d", sa.sun_path, errno);
+		close(radio->sock);
+		return false;
+	}
+
+	debug1("radio %04X on %s", radio->address, radio->bus_dir);
+	return true;
+}
+
+comms_layer_t* radio_init(uint16_t channel, uint16_t pan_id, am_addr_t address)
+{
+	comms_layer_t* radio;
+	bool ok;
+
+	if(address == AM_BROADCAST_ADDR)return NULL;
+
+	radio = calloc(1, sizeof(comms_layer_t));
+	if(radio == NULL)return NULL;
+	radio->bus = radio_bus;
+	radio->address = address;
+	radio->status = COMMS_STOPPED;
+	radio->sock = -1;
+
+	if(radio->bus == RADIO_BUS_LOCAL)ok = localInit(radio);
+	else ok = socketInit(radio);
+	if(!ok)
+	{
+		free(radio);
+		return NULL;
+	}
+
+	radio->rcvr_mutex = osMutexNew(NULL);
+	radio->tx_qID = osMessageQueueNew(RADIO_TX_QUEUE_LENGTH, sizeof(radio_tx_t), NULL);
+	return radio;
+}
+
+comms_error_t comms_start(comms_layer_t* comms, comms_status_change_f* start_done, void* user)
+{
+	if(comms->status != COMMS_STOPPED)return COMMS_EBUSY;
+
+	comms->status = COMMS_STARTING;
+	comms->start_done = start_done;
+	comms->start_user = user;
+
+	osThreadNew(radioRxLoop, comms, NULL);
+	osThreadNew(radioTxLoop, comms, NULL);
+	return COMMS_SUCCESS;
+}
+
+comms_status_t comms_status(comms_layer_t* comms)
+{
+	return comms->status;
+}
+
+comms_error_t comms_register_recv(comms_layer_t* comms, comms_receiver_t* rcvr, comms_receive_f* func, void* user, am_id_t amid)
+{
+	rcvr->type = amid;
+	rcvr->callback = func;
+	rcvr->user = user;
+
+	while(osMutexAcquire(comms->rcvr_mutex, 1000) != osOK);
+	rcvr->next = comms->receivers;
+	comms->receivers = rcvr;
+	osMutexRelease(comms->rcvr_mutex);
+	return COMMS_SUCCESS;
+}
+
+/**********************************************************************************************
+ *	Message manipulation and sending
+ **********************************************************************************************/
+
+void comms_init_message(comms_layer_t* comms, comms_msg_t* msg)
+{
+	memset(msg, 0, sizeof(comms_msg_t));
+	msg->source = comms->address;
+	msg->destination = AM_BROADCAST_ADDR;
+}
+
+void* comms_get_payload(comms_layer_t* comms, const comms_msg_t* msg, uint8_t length)
+{
+	if(length > COMMS_MSG_PAYLOAD_SIZE)return NULL;
+	return (void*)msg->payload;
+}
+
+uint8_t comms_get_payload_length(comms_layer_t* comms, const comms_msg_t* msg)
+{
+	return msg->length;
+}
+
+void comms_set_payload_length(comms_layer_t* comms, comms_msg_t* msg, uint8_t length)
+{
+	msg->length = length;
+}
+
+uint8_t comms_get_payload_max_length(comms_layer_t* comms)
+{
+	return COMMS_MSG_PAYLOAD_SIZE;
+}
+
+am_id_t comms_get_packet_type(comms_layer_t* comms, const comms_msg_t* msg)
+{
+	return msg->type;
+}
+
+void comms_set_packet_type(comms_layer_t* comms, comms_msg_t* msg, am_id_t ptype)
+{
+	msg->type = ptype;
+}
+
+am_addr_t comms_am_get_source(comms_layer_t* comms, const comms_msg_t* msg)
+{
+	return msg->source;
+}
+
+am_addr_t comms_am_get_destination(comms_layer_t* comms, const comms_msg_t* msg)
+{
+	return msg->destination;
+}
+
+void comms_am_set_destination(comms_layer_t* comms, comms_msg_t* msg, am_addr_t dest)
+{
+	msg->destination = dest;
+}
+
+comms_error_t comms_send(comms_layer_t* comms, comms_msg_t* msg, comms_send_done_f* sdf, void* user)
+{
+	radio_tx_t tx;
+
+	if(comms->status != COMMS_STARTED)return COMMS_EOFF;
+	if(msg->length > COMMS_MSG_PAYLOAD_SIZE)return COMMS_ESIZE;
+
+	tx.msg = msg;
+	tx.sdf = sdf;
+	tx.user = user;
+	tx.frame.type = msg->type;
+	tx.frame.source = hton16(comms->address);
+	tx.frame.destination = hton16(msg->destination);
+	tx.frame.length = msg->length;
+	memcpy(tx.frame.payload, msg->payload, msg->length);
+
+	if(osMessageQueuePut(comms->tx_qID, &tx, 0, 0) != osOK)return COMMS_EBUSY;
+	return COMMS_SUCCESS;
+}
@@ -0,0 +1,282 @@
+/**
+ *
+ * This is the journal replay tool. It plays a game journal (see
+ * crane/journal.c) recorded by clg-crane-host or clg-game-sim back into the
+ * crane-agent game engine (crane_state.c, system_state.c) and compares the
+ * crane state of every round with the recorded one.
+ *
+ * The engine is started as in the recording and every game gets its
+ * recorded seed. Recorded messages are handed to the receive functions of
+ * the engine directly, at the recorded tick relative to the start of the
+ * engine, from one thread that takes the place of the radio receive thread.
+ * The kernel runs in virtual time, so the replay runs as fast as the engine
+ * can process the messages, and the engine sees the same inputs at the same
+ * ticks. Rounds and game scores that differ are printed, at the end the 
+ * number of matching rounds and scores, the wall clock time used and the
+ * message rate are printed. Engine
+ * changes can be checked against recorded traffic this way, both for the
+ * outcome and for throughput.
+ *
+ * Usage: clg-replay [-v] journal
+ *
+ * -v passes the log output of the engine through, otherwise it is discarded.
+ *
+ * The replay must be built with at least as many games (CLG_MAX_GAMES) and
+ * ships (SDB_MAX_SHIPS) as the recording. A recording made in real time
+ * (clg-crane-host) can differ from its replay for messages that arrived
+ * within a tick of the end of a round, as the round timer of the recording
+ * drifts by the processing time of every round.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "cmsis_os2.h"
+#include "cmsis_os2_host.h"
+
+#include "mist_comm_am.h"
+#include "radio.h"
+#include "endianness.h"
+
+#include "host_loglevels.h"
+#define __MODUUL__ "rply"
+#define __LOG_LEVEL__ (LOG_LEVEL_replay & BASE_LOG_LEVEL)
+#include "log.h"
+
+#include "system_state.h"
+#include "crane_state.h"
+#include "journal.h"
+#include "journal_file.h"
+#include "clg_comm.h"
+
+#define REPLAY_ROUNDS 65536		// Round sequence numbers
+#define REPLAY_MAX_DIFFS 20		// Differing rounds printed
+
+typedef struct {
+	journal_round_t round;
+	bool recorded;
+	bool replayed;
+} replay_round_t;
+
+static journal_record_t* records;
+static size_t record_count;
+static replay_round_t* rounds[CLG_MAX_GAMES];	// By round sequence number
+static uint8_t game_count;
+static int report_fd = STDOUT_FILENO;
+static struct timespec wall_start;
+
+// Replay results, written by the journal thread
+static uint32_t rounds_matched, rounds_differ, rounds_extra, scores_matched, scores_differ;
+
+/**********************************************************************************************
+ *	Result comparison
+ **********************************************************************************************/
+
+// Compares a replayed score with the recorded score of the same game.
+static void compareScore(const journal_record_t* rec)
+{
+	journal_score_t jscore, recorded;
+	size_t i;
+
+	memcpy(&jscore, rec->data, sizeof(jscore));
+	for(i=0;i<record_count;i++)
+	{
+		if(records[i].type != JOURNAL_SCORE || records[i].game != rec->game || records[i].len != sizeof(recorded))continue;
+		memcpy(&recorded, records[i].data, sizeof(recorded));
+		if(recorded.seq != jscore.seq)continue;
+		if(memcmp(&recorded, &jscore, sizeof(jscore)) == 0)scores_matched++;
+		else
+		{
+			dprintf(report_fd, "Game %u #%u: recorded ships %u loaded %u, replayed ships %u loaded %u\n", rec->game, ntoh16(jscore.seq),
+				ntoh16(recorded.ships), ntoh16(recorded.loaded), ntoh16(jscore.ships), ntoh16(jscore.loaded));
+			scores_differ++;
+		}
+		return;
+	}
+}
+
+// Journal sink of the replayed engine.
+static void compareSink(const journal_record_t* rec, void* user)
+{
+	journal_round_t jround;
+	replay_round_t* r;
+
+	if(rec->type == JOURNAL_SCORE && rec->game < game_count && rec->len == sizeof(journal_score_t))compareScore(rec);
+	if(rec->type != JOURNAL_ROUND || rec->game >= game_count || rec->len != sizeof(journal_round_t))return;
+	memcpy(&jround, rec->data, sizeof(jround));
+	r = &rounds[rec->game][ntoh16(jround.seq)];
+	r->replayed = true;
+	if(!r->recorded)rounds_extra++;
+	else if(memcmp(&r->round, &jround, sizeof(jround)) == 0)rounds_matched++;
+	else
+	{
+		if(rounds_differ < REPLAY_MAX_DIFFS)dprintf(report_fd, "Game %u round %u: recorded %u %u %u cmd %u, replayed %u %u %u cmd %u\n",
+			rec->game, ntoh16(jround.seq), r->round.x, r->round.y, r->round.cargo, r->round.done,
+			jround.x, jround.y, jround.cargo, jround.done);
+		rounds_differ++;
+	}
+}
+
+/**********************************************************************************************
+ *	Replay
+ **********************************************************************************************/
+
+static void replayLoop(void * arg)
+{
+	uint32_t offset, start_tick = 0, last_tick = 0, seed, now, target, messages = 0, recorded = 0, scores = 0, lost = 0;
+	bool seeded[CLG_MAX_GAMES] = {false};
+	struct timespec wall_end;
+	bool started = false;
+	comms_msg_t msg;
+	double wall;
+	size_t i;
+	uint8_t game;
+
+	comms_layer_t* radio = radio_init(DEFAULT_RADIO_CHANNEL, 0x22, CRANE_ADDR);
+	if(radio == NULL || comms_start(radio, NULL, NULL) != COMMS_SUCCESS)exit(1);
+	while(comms_status(radio) != COMMS_STARTED)osDelay(1);
+
+	// Responses are sent but nobody listens, all input comes from the journal
+	initJournal(compareSink, NULL);
+	for(game=0;game<game_count;game++)
+	{
+		initCrane(game, radio, CRANE_ADDR);
+		initSystem(game, radio, CRANE_ADDR);
+	}
+
+	for(i=0;i<record_count;i++)
+	{
+		const journal_record_t* rec = &records[i];
+		if(rec->type == JOURNAL_START && !started)
+		{
+			start_tick = rec->tick;
+			started = true;
+		}
+		else if(rec->type == JOURNAL_SEED && rec->len == sizeof(seed) && !seeded[rec->game])
+		{
+			// Seeds of the following games are drawn by the engine
+			memcpy(&seed, rec->data, sizeof(seed));
+			setGameSeed(rec->game, ntoh32(seed));
+			seeded[rec->game] = true;
+		}
+		else if(rec->type == JOURNAL_LOST && rec->len == sizeof(uint16_t))lost += (rec->data[0] << 8) | rec->data[1];
+		else if(rec->type == JOURNAL_ROUND)recorded++;
+		else if(rec->type == JOURNAL_SCORE)scores++;
+		last_tick = rec->tick;
+	}
+	if(lost > 0)dprintf(report_fd, "Journal is incomplete, %"PRIu32" records lost, replay is not exact\n", lost);
+
+	offset = osKernelGetTickCount() - start_tick;
+	for(i=0;i<record_count;i++)
+	{
+		const journal_record_t* rec = &records[i];
+		if(rec->type != JOURNAL_CRANE_MSG && rec->type != JOURNAL_SYSTEM_MSG)continue;
+
+		target = rec->tick + offset;
+		now = osKernelGetTickCount();
+		if((int32_t)(target - now) > 0)osDelay(target - now);
+
+		comms_init_message(radio, &msg);
+		memcpy(comms_get_payload(radio, &msg, rec->len), rec->data, rec->len);
+		comms_set_payload_length(radio, &msg, rec->len);
+		if(rec->type == JOURNAL_CRANE_MSG)craneReceiveMessage(radio, &msg, CLG_GAME_USER(rec->game));
+		else systemReceiveMessage(radio, &msg, CLG_GAME_USER(rec->game));
+		messages++;
+	}
+
+	// Let the last recorded round end and its record reach compareSink
+	target = last_tick + offset + 1;
+	now = osKernelGetTickCount();
+	if((int32_t)(target - now) > 0)osDelay(target - now);
+	osDelay(1);
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	dprintf(report_fd, "Records %zu, messages %"PRIu32", game time %.3f s\n", record_count, messages, (last_tick - start_tick) / (double)osKernelGetTickFreq());
+	dprintf(report_fd, "Rounds recorded %"PRIu32", matched %"PRIu32", differ %"PRIu32", not recorded %"PRIu32"\n", recorded, rounds_matched, rounds_differ, rounds_extra);
+	if(scores > 0)dprintf(report_fd, "Scores recorded %"PRIu32", matched %"PRIu32", differ %"PRIu32"\n", scores, scores_matched, scores_differ);
+	dprintf(report_fd, "Wall time %.3f s, %.0f messages/s\n", wall, messages / wall);
+	exit(rounds_differ > 0 || rounds_matched < recorded || scores_matched < scores ? 1 : 0);
+}
+
+int main (int argc, char* argv[])
+{
+	journal_round_t jround;
+	bool verbose = false;
+	size_t i;
+	int opt;
+
+	while((opt = getopt(argc, argv, "v")) != -1)
+	{
+		switch(opt)
+		{
+			case 'v': verbose = true;
+			break;
+			default:
+				fprintf(stderr, "Usage: %s [-v] journal\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind >= argc)
+	{
+		fprintf(stderr, "Usage: %s [-v] journal\n", argv[0]);
+		return 1;
+	}
+
+	records = readJournalFile(argv[optind], &record_count);
+	if(records == NULL)
+	{
+		fprintf(stderr, "%s is not a journal\n", argv[optind]);
+		return 1;
+	}
+	for(i=0;i<record_count;i++)
+	{
+		const journal_record_t* rec = &records[i];
+		if(rec->game >= CLG_MAX_GAMES)
+		{
+			fprintf(stderr, "Journal has game %u, replay is built with CLG_MAX_GAMES %u\n", rec->game, CLG_MAX_GAMES);
+			return 1;
+		}
+		if(rec->game >= game_count)
+		{
+			game_count = rec->game + 1;
+			rounds[rec->game] = calloc(REPLAY_ROUNDS, sizeof(replay_round_t));
+			if(rounds[rec->game] == NULL)return 1;
+		}
+		if(rec->type == JOURNAL_ROUND && rec->len == sizeof(jround))
+		{
+			memcpy(&jround, rec->data, sizeof(jround));
+			rounds[rec->game][ntoh16(jround.seq)].round = jround;
+			rounds[rec->game][ntoh16(jround.seq)].recorded = true;
+		}
+	}
+
+	if(!verbose)
+	{
+		report_fd = dup(STDOUT_FILENO);
+		int null_fd = open("/dev/null", O_WRONLY);
+		if(report_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0)return 1;
+		close(null_fd);
+	}
+
+	osHostSetVirtualTime(true);
+	radio_set_bus(RADIO_BUS_LOCAL);
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+	osKernelInitialize();
+
+	const osThreadAttr_t replay_thread_attr = { .name = "replay" };
+	osThreadNew(replayLoop, NULL, &replay_thread_attr);
+	osKernelStart(); // This should never return
+
+	return 1;
+}
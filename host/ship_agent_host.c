@@ -0,0 +1,55 @@
+/**
+ *
+ * This is the host (Linux) replacement of ship_main.c of the ship-agent,
+ * built into clg-ship-agent.so together with the ship-agent modules. Only the
+ * entry point is exported, all other symbols of the shared object are hidden,
+ * so ship-agent functions do not clash with the crane-agent functions of the
+ * same name in the loading process.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "cmsis_os2.h"
+
+#include "mist_comm_am.h"
+#include "radio.h"
+
+#include "loglevels.h"
+#define __MODUUL__ "main"
+#define __LOG_LEVEL__ (LOG_LEVEL_ship_main & BASE_LOG_LEVEL)
+#include "log.h"
+
+#include "game_status.h"
+#include "crane_control.h"
+#include "ship_strategy.h"
+#include "clg_comm.h"
+#include "ship_agent_host.h"
+
+static comms_receiver_t rcvr, rcvr2, rcvr3;
+
+__attribute__((visibility("default"))) ship_agent_start_f shipAgentStart;
+
+bool shipAgentStart(am_addr_t addr)
+{
+	comms_layer_t* radio = radio_init(DEFAULT_RADIO_CHANNEL, 0x22, addr);
+	if(radio == NULL || comms_start(radio, NULL, NULL) != COMMS_SUCCESS)
+	{
+		return false;
+	}
+
+	while(comms_status(radio) != COMMS_STARTED)osDelay(1);
+
+	comms_register_recv(radio, &rcvr, craneReceiveMessage, NULL, AMID_CRANECOMMUNICATION);
+	comms_register_recv(radio, &rcvr2, systemReceiveMessage, NULL, AMID_SYSTEMCOMMUNICATION);
+	comms_register_recv(radio, &rcvr3, ship2ShipReceiveMessage, NULL, AMID_SHIPCOMMUNICATION);
+	debug1("ADDR:%04"PRIX16, addr);
+
+	initSystemStatus(radio, addr); // This should be first
+	initCraneControl(radio, addr); // This should be second
+	initShipStrategy(radio, addr);
+	return true;
+}
@@ -0,0 +1,28 @@
+/**
+ *
+ * Host (Linux) entry point of the ship-agent. The ship-agent modules keep
+ * their state in file-scope variables, so the host builds them into a shared
+ * object (clg-ship-agent.so) and every ship instance is a separately loaded
+ * copy of it, see clg-tournament.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef SHIP_AGENT_HOST_H_
+#define SHIP_AGENT_HOST_H_
+
+#include <stdbool.h>
+
+#include "mist_comm_am.h"
+
+// Name of the entry point symbol
+#define SHIP_AGENT_START "shipAgentStart"
+
+// Creates a radio instance with address 'addr' and starts the ship-agent
+// modules on it. Must be called from a kernel thread. Returns false if the
+// radio instance could not be created.
+typedef bool ship_agent_start_f(am_addr_t addr);
+
+#endif//SHIP_AGENT_HOST_H_
@@ -0,0 +1,348 @@
+/**
+ *
+ * This is a simulated fleet of ships for load testing the host build of the
+ * crane-agent. Every simulated ship has its own loopback radio instance and
+ * address and follows the simplest possible strategy:
+ *
+ * - send WELCOME_MSG every SIM_WELCOME_RETRY_INTERVAL until a WELCOME_RMSG
+ *   is received
+ * - every crane update round, SIM_VOTE_DELAY after the crane location message,
+ *   vote for the command that moves the crane towards own location (x first)
+ *   or place cargo if the crane is already there
+ * - stop voting when own cargo has been placed and leave the game (LEAVE_QMSG)
+ * - when the departure of the ship is announced (DEPART_RMSG), because it left
+ *   or because its loading deadline passed, join the game again as a new ship
+ *
+ * Ships join the next game the same way when a game ends. Games are counted
+ * from the scoreboards (SCOREBOARD_MSG).
+ *
+ * Fleet statistics are printed every SIM_STATS_INTERVAL.
+ *
+ * Every fleet plays one game of a multi-game crane-agent, i.e. talks to the
+ * crane on the AM types of that game (see CLG_GAME_AMID). Several fleets can
+ * run in one process.
+ *
+ * The fleet runs standalone against a crane-agent process (ship_sim_main.c)
+ * or in the same process with the crane engine (game_sim_main.c).
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "cmsis_os2.h"
+
+#include "mist_comm_am.h"
+#include "radio.h"
+#include "endianness.h"
+
+#include "host_loglevels.h"
+#define __MODUUL__ "ssim"
+#define __LOG_LEVEL__ (LOG_LEVEL_ship_sim & BASE_LOG_LEVEL)
+#include "log.h"
+
+#include "clg_comm.h"
+#include "game_types.h"
+#include "ship_sim.h"
+
+#define SIM_TICK 100UL						// Simulation step, ms
+#define SIM_WELCOME_RETRY_INTERVAL 2000UL	// ms
+#define SIM_VOTE_DELAY 1000UL				// Delay from crane location message to vote, ms
+#define SIM_STATS_INTERVAL 10000UL			// ms
+
+struct sim_fleet;
+
+typedef struct {
+	struct sim_fleet* fleet;
+	comms_layer_t* radio;
+	comms_receiver_t crcvr, srcvr;
+	comms_msg_t msg;
+	am_addr_t addr;
+	bool registered;
+	bool loaded;
+	bool leaving;
+	uint8_t x, y;
+	uint32_t welcome_time;
+} sim_ship_t;
+
+struct sim_fleet {
+	uint8_t game;
+	sim_ship_t* ships;
+	uint16_t size;
+	am_addr_t crane_addr;
+
+	osMutexId_t mutex; // Protects ships and crane state
+	crane_location_t cloc;
+	uint32_t round_start, rounds;
+	uint32_t departed, delivered;	// Departures, departures with cargo
+	uint32_t games;					// Games ended
+};
+
+static void simLoop(void *args);
+
+/**********************************************************************************************
+ *	Message receiving
+ **********************************************************************************************/
+
+static void simCraneReceive(comms_layer_t* comms, const comms_msg_t* msg, void* user)
+{
+	sim_ship_t* ship = (sim_ship_t*)user;
+	sim_fleet_t* fleet = ship->fleet;
+	crane_location_msg_t* packet;
+
+	if(comms_get_payload_length(comms, msg) != sizeof(crane_location_msg_t))return;
+	packet = (crane_location_msg_t*)comms_get_payload(comms, msg, sizeof(crane_location_msg_t));
+	if(packet->messageID != CRANE_LOCATION_MSG)return;
+
+	while(osMutexAcquire(fleet->mutex, 1000) != osOK);
+	// Every ship hears every broadcast, round timing is taken from the first ship only
+	if(ship == &fleet->ships[0])
+	{
+		fleet->cloc.crane_x = packet->x_coordinate;
+		fleet->cloc.crane_y = packet->y_coordinate;
+		fleet->cloc.cargo_here = packet->cargoPlaced;
+		fleet->round_start = osKernelGetTickCount();
+		fleet->rounds++;
+	}
+	if(packet->cargoPlaced && ship->registered && packet->x_coordinate == ship->x && packet->y_coordinate == ship->y)
+	{
+		if(!ship->loaded)info1("Ship %04"PRIX16" loaded", ship->addr);
+		ship->loaded = true;
+	}
+	osMutexRelease(fleet->mutex);
+}
+
+static void simSystemReceive(comms_layer_t* comms, const comms_msg_t* msg, void* user)
+{
+	sim_ship_t* ship = (sim_ship_t*)user;
+	query_response_msg_t* packet;
+	scoreboard_msg_t* score;
+	uint8_t len = comms_get_payload_length(comms, msg);
+
+	// Every ship hears every scoreboard, games are counted by the first ship only
+	if(len >= offsetof(scoreboard_msg_t, winners) && ship == &ship->fleet->ships[0])
+	{
+		score = (scoreboard_msg_t*)comms_get_payload(comms, msg, len);
+		if(score->messageID == SCOREBOARD_MSG && score->first == 0)
+		{
+			info1("Game %u #%u over, ships %u loaded %u", ship->fleet->game, ntoh16(score->gameSeq), ntoh16(score->ships), ntoh16(score->loaded));
+			while(osMutexAcquire(ship->fleet->mutex, 1000) != osOK);
+			ship->fleet->games++;
+			osMutexRelease(ship->fleet->mutex);
+		}
+	}
+	if(len != sizeof(query_response_msg_t))return;
+	packet = (query_response_msg_t*)comms_get_payload(comms, msg, sizeof(query_response_msg_t));
+	if(ntoh16(packet->shipAddr) != ship->addr)return;
+
+	if(packet->messageID == DEPART_RMSG)
+	{
+		while(osMutexAcquire(ship->fleet->mutex, 1000) != osOK);
+		if(ship->registered)
+		{
+			debug1("Ship %04"PRIX16" departed %u", ship->addr, packet->isCargoLoaded);
+			ship->fleet->departed++;
+			if(packet->isCargoLoaded)ship->fleet->delivered++;
+		}
+		ship->registered = ship->loaded = ship->leaving = false; // Join again
+		osMutexRelease(ship->fleet->mutex);
+		return;
+	}
+	if(packet->messageID != WELCOME_RMSG)return;
+
+	while(osMutexAcquire(ship->fleet->mutex, 1000) != osOK);
+	if(!ship->registered)debug1("Ship %04"PRIX16" at %u %u", ship->addr, packet->x_coordinate, packet->y_coordinate);
+	ship->registered = true;
+	ship->x = packet->x_coordinate;
+	ship->y = packet->y_coordinate;
+	osMutexRelease(ship->fleet->mutex);
+}
+
+/**********************************************************************************************
+ *	Message sending
+ **********************************************************************************************/
+
+static void sendWelcome(sim_ship_t* ship)
+{
+	query_msg_t* qmsg;
+
+	comms_init_message(ship->radio, &ship->msg);
+	qmsg = comms_get_payload(ship->radio, &ship->msg, sizeof(query_msg_t));
+	qmsg->messageID = WELCOME_MSG;
+	qmsg->senderAddr = hton16(ship->addr);
+	qmsg->shipAddr = hton16(ship->addr);
+	comms_set_packet_type(ship->radio, &ship->msg, CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, ship->fleet->game));
+	comms_am_set_destination(ship->radio, &ship->msg, ship->fleet->crane_addr);
+	comms_set_payload_length(ship->radio, &ship->msg, sizeof(query_msg_t));
+	comms_send(ship->radio, &ship->msg, NULL, NULL);
+}
+
+static void sendLeave(sim_ship_t* ship)
+{
+	query_msg_t* qmsg;
+
+	comms_init_message(ship->radio, &ship->msg);
+	qmsg = comms_get_payload(ship->radio, &ship->msg, sizeof(query_msg_t));
+	qmsg->messageID = LEAVE_QMSG;
+	qmsg->senderAddr = hton16(ship->addr);
+	qmsg->shipAddr = hton16(ship->addr);
+	comms_set_packet_type(ship->radio, &ship->msg, CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, ship->fleet->game));
+	comms_am_set_destination(ship->radio, &ship->msg, ship->fleet->crane_addr);
+	comms_set_payload_length(ship->radio, &ship->msg, sizeof(query_msg_t));
+	comms_send(ship->radio, &ship->msg, NULL, NULL);
+}
+
+static void sendCommand(sim_ship_t* ship, crane_command_t cmd)
+{
+	crane_command_msg_t* cmsg;
+
+	comms_init_message(ship->radio, &ship->msg);
+	cmsg = comms_get_payload(ship->radio, &ship->msg, sizeof(crane_command_msg_t));
+	cmsg->messageID = CRANE_COMMAND_MSG;
+	cmsg->senderAddr = hton16(ship->addr);
+	cmsg->cmd = (uint8_t)cmd;
+	comms_set_packet_type(ship->radio, &ship->msg, CLG_GAME_AMID(AMID_CRANECOMMUNICATION, ship->fleet->game));
+	comms_am_set_destination(ship->radio, &ship->msg, ship->fleet->crane_addr);
+	comms_set_payload_length(ship->radio, &ship->msg, sizeof(crane_command_msg_t));
+	comms_send(ship->radio, &ship->msg, NULL, NULL);
+}
+
+static crane_command_t selectCommand(const sim_ship_t* ship)
+{
+	const crane_location_t* cloc = &ship->fleet->cloc;
+
+	if(ship->x > cloc->crane_x)return CM_RIGHT;
+	if(ship->x < cloc->crane_x)return CM_LEFT;
+	if(ship->y > cloc->crane_y)return CM_UP;
+	if(ship->y < cloc->crane_y)return CM_DOWN;
+	if(cloc->cargo_here)return CM_NOTHING_TO_DO;
+	return CM_PLACE_CARGO;
+}
+
+/**********************************************************************************************
+ *	Initialise module
+ **********************************************************************************************/
+
+sim_fleet_t* initShipSim(uint8_t game, uint16_t ships, am_addr_t first_addr, am_addr_t crane)
+{
+	uint16_t i;
+	sim_fleet_t* fleet;
+
+	fleet = calloc(1, sizeof(sim_fleet_t));
+	if(ships == 0 || fleet == NULL)return NULL;
+	fleet->ships = calloc(ships, sizeof(sim_ship_t));
+	if(fleet->ships == NULL)
+	{
+		free(fleet);
+		return NULL;
+	}
+	fleet->game = game;
+	fleet->size = ships;
+	fleet->crane_addr = crane;
+	fleet->mutex = osMutexNew(NULL);
+
+	for(i=0;i<fleet->size;i++)
+	{
+		sim_ship_t* ship = &fleet->ships[i];
+		ship->fleet = fleet;
+		ship->addr = (am_addr_t)(first_addr + i);
+		ship->welcome_time = osKernelGetTickCount() - SIM_WELCOME_RETRY_INTERVAL;
+		ship->radio = radio_init(DEFAULT_RADIO_CHANNEL, 0x22, ship->addr);
+		if(ship->radio == NULL || comms_start(ship->radio, NULL, NULL) != COMMS_SUCCESS)
+		{
+			err1("Radio error %04"PRIX16, ship->addr);
+			return NULL; // Radio instances can not be released, fleet is leaked
+		}
+		while(comms_status(ship->radio) != COMMS_STARTED)osDelay(1);
+		comms_register_recv(ship->radio, &ship->crcvr, simCraneReceive, ship, CLG_GAME_AMID(AMID_CRANECOMMUNICATION, game));
+		comms_register_recv(ship->radio, &ship->srcvr, simSystemReceive, ship, CLG_GAME_AMID(AMID_SYSTEMCOMMUNICATION, game));
+	}
+
+	info1("Game %u fleet of %u ships, crane %04"PRIX16, fleet->game, fleet->size, fleet->crane_addr);
+	osThreadNew(simLoop, fleet, NULL);
+	return fleet;
+}
+
+/**********************************************************************************************
+ *	Simulation
+ **********************************************************************************************/
+
+void getShipSimStats(sim_fleet_t* fleet, ship_sim_stats_t* stats)
+{
+	uint16_t i;
+
+	stats->ships = fleet->size;
+	stats->registered = stats->loaded = 0;
+	while(osMutexAcquire(fleet->mutex, 1000) != osOK);
+	for(i=0;i<fleet->size;i++)
+	{
+		if(fleet->ships[i].registered)stats->registered++;
+		if(fleet->ships[i].loaded)stats->loaded++;
+	}
+	stats->rounds = fleet->rounds;
+	stats->departed = fleet->departed;
+	stats->delivered = fleet->delivered;
+	stats->games = fleet->games;
+	osMutexRelease(fleet->mutex);
+}
+
+static void simLoop(void *args)
+{
+	sim_fleet_t* fleet = (sim_fleet_t*)args;
+	uint16_t i, registered, loaded;
+	uint32_t now, voted_round = 0, last_stats = 0;
+	crane_command_t cmd;
+
+	for(;;)
+	{
+		osDelay(SIM_TICK);
+		now = osKernelGetTickCount();
+
+		while(osMutexAcquire(fleet->mutex, 1000) != osOK);
+		registered = loaded = 0;
+		for(i=0;i<fleet->size;i++)
+		{
+			sim_ship_t* ship = &fleet->ships[i];
+			if(!ship->registered)
+			{
+				if(now - ship->welcome_time >= SIM_WELCOME_RETRY_INTERVAL)
+				{
+					ship->welcome_time = now;
+					sendWelcome(ship);
+				}
+				continue;
+			}
+			registered++;
+			if(ship->loaded)
+			{
+				loaded++;
+				if(!ship->leaving)sendLeave(ship); // Departure is announced with DEPART_RMSG
+				ship->leaving = true;
+			}
+		}
+
+		if(fleet->rounds != voted_round && now - fleet->round_start >= SIM_VOTE_DELAY)
+		{
+			voted_round = fleet->rounds;
+			for(i=0;i<fleet->size;i++)
+			{
+				sim_ship_t* ship = &fleet->ships[i];
+				if(!ship->registered || ship->loaded)continue;
+				cmd = selectCommand(ship);
+				if(cmd != CM_NOTHING_TO_DO)sendCommand(ship, cmd);
+			}
+		}
+		osMutexRelease(fleet->mutex);
+
+		if(now - last_stats >= SIM_STATS_INTERVAL)
+		{
+			last_stats = now;
+			info1("Game %u fleet %u registered %u loaded %u departed %"PRIu32" delivered %"PRIu32" rounds %"PRIu32" games %"PRIu32,
+				fleet->game, fleet->size, registered, loaded, fleet->departed, fleet->delivered, fleet->rounds, fleet->games);
+		}
+	}
+}
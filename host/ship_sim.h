@@ -0,0 +1,40 @@
+/**
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+
+#ifndef SHIP_SIM_H_
+#define SHIP_SIM_H_
+
+#include "mist_comm_am.h"
+
+typedef struct {
+	uint16_t ships;
+	uint16_t registered;
+	uint16_t loaded;
+	uint32_t rounds;	// Crane update rounds observed
+	uint32_t departed;	// Ships that left the game or whose loading deadline passed
+	uint32_t delivered;	// Departed ships that got their cargo
+	uint32_t games;		// Games ended
+} ship_sim_stats_t;
+
+typedef struct sim_fleet sim_fleet_t;
+
+/**********************************************************************************************
+ *	Initialise module
+ **********************************************************************************************/
+
+// Creates a fleet of 'ships' simulated ships for game 'game' with consecutive addresses
+// starting from 'first_addr', each with its own radio instance, and starts the simulation.
+// Must be called from a kernel thread. Returns NULL if a radio instance could not be created.
+sim_fleet_t* initShipSim(uint8_t game, uint16_t ships, am_addr_t first_addr, am_addr_t crane_addr);
+
+/**********************************************************************************************
+ *	Utility functions
+ **********************************************************************************************/
+
+void getShipSimStats(sim_fleet_t* fleet, ship_sim_stats_t* stats);
+
+#endif//SHIP_SIM_H_
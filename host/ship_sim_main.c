@@ -0,0 +1,71 @@
+/**
+ *
+ * This is the main function of the simulated fleet of ships (see ship_sim.c)
+ * that runs against a separate crane-agent process over the socket bus.
+ *
+ * Usage: clg-ship-sim [-n ships] [-a first address] [-c crane address] [-g game]
+ *
+ * Addresses are given in hex. 'game' selects the game of a multi-game
+ * crane-agent, default is game 0. The loopback bus directory can be changed with
+ * environment variable CLG_BUS_DIR.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cmsis_os2.h"
+
+#include "mist_comm_am.h"
+
+#include "clg_comm.h"
+#include "game_types.h"
+#include "ship_sim.h"
+
+#define SIM_DEFAULT_SHIPS 10
+#define SIM_DEFAULT_FIRST_ADDR 0x0100
+
+static uint16_t fleet_size = SIM_DEFAULT_SHIPS;
+static am_addr_t first_addr = SIM_DEFAULT_FIRST_ADDR;
+static am_addr_t crane_addr = CRANE_ADDR;
+static uint8_t game = 0;
+
+static void setup_loop(void * arg)
+{
+	if(initShipSim(game, fleet_size, first_addr, crane_addr) == NULL)exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:a:c:g:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n': fleet_size = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+			case 'a': first_addr = (am_addr_t)strtoul(optarg, NULL, 16);
+			break;
+			case 'c': crane_addr = (am_addr_t)strtoul(optarg, NULL, 16);
+			break;
+			case 'g': game = (uint8_t)strtoul(optarg, NULL, 0);
+			break;
+			default:
+				fprintf(stderr, "Usage: %s [-n ships] [-a first address] [-c crane address] [-g game]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	osKernelInitialize();
+
+	const osThreadAttr_t setup_thread_attr = { .name = "setup" };
+	osThreadNew(setup_loop, NULL, &setup_thread_attr);
+	osKernelStart(); // This should never return
+
+	return 1;
+}
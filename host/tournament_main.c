@@ -0,0 +1,451 @@
+/**
+ *
+ * This is the tournament runner. It plays many games of ship-agents against
+ * the crane-agent game engine and reports games per second, the share of
+ * ships that got their cargo and the win rate of every ship strategy.
+ *
+ * Every game runs in its own child process: the runner binary started in game
+ * mode, with the crane engine (crane_state.c, system_state.c) and 'ships'
+ * ship-agents on the local bus in virtual time (see game_sim_main.c). The
+ * ship-agent modules keep their state in file-scope variables, so each ship is
+ * a separately loaded copy of a ship-agent shared object (see
+ * ship_agent_host.h). Every strategy is one shared object, built from its own
+ * ship_strategy.c. Ship 'i' of game 'k' plays strategy (k + i) % strategies,
+ * so all strategies get the same seats equally often. A ship wins if its
+ * cargo has been loaded when it departs (DEPART_RMSG, heard by an observer
+ * radio of the game process) or when the game ends. The game process ends
+ * with the scoreboard (SCOREBOARD_MSG) of the game, or after 'duration' if
+ * there is none by then.
+ *
+ * Games are scheduled on 'jobs' worker threads. Every worker has a deque of
+ * games, filled round robin at start. A worker takes games from the back of
+ * its own deque and, once it has run empty, steals from the front of the
+ * others, so workers that drew short games take load off the rest.
+ *
+ * Usage: clg-tournament [-g games] [-n ships] [-j jobs] [-t duration]
+ *                       [-s strategy.so]... [-r seed] [-v]
+ *
+ * The default strategy is clg-ship-agent.so next to the runner binary.
+ * Game 'k' is seeded with 'seed' + k (see setGameSeed), the seed defaults to
+ * the current time and is printed, so a tournament can be played again.
+ * -v passes the log output of the games through.
+ *
+ * Copyright Proactivity Lab 2020
+ *
+ * @license MIT
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <dlfcn.h>
+#include <sys/wait.h>
+
+#include "cmsis_os2.h"
+#include "cmsis_os2_host.h"
+
+#include "mist_comm_am.h"
+#include "radio.h"
+#include "endianness.h"
+
+#include "host_loglevels.h"
+#define __MODUUL__ "tour"
+#define __LOG_LEVEL__ (LOG_LEVEL_tournament & BASE_LOG_LEVEL)
+#include "log.h"
+
+#include "system_state.h"
+#include "crane_state.h"
+#include "clg_comm.h"
+#include "ship_agent_host.h"
+
+#define TOUR_DEFAULT_GAMES 100
+#define TOUR_DEFAULT_SHIPS MAX_SHIPS
+// Longest possible game (see initGame in system_state.c) and two more rounds, seconds
+#define TOUR_DEFAULT_DURATION ((3 * (GRID_UPPER_BOUND - GRID_LOWER_BOUND) + 2) * CRANE_UPDATE_INTERVAL)
+#define TOUR_MAX_STRATEGIES 8
+#define TOUR_FIRST_SHIP_ADDR 0x0100
+#define TOUR_OBSERVER_ADDR 0x00FE	// Listens to departures in a game process
+#define TOUR_RESULT_FD 3			// Game result pipe of a game process
+
+extern char** environ;
+
+typedef struct {
+	pthread_mutex_t mutex;
+	uint32_t* games;
+	uint32_t head, tail;	// Thieves take from head, owner from tail
+} game_deque_t;
+
+typedef struct {
+	uint32_t ships;
+	uint32_t wins;
+} strategy_stats_t;
+
+static uint32_t game_count = TOUR_DEFAULT_GAMES;
+static uint16_t fleet_size = TOUR_DEFAULT_SHIPS;
+static uint16_t jobs;
+static uint32_t duration = TOUR_DEFAULT_DURATION;
+static const char* strategies[TOUR_MAX_STRATEGIES];
+static uint8_t strategy_count;
+static bool verbose;
+static uint32_t seed;
+
+// Scheduler state
+static game_deque_t* deques;
+static pthread_mutex_t spawn_mutex = PTHREAD_MUTEX_INITIALIZER;	// Keeps pipes of one game from leaking into another
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static strategy_stats_t strategy_stats[TOUR_MAX_STRATEGIES];
+static uint32_t games_played, games_failed, steals;
+
+// Game state
+static uint32_t game_number;
+static bool departed_loaded[MAX_SHIPS];	// Ships of the game that departed with cargo
+static osEventFlagsId_t game_over;		// Scoreboard heard
+
+/**********************************************************************************************
+ *	Game process
+ **********************************************************************************************/
+
+// Loads a private copy of shared object 'path'. The dynamic loader maps a file only once,
+// so the copy is written to a new temporary file first.
+static void* loadCopy(const char* path)
+{
+	char name[] = "/tmp/clg-ship-agent-XXXXXX";
+	char buf[4096];
+	ssize_t len;
+	void* handle = NULL;
+	int src, dst;
+
+	src = open(path, O_RDONLY);
+	if(src < 0)return NULL;
+	dst = mkstemp(name);
+	if(dst >= 0)
+	{
+		while((len = read(src, buf, sizeof(buf))) > 0)if(write(dst, buf, (size_t)len) != len)break;
+		close(dst);
+		if(len == 0)handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+		unlink(name);
+	}
+	close(src);
+	return handle;
+}
+
+// Records ships of the game that depart with their cargo and the end of the game.
+static void observeDepartures(comms_layer_t* comms, const comms_msg_t* msg, void* user)
+{
+	query_response_msg_t* packet;
+	uint8_t len = comms_get_payload_length(comms, msg);
+	uint16_t i;
+
+	if(len >= 1 && *(uint8_t*)comms_get_payload(comms, msg, len) == SCOREBOARD_MSG)osEventFlagsSet(game_over, 1);
+	if(len != sizeof(query_response_msg_t))return;
+	packet = (query_response_msg_t*)comms_get_payload(comms, msg, sizeof(query_response_msg_t));
+	if(packet->messageID != DEPART_RMSG || !packet->isCargoLoaded)return;
+	i = ntoh16(packet->shipAddr) - TOUR_FIRST_SHIP_ADDR;
+	if(i < fleet_size)__atomic_store_n(&departed_loaded[i], true, __ATOMIC_RELAXED);
+}
+
+static void gameLoop(void * arg)
+{
+	static comms_receiver_t rcvr, rcvr2, orcvr;
+	ship_agent_start_f* start;
+	sdb_t ship;
+	void* so;
+	uint16_t i;
+
+	comms_layer_t* radio = radio_init(DEFAULT_RADIO_CHANNEL, 0x22, CRANE_ADDR);
+	if(radio == NULL || comms_start(radio, NULL, NULL) != COMMS_SUCCESS)_exit(1);
+	while(comms_status(radio) != COMMS_STARTED)osDelay(1);
+	comms_register_recv(radio, &rcvr, craneReceiveMessage, CLG_GAME_USER(0), AMID_CRANECOMMUNICATION);
+	comms_register_recv(radio, &rcvr2, systemReceiveMessage, CLG_GAME_USER(0), AMID_SYSTEMCOMMUNICATION);
+
+	comms_layer_t* observer = radio_init(DEFAULT_RADIO_CHANNEL, 0x22, TOUR_OBSERVER_ADDR);
+	if(observer == NULL || comms_start(observer, NULL, NULL) != COMMS_SUCCESS)_exit(1);
+	while(comms_status(observer) != COMMS_STARTED)osDelay(1);
+	game_over = osEventFlagsNew(NULL);
+	comms_register_recv(observer, &orcvr, observeDepartures, NULL, AMID_SYSTEMCOMMUNICATION);
+
+	initCrane(0, radio, CRANE_ADDR);
+	initSystem(0, radio, CRANE_ADDR);
+	setGameSeed(0, seed + game_number);
+
+	for(i=0;i<fleet_size;i++)
+	{
+		const char* path = strategies[(game_number + i) % strategy_count];
+		so = loadCopy(path);
+		start = so != NULL ? (ship_agent_start_f*)dlsym(so, SHIP_AGENT_START) : NULL;
+		if(start == NULL || !start(TOUR_FIRST_SHIP_ADDR + i))
+		{
+			err1("Ship %u %s: %s", i, path, so == NULL ? dlerror() : "start failed");
+			_exit(1);
+		}
+	}
+
+	osEventFlagsWait(game_over, 1, osFlagsWaitAny, duration * osKernelGetTickFreq());
+
+	dprintf(TOUR_RESULT_FD, "L");
+	for(i=0;i<fleet_size;i++)
+	{
+		bool won = __atomic_load_n(&departed_loaded[i], __ATOMIC_RELAXED) || (getShip(0, TOUR_FIRST_SHIP_ADDR + i, &ship) && ship.isCargoLoaded);
+		dprintf(TOUR_RESULT_FD, " %u", won);
+	}
+	dprintf(TOUR_RESULT_FD, "\n");
+	_exit(0); // Ship-agent threads never stop, skip exit handlers
+}
+
+static int playGame()
+{
+	osHostSetVirtualTime(true);
+	radio_set_bus(RADIO_BUS_LOCAL);
+
+	osKernelInitialize();
+
+	const osThreadAttr_t game_thread_attr = { .name = "game" };
+	osThreadNew(gameLoop, NULL, &game_thread_attr);
+	osKernelStart(); // This should never return
+
+	return 1;
+}
+
+/**********************************************************************************************
+ *	Scheduler
+ **********************************************************************************************/
+
+// Takes the next game for worker 'w', from its own deque or stolen from another one.
+// Returns false if there are no games left.
+static bool takeGame(uint16_t w, uint32_t* game)
+{
+	uint16_t k;
+	bool found = false;
+
+	pthread_mutex_lock(&deques[w].mutex);
+	if(deques[w].tail > deques[w].head)
+	{
+		*game = deques[w].games[--deques[w].tail];
+		found = true;
+	}
+	pthread_mutex_unlock(&deques[w].mutex);
+
+	for(k=1;k<jobs && !found;k++)
+	{
+		game_deque_t* victim = &deques[(w + k) % jobs];
+		pthread_mutex_lock(&victim->mutex);
+		if(victim->tail > victim->head)
+		{
+			*game = victim->games[victim->head++];
+			found = true;
+		}
+		pthread_mutex_unlock(&victim->mutex);
+		if(found)__atomic_fetch_add(&steals, 1, __ATOMIC_RELAXED);
+	}
+	return found;
+}
+
+// Plays 'game' in a game process. Fills 'won' with the result of every ship.
+// Returns false if the game process failed.
+static bool runGame(uint32_t game, bool won[])
+{
+	char arg_game[12], arg_ships[8], arg_duration[12], arg_seed[12], result[4 * MAX_SHIPS + 8];
+	const char* argv[10 + 2 * TOUR_MAX_STRATEGIES];
+	posix_spawn_file_actions_t fa;
+	size_t len = 0;
+	ssize_t n;
+	int fds[2], status, argc = 0, err;
+	pid_t pid;
+	char* p;
+	uint16_t i;
+	uint8_t s;
+
+	snprintf(arg_game, sizeof(arg_game), "%"PRIu32, game);
+	snprintf(arg_ships, sizeof(arg_ships), "%u", fleet_size);
+	snprintf(arg_duration, sizeof(arg_duration), "%"PRIu32, duration);
+	snprintf(arg_seed, sizeof(arg_seed), "%"PRIu32, seed);
+	argv[argc++] = "clg-tournament";
+	argv[argc++] = "-x";
+	argv[argc++] = arg_game;
+	argv[argc++] = "-n";
+	argv[argc++] = arg_ships;
+	argv[argc++] = "-t";
+	argv[argc++] = arg_duration;
+	argv[argc++] = "-r";
+	argv[argc++] = arg_seed;
+	for(s=0;s<strategy_count;s++)
+	{
+		argv[argc++] = "-s";
+		argv[argc++] = strategies[s];
+	}
+	argv[argc] = NULL;
+
+	posix_spawn_file_actions_init(&fa);
+	pthread_mutex_lock(&spawn_mutex);
+	if(pipe(fds) != 0)
+	{
+		pthread_mutex_unlock(&spawn_mutex);
+		posix_spawn_file_actions_destroy(&fa);
+		return false;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	posix_spawn_file_actions_adddup2(&fa, fds[1], TOUR_RESULT_FD); // Result fd itself is not close-on-exec
+	if(!verbose)posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	err = posix_spawn(&pid, "/proc/self/exe", &fa, NULL, (char* const*)argv, environ);
+	close(fds[1]);
+	pthread_mutex_unlock(&spawn_mutex);
+	posix_spawn_file_actions_destroy(&fa);
+	if(err != 0)
+	{
+		close(fds[0]);
+		return false;
+	}
+
+	while(len < sizeof(result) - 1 && (n = read(fds[0], result + len, sizeof(result) - 1 - len)) > 0)len += (size_t)n;
+	result[len] = '\0';
+	close(fds[0]);
+	if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)return false;
+
+	if(result[0] != 'L')return false;
+	p = result + 1;
+	for(i=0;i<fleet_size;i++)won[i] = strtoul(p, &p, 10) != 0;
+	return true;
+}
+
+static void* workerLoop(void* arg)
+{
+	uint16_t w = (uint16_t)(uintptr_t)arg;
+	bool won[MAX_SHIPS];
+	uint32_t game;
+	uint16_t i;
+
+	while(takeGame(w, &game))
+	{
+		bool ok = runGame(game, won);
+
+		pthread_mutex_lock(&stats_mutex);
+		if(ok)
+		{
+			games_played++;
+			for(i=0;i<fleet_size;i++)
+			{
+				strategy_stats_t* st = &strategy_stats[(game + i) % strategy_count];
+				st->ships++;
+				if(won[i])st->wins++;
+			}
+		}
+		else games_failed++;
+		pthread_mutex_unlock(&stats_mutex);
+	}
+	return NULL;
+}
+
+static int runTournament()
+{
+	pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+	struct timespec start, end;
+	uint32_t game, ships = 0, wins = 0;
+	double wall;
+	uint16_t w;
+	uint8_t s;
+
+	deques = calloc(jobs, sizeof(game_deque_t));
+	if(threads == NULL || deques == NULL)return 1;
+	for(w=0;w<jobs;w++)
+	{
+		pthread_mutex_init(&deques[w].mutex, NULL);
+		deques[w].games = calloc(game_count / jobs + 1, sizeof(uint32_t));
+		if(deques[w].games == NULL)return 1;
+	}
+	for(game=0;game<game_count;game++)
+	{
+		game_deque_t* d = &deques[game % jobs];
+		d->games[d->tail++] = game;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(w=0;w<jobs;w++)pthread_create(&threads[w], NULL, workerLoop, (void*)(uintptr_t)w);
+	for(w=0;w<jobs;w++)pthread_join(threads[w], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	for(s=0;s<strategy_count;s++)
+	{
+		ships += strategy_stats[s].ships;
+		wins += strategy_stats[s].wins;
+	}
+	printf("Games %"PRIu32" (%"PRIu32" failed), %u ships, %u jobs, %"PRIu32" steals\n", games_played, games_failed, fleet_size, jobs, steals);
+	printf("Seed %"PRIu32"\n", seed);
+	printf("Wall time %.3f s, %.1f games/s\n", wall, games_played / wall);
+	printf("Cargo loaded %"PRIu32"/%"PRIu32" (%.1f %%)\n", wins, ships, ships > 0 ? 100.0 * wins / ships : 0.0);
+	for(s=0;s<strategy_count;s++)
+	{
+		strategy_stats_t* st = &strategy_stats[s];
+		printf("Strategy %u %s: won %"PRIu32"/%"PRIu32" (%.1f %%)\n", s, strategies[s], st->wins, st->ships, st->ships > 0 ? 100.0 * st->wins / st->ships : 0.0);
+	}
+	return games_failed > 0 ? 1 : 0;
+}
+
+int main (int argc, char* argv[])
+{
+	static char default_strategy[4096];
+	bool game_mode = false;
+	long cpus;
+	int opt;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	jobs = cpus > 0 ? (uint16_t)cpus : 1;
+	seed = (uint32_t)time(NULL);
+
+	while((opt = getopt(argc, argv, "g:n:j:t:s:r:vx:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'g': game_count = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+			case 'n': fleet_size = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+			case 'j': jobs = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+			case 't': duration = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+			case 's':
+				if(strategy_count >= TOUR_MAX_STRATEGIES)
+				{
+					fprintf(stderr, "At most %u strategies\n", TOUR_MAX_STRATEGIES);
+					return 1;
+				}
+				strategies[strategy_count++] = optarg;
+			break;
+			case 'r': seed = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+			case 'v': verbose = true;
+			break;
+			case 'x': // Internal, play one game
+				game_mode = true;
+				game_number = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+			default:
+				fprintf(stderr, "Usage: %s [-g games] [-n ships] [-j jobs] [-t duration] [-s strategy.so]... [-r seed] [-v]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(fleet_size == 0 || fleet_size > MAX_SHIPS || jobs == 0)
+	{
+		fprintf(stderr, "Ships must be 1..%u, jobs at least 1\n", MAX_SHIPS);
+		return 1;
+	}
+	if(strategy_count == 0)
+	{
+		ssize_t len = readlink("/proc/self/exe", default_strategy, sizeof(default_strategy) - 32);
+		if(len <= 0)return 1;
+		default_strategy[len] = '\0';
+		strcpy(strrchr(default_strategy, '/') + 1, "clg-ship-agent.so");
+		strategies[strategy_count++] = default_strategy;
+	}
+
+	if(game_mode)return playGame();
+	return runTournament();
+}
@@ -22,33 +22,79 @@
  * update interval time count is reset. Crane control module must choose a command
  * and send a crane command messages before crane update interval time passes.
  * 
+ * Commands are sent by a one-shot deadline: every round broadcast re-arms it
+ * to fire the command guard time (see setCommandGuard) before the round 
+ * closes, i.e. CRANE_UPDATE_INTERVAL after the broadcast. The command thread
+ * sleeps until the deadline or the next broadcast, whichever comes first, 
+ * so it wakes once a round. If a broadcast is missed, the deadline is moved
+ * on by one round, for at most CC_BLIND_ROUNDS rounds without hearing the 
+ * crane.
+ * 
+ * The guard adapts to the measured delays, so that the command goes out as 
+ * late as possible, after the commands of the other ships have been heard,
+ * but still before the round closes. Every command is timed from the 
+ * moment it is chosen to its send done event (queueing and radio delay) 
+ * and against the next round broadcast: a command that is not sent by the
+ * time the broadcast arrives missed the round. The time from send done to
+ * the broadcast (the margin) is kept in a histogram, with misses in a bin
+ * of their own, and the command counts as confirmed if the broadcast shows
+ * the crane did it. The guard is the smoothed send delay plus the smoothed
+ * deviation of the broadcast period, each with four times its variation, 
+ * plus CC_GUARD_MARGIN. Every miss adds a backoff that doubles with 
+ * consecutive misses and decays by an eighth every round that is made.
+ * Until CC_GUARD_WARMUP commands have been timed, or if adaptation is 
+ * turned off (see setAdaptiveGuard), the guard set with setCommandGuard is
+ * used.
+ * 
+ * Crane location messages carry the crane round sequence number and what the
+ * crane did in the last rounds (see crane_location_msg_t). If some messages were
+ * missed, the history is walked back from the current location to find cargo
+ * placements of the missed rounds, so there is no need to ask the crane with
+ * CM_CURRENT_LOCATION. If more rounds were missed than the history holds, cargo
+ * status of all ships is asked from the crane-agent instead. Responses to
+ * CM_CURRENT_LOCATION carry no history. They update the crane location only if
+ * it is newer and never reset the crane update interval time count, only round
+ * broadcasts do. Neither do they move the round from which the next broadcast
+ * walks the history back, so placements in the rounds missed before a response
+ * are still found.
+ * 
  * Control commands are chosen based on crane control tactics. Ship strategy module 
  * must choose (and implement) a tactic. Some basic tactics are implemented (see
- * crane_control.h) but different new tactics can be added by users. 
+ * crane_control.h) but different new tactics can be added by users. A command 
+ * is chosen from one game snapshot (see getGameSnapshot), so the ships and the
+ * crane are seen as they were after the same update.
+ * 
+ * Tactic cc_tour plans the order in which the crane visits all ships without
+ * cargo, so that as many as possible get their cargo before their loading
+ * deadline (see getShipDeadline). A visit takes the Manhattan distance in rounds
+ * plus a round to place the cargo, a ship whose deadline cannot be met in the
+ * order is skipped. Orders are compared by ships served, then by the sum of
+ * their serving rounds. After each round broadcast the tour is brought up to 
+ * date, ships that got cargo or left are dropped and new ones are inserted
+ * where they cost least, and then improved by moving one ship or reversing a
+ * part of the tour. At most CC_TOUR_BUDGET moves are tried per round, the 
+ * search continues from where it stopped in the next round until no move 
+ * improves the tour. The crane is called to the first ship of the tour.
+ * 
+ * With vote prediction (see setVotePrediction) the straight vote for the target
+ * is announced 1/CC_ANNOUNCE_DIV of the round after the broadcast, and revised
+ * at the deadline from the votes heard by then. The crane uses only the last
+ * command of a ship, so the others get to hear the announced votes before they
+ * cast their final ones, which they could not if everybody voted at the deadline.
  * 
  * Note:
  * 		After ship-agent boot and first initialisation the physical address of 
  * 		crane-agent is not yet known. The first CRANE_LOCATION_MSG to arrive reveals
  * 		(identity manipulation threat?) crane-agent physical address. All messages
  * 		sent before this event will be broadcast and all messages sent after this
- * 		event will be unicast. 
- * 
- * TODO Currently crane command messages are sent as unicast directly to crane-
- * 		agent. This means tactics such as cc_parrot_ship and cc_popular_command
- * 		wont work, because nobody except crane will receive crane control messages.
- * 		Simple solution would be to use broadcast globally, but maybe make it a 
- * 		compile time choice?
+ * 		event will be unicast. Crane command messages are always broadcast, so 
+ * 		that other ships can hear them (see cc_parrot_ship, cc_popular_command 
+ * 		and setVotePrediction).
  * 
  * TODO CRANE_ADDR and SYSYEM_ADDR are still used to identify crane-agent. This
  * 		however does not solve crane-agent identity theft and impersonation problem
  * 		so in this regard it is redundant. Suggested for removal.
  * 
- * TODO Sending command CM_CURRENT_LOCATION and receiving a location message
- * 		in response resets crane interval time count. This messes up crane 
- * 		command sending. Possible fix is to set some sort of flag about sending
- * 		command CM_CURRENT_LOCATION and then when a location message is received
- * 		crane interval time count is not reset and the flag is cleared instead.
- * 
  * Copyright Proactivity Lab 2020
  *
  * @license MIT
@@ -72,6 +118,32 @@
 #define __LOG_LEVEL__ (LOG_LEVEL_crane_control & BASE_LOG_LEVEL)
 #include "log.h"
 
+#define CC_DEFAULT_COMMAND_GUARD 250UL	// Command is sent this long before the round closes, ms
+#define CC_BLIND_ROUNDS 3				// Rounds commands are sent without crane broadcasts
+#define CC_ROUND_FLAG 0x00000001U		// Round broadcast received, see craneMainLoop
+#define CC_GUARD_MARGIN 20UL			// Added to the measured delays, ms
+#define CC_GUARD_MIN 5UL				// ms
+#define CC_GUARD_BACKOFF 10UL			// First backoff after a miss, ms
+#define CC_GUARD_WARMUP 4				// Commands timed before the guard adapts
+#define CC_STATS_ROUNDS 20				// Send statistics are logged every this many rounds
+#define CC_TOUR_BUDGET 256				// Tour moves tried per round, see planTour
+#define CC_VOTE_ONE 60					// Probability 1 in vote prediction, divisible by every tie size
+#define CC_ANNOUNCE_DIV 2				// Vote is announced this part of the round after the broadcast
+
+// Command being sent or waiting for the round broadcast, see sendCommandMsg
+typedef struct {
+	crane_command_msg_t packet;
+	uint32_t chosen;	// Kernel ticks
+	uint16_t round;		// Crane round the command was chosen in
+} cmd_out_t;
+
+// Ship on the tour, see planTour
+typedef struct {
+	am_addr_t addr;
+	loc_bundle_t loc;
+	uint16_t due;		// Rounds left until the loading deadline
+} tour_stop_t;
+
 typedef struct scmd_t
 {
 	am_addr_t ship_addr;
@@ -79,20 +151,47 @@ typedef struct scmd_t
 }scmd_t;
 
 static scmd_t cmds[MAX_SHIPS];
-static uint32_t lastCraneEventTime = 0x0FFFFFFFU; // Event initial value; kernel ticks
+static uint32_t lastCraneEventTime; // Last round broadcast; kernel ticks, protected by cloc_mutex
+
+// Send timing, protected by tmg_mutex
+static uint32_t command_guard = CC_DEFAULT_COMMAND_GUARD; // Set guard, ms
+static bool adaptive_guard = true;
+static cmd_out_t tx_cmd;			// Last command sent
+static bool tx_pending = false;		// tx_cmd waits for the round broadcast
+static bool tx_done = false;		// Send done event of tx_cmd received
+static uint32_t tx_done_time;
+static uint32_t send_avg, send_var;	// Smoothed send delay and its variation, ms * 8
+static uint32_t jit_avg, jit_var;	// Smoothed deviation of broadcast period and its variation, ms * 8
+static uint32_t backoff;			// ms
+static uint32_t last_round_time;	// Arrival of the last round broadcast, kernel ticks
+static uint16_t last_round_seq;
+static bool last_round_valid = false;
+static cc_send_stats_t send_stats;
 static crane_location_t cloc;
+static uint16_t crane_seq; // Round of the last broadcast, history is replayed from it
+static bool crane_seq_valid = false;
+static uint16_t cloc_seq; // Round of 'cloc'
+static bool cloc_seq_valid = false;
 
 // Some initial tactics choices
 static bool Xfirst = true; // Which coordinate to use first, x is default
 static bool alwaysPlaceCargo = true; // Always send 'place cargo' command when crane is on top of a ship
+static bool votePrediction = false; // Vote for the command that is expected to bring the crane closest to the target
 
 static cmd_sel_tactic_t tactic;
 static am_addr_t tactic_addr;
 static loc_bundle_t tactic_loc;
 
-static osMutexId_t cmdb_mutex, cloc_mutex, cctt_mutex;
+// Tour of tactic cc_tour, used only by craneMainLoop thread
+static tour_stop_t tour[MAX_SHIPS];
+static uint8_t tour_len = 0;
+static uint8_t tour_served = 0;	// Ships at the start of 'tour' whose deadline is met
+static uint16_t tour_move = 0;	// Next move to try
+static uint16_t tour_tried = 0;	// Moves tried since the tour last improved
+
+static osMutexId_t cmdb_mutex, cloc_mutex, cctt_mutex, tmg_mutex;
 static osMessageQueueId_t cmsg_qID, lmsg_qID, smsg_qID;
-static osThreadId_t snd_task_id;
+static osThreadId_t snd_task_id, main_task_id;
 
 static comms_msg_t m_msg;
 static comms_layer_t* cradio;
@@ -104,15 +203,30 @@ static void craneMainLoop(void *args);
 static void locationMsgHandler(void *args);
 static void commandMsgHandler(void *args);
 static void sendCommandMsg(void *args);
+static void sendRoundCommand(bool final);
+static void planTour();
+static uint32_t tourCost(const tour_stop_t stops[], uint8_t len, loc_bundle_t from, uint8_t* served);
+static bool tryTourMove(uint16_t move, loc_bundle_t from, uint32_t* cost);
+static bool tourTarget(const game_snapshot_t* snap, loc_bundle_t* loc);
+static crane_command_t voteCommand(const game_snapshot_t* snap, crane_command_t cmd, loc_bundle_t target);
+static int8_t cmdProgress(crane_command_t cmd, loc_bundle_t target, const crane_location_t* crane);
+static void countVotes(uint8_t votes[CM_CURRENT_LOCATION]);
+static void winChances(const uint8_t votes[CM_CURRENT_LOCATION], uint8_t chance[CM_CURRENT_LOCATION]);
+static void timeRound(const crane_location_msg_t* packet, uint32_t now);
+static void smooth(uint32_t* avg, uint32_t* var, uint32_t sample);
+static uint32_t adaptGuard();
 
 static uint8_t getEmptySlot();
-static crane_command_t goToDestination(uint8_t x, uint8_t y);
+static crane_command_t goToDestination(const game_snapshot_t* snap, uint8_t x, uint8_t y);
+static const snapshot_ship_t* shipByAddr(const game_snapshot_t* snap, am_addr_t addr);
+static const snapshot_ship_t* shipAtLoc(const game_snapshot_t* snap, loc_bundle_t loc);
 static crane_command_t parrotShip(am_addr_t sID);
 static crane_command_t selectPopular();
-static crane_command_t selectCommand(uint8_t x, uint8_t y);
-static crane_command_t selectCommandXFirst(uint8_t x, uint8_t y);
-static crane_command_t selectCommandYFirst(uint8_t x, uint8_t y);
+static crane_command_t selectCommand(const game_snapshot_t* snap, uint8_t x, uint8_t y);
+static crane_command_t selectCommandXFirst(const crane_location_t* crane, uint8_t x, uint8_t y);
+static crane_command_t selectCommandYFirst(const crane_location_t* crane, uint8_t x, uint8_t y);
 static void clearCmdsBuf();
+static void replayRounds(const crane_location_msg_t* packet, uint16_t rounds);
 
 /**********************************************************************************************
  *	Initialise module
@@ -125,8 +239,10 @@ void initCraneControl(comms_layer_t* radio, am_addr_t addr)
 	cmdb_mutex = osMutexNew(NULL);				// Protects ships' crane command database
 	cloc_mutex = osMutexNew(&cloc_Mutex_attr);	// Protects current crane location values
 	cctt_mutex = osMutexNew(NULL);				// Protects tactics related variables
+	tmg_mutex = osMutexNew(NULL);				// Protects send timing variables
+	send_stats.guard = command_guard;
 	
-	smsg_qID = osMessageQueueNew(MAX_SHIPS + 3, sizeof(crane_command_msg_t), NULL); // Send queue
+	smsg_qID = osMessageQueueNew(MAX_SHIPS + 3, sizeof(cmd_out_t), NULL); // Send queue
 	cmsg_qID = osMessageQueueNew(MAX_SHIPS + 3, sizeof(crane_command_msg_t), NULL); // Receive queue
 	lmsg_qID = osMessageQueueNew(6, sizeof(crane_location_msg_t), NULL);
 	
@@ -149,11 +265,11 @@ void initCraneControl(comms_layer_t* radio, am_addr_t addr)
 	tactic_addr = my_address;
 	osMutexRelease(cctt_mutex);
 
+	main_task_id = osThreadNew(craneMainLoop, NULL, NULL);	// Sends a command every round, before its deadline is armed
     osThreadNew(commandMsgHandler, NULL, NULL);		// Handles received crane command messages
     osThreadNew(locationMsgHandler, NULL, NULL);	// Handles received crane location messages
     snd_task_id = osThreadNew(sendCommandMsg, NULL, NULL);		// Handles command message sending
 	osThreadFlagsSet(snd_task_id, 0x00000001U); 	// Sets thread to ready-to-send state
-	osThreadNew(craneMainLoop, NULL, NULL);			// Crane state changes
 }
 
 /**********************************************************************************************
@@ -162,84 +278,148 @@ void initCraneControl(comms_layer_t* radio, am_addr_t addr)
 
 static void craneMainLoop(void *args)
 {
-	static crane_command_t cmd = CM_NOTHING_TO_DO;
-	cargo_status_t  stat;
+	const uint32_t round_ticks = CRANE_UPDATE_INTERVAL * osKernelGetTickFreq();
+	uint32_t deadline = 0, announce = 0, next, wait, flags, start, guard;
 	cmd_sel_tactic_t tt;
-	uint32_t time_left, ticks;
-	am_addr_t addr;
-	loc_bundle_t loc;
-	crane_command_msg_t packet;
+	uint8_t blind = 0;
+	bool armed = false, announced = true;
 
-	ticks = (uint32_t)(0.5 * osKernelGetTickFreq()); // Half a second
 	for(;;)
 	{
-		osDelay(ticks);
-		
-		time_left = CRANE_UPDATE_INTERVAL*osKernelGetTickFreq() + lastCraneEventTime - osKernelGetTickCount();
-		if(time_left < ticks)
+		wait = osWaitForever; // Not armed before the first broadcast
+		next = announced ? deadline : announce;
+		if(armed)wait = (int32_t)(next - osKernelGetTickCount()) > 0 ? next - osKernelGetTickCount() : 0;
+
+		flags = osThreadFlagsWait(CC_ROUND_FLAG, osFlagsWaitAny, wait);
+		if((flags & osFlagsError) == 0) // New round, re-arm
 		{
+			while(osMutexAcquire(cloc_mutex, 1000) != osOK);
+			start = lastCraneEventTime;
+			osMutexRelease(cloc_mutex);
+			guard = getCommandGuard() * osKernelGetTickFreq() / 1000;
+
+			deadline = start + round_ticks - (guard < round_ticks ? guard : round_ticks);
+			announce = start + round_ticks / CC_ANNOUNCE_DIV;
+			armed = true;
+			announced = !getVotePrediction() || (int32_t)(deadline - announce) <= 0;
+			blind = 0;
+
 			while(osMutexAcquire(cctt_mutex, 1000) != osOK);
 			tt = tactic;
-			addr = tactic_addr;
-			loc = tactic_loc;
 			osMutexRelease(cctt_mutex);
+			if(tt == cc_tour)planTour();
+			continue;
+		}
+		if(!armed)continue;
 
-			switch(tt)
-			{
-				case cc_do_nothing : 		// Don't send crane control command messages.
-
-					cmd = CM_NOTHING_TO_DO;
-					break;
+		if(!announced) // Let the others hear the straight vote, it is revised at the deadline
+		{
+			sendRoundCommand(false);
+			announced = true;
+			continue;
+		}
+		sendRoundCommand(true);
 
-				case cc_to_address :		// Call crane to specified ship and place cargo.
+		// Keep sending on schedule for a while if broadcasts are missed
+		if(++blind < CC_BLIND_ROUNDS)deadline += round_ticks;
+		else armed = false;
+	}
+}
 
-					stat = getCargoStatus(addr);
-					if(stat == cs_cargo_not_received)
-					{
-						loc = getShipLocation(addr);
-						cmd = goToDestination(loc.x, loc.y);
-					}
-					else cmd = CM_NOTHING_TO_DO; // Nothing to do, cuz cargo placed or no such ship.
-					break;
+// Chooses the command of this round according to current tactic and queues it for sending.
+// Votes are predicted only for the 'final' command of the round, not for the announced one.
+static void sendRoundCommand(bool final)
+{
+	crane_command_t cmd;
+	const snapshot_ship_t* ship;
+	game_snapshot_t snap;
+	cmd_sel_tactic_t tt;
+	am_addr_t addr;
+	loc_bundle_t loc;
+	cmd_out_t out;
+	bool target = false, predict;
 
-				case cc_to_location :		// Call crane to specified location and place cargo.
+	while(osMutexAcquire(cctt_mutex, 1000) != osOK);
+	tt = tactic;
+	addr = tactic_addr;
+	loc = tactic_loc;
+	predict = votePrediction && final;
+	osMutexRelease(cctt_mutex);
 
-					stat = getCargoStatus(getShipAddr(loc));
-					if(stat == cs_cargo_not_received)
-					{
-						cmd = goToDestination(loc.x, loc.y);
-					}
-					else cmd = CM_NOTHING_TO_DO; // Nothing to do, cuz cargo placed or no such ship.
-					break;
+	getGameSnapshot(&snap); // One view of the ships and the crane for the whole choice
 
-				case cc_parrot_ship :		// Send same command message as specified ship.
+	switch(tt)
+	{
+		case cc_do_nothing : 		// Don't send crane control command messages.
 
-					cmd = parrotShip(addr);
-					break;
+			cmd = CM_NOTHING_TO_DO;
+			break;
 
-				case cc_popular_command	:	// Send the command that is currently most popular.
+		case cc_to_address :		// Call crane to specified ship and place cargo.
 
-					cmd = selectPopular();
-					break;
+			ship = shipByAddr(&snap, addr);
+			if(ship != NULL && !ship->cargo)
+			{
+				loc = ship->loc;
+				cmd = goToDestination(&snap, loc.x, loc.y);
+				target = true;
+			}
+			else cmd = CM_NOTHING_TO_DO; // Nothing to do, cuz cargo placed or no such ship.
+			break;
 
-				default :
+		case cc_to_location :		// Call crane to specified location and place cargo.
 
-					cmd = CM_NOTHING_TO_DO;
-					break;
+			ship = shipAtLoc(&snap, loc);
+			if(ship != NULL && !ship->cargo)
+			{
+				cmd = goToDestination(&snap, loc.x, loc.y);
+				target = true;
 			}
+			else cmd = CM_NOTHING_TO_DO; // Nothing to do, cuz cargo placed or no such ship.
+			break;
+
+		case cc_parrot_ship :		// Send same command message as specified ship.
+
+			cmd = parrotShip(addr);
+			break;
+
+		case cc_popular_command	:	// Send the command that is currently most popular.
+
+			cmd = selectPopular();
+			break;
+
+		case cc_tour :				// Call crane along a tour of all ships without cargo.
 
-			info1("Cmnd sel %u", cmd);
-			if(cmd != CM_NOTHING_TO_DO)
+			if(tourTarget(&snap, &loc))
 			{
-				packet.messageID = CRANE_COMMAND_MSG;
-				packet.senderAddr = my_address;
-				packet.cmd = (uint8_t) cmd;
-				osMessageQueuePut(smsg_qID, &packet, 0, 0);
+				cmd = goToDestination(&snap, loc.x, loc.y);
+				target = true;
 			}
-			else ; // Nothing to do.
-		}
-		else ; // There is still time until crane update event, wait!
+			else cmd = CM_NOTHING_TO_DO;
+			break;
+
+		default :
+
+			cmd = CM_NOTHING_TO_DO;
+			break;
 	}
+
+	// Tactics with a target location may vote for another command that is more likely to win
+	if(target && predict && cmd != CM_NOTHING_TO_DO && loc.x != 0 && loc.y != 0)cmd = voteCommand(&snap, cmd, loc);
+
+	info1("Cmnd sel %u", cmd);
+	if(cmd != CM_NOTHING_TO_DO)
+	{
+		out.packet.messageID = CRANE_COMMAND_MSG;
+		out.packet.senderAddr = my_address;
+		out.packet.cmd = (uint8_t) cmd;
+		out.chosen = osKernelGetTickCount();
+		while(osMutexAcquire(cloc_mutex, 1000) != osOK);
+		out.round = crane_seq;
+		osMutexRelease(cloc_mutex);
+		osMessageQueuePut(smsg_qID, &out, 0, 0);
+	}
+	else ; // Nothing to do.
 }
 
 /**********************************************************************************************
@@ -249,7 +429,7 @@ static void craneMainLoop(void *args)
 void craneReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* user)
 {
 	uint8_t pl_len = comms_get_payload_length(comms, msg);
-	am_addr_t crane_addr;
+	am_addr_t crane_addr = AM_BROADCAST_ADDR;
 	
 	if (pl_len == sizeof(crane_command_msg_t))
     {
@@ -282,29 +462,57 @@ void craneReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* use
 static void locationMsgHandler(void *args)
 {
 	crane_location_msg_t packet;
-	loc_bundle_t sloc;
-	am_addr_t saddr;
+	crane_location_t loc;
+	uint16_t seq, rounds;
 	for(;;)
 	{
 		osMessageQueueGet(lmsg_qID, &packet, NULL, osWaitForever);
 		if(packet.messageID == CRANE_LOCATION_MSG && ntoh16(packet.senderAddr) == CRANE_ADDR)
 		{
-			lastCraneEventTime = osKernelGetTickCount();
-			info1("Crane mov %u %u %u", packet.x_coordinate, packet.y_coordinate, packet.cargoPlaced);
+			seq = ntoh16(packet.seq);
+			if(packet.historyLen == 0)
+			{
+				// Location response, the round has started earlier and what happened in it is unknown.
+				// Rounds missed before it are replayed from the history of the next broadcast.
+				rounds = cloc_seq_valid ? (uint16_t)(seq - cloc_seq) : 1;
+				if(cloc_seq_valid && (rounds == 0 || rounds > 0x8000U))continue; // Not newer than what we know
+				info1("Crane loc %u %u %u seq %u", packet.x_coordinate, packet.y_coordinate, packet.cargoPlaced, seq);
+			}
+			else
+			{
+				rounds = crane_seq_valid ? (uint16_t)(seq - crane_seq) : 1; // Rounds since last broadcast
+				if(crane_seq_valid && (rounds == 0 || rounds > 0x8000U))continue; // Not newer than what we know
+				info1("Crane mov %u %u %u seq %u", packet.x_coordinate, packet.y_coordinate, packet.cargoPlaced, seq);
+				if(rounds > 1)info1("Crane rounds missed %u", rounds - 1);
+			}
 
+			beginGameUpdate(); // Tactics see the cargo replayed and the new crane state together
+			if(packet.historyLen != 0)replayRounds(&packet, rounds);
 			while(osMutexAcquire(cloc_mutex, 1000) != osOK);
-			cloc.crane_x = packet.x_coordinate;
-			cloc.crane_y = packet.y_coordinate;
-			cloc.cargo_here = packet.cargoPlaced;
+			rounds = (uint16_t)(seq - cloc_seq);
+			if(!cloc_seq_valid || (rounds != 0 && rounds <= 0x8000U)) // A broadcast may be older than a response
+			{
+				cloc.crane_x = packet.x_coordinate;
+				cloc.crane_y = packet.y_coordinate;
+				cloc.cargo_here = packet.cargoPlaced;
+				cloc_seq = seq;
+				cloc_seq_valid = true;
+			}
+			if(packet.historyLen != 0)
+			{
+				crane_seq = seq;
+				crane_seq_valid = true;
+				lastCraneEventTime = osKernelGetTickCount();
+			}
+			loc = cloc;
+			seq = cloc_seq;
 			osMutexRelease(cloc_mutex);
-			
-			// If cargo was placed, check if we need to update our knowledge base
-			if(packet.cargoPlaced)
+			setSnapshotCrane(loc, seq);
+			endGameUpdate();
+			if(packet.historyLen != 0)
 			{
-				sloc.x = packet.x_coordinate;
-				sloc.y = packet.y_coordinate;
-				saddr = getShipAddr(sloc);
-				if(saddr != 0 && getCargoStatus(saddr) != 0)markCargo(saddr);
+				timeRound(&packet, lastCraneEventTime);
+				osThreadFlagsSet(main_task_id, CC_ROUND_FLAG); // Re-arm command deadline
 			}
 
 			clearCmdsBuf(); // Clear contents of cmds buffer
@@ -312,6 +520,46 @@ static void locationMsgHandler(void *args)
 	}
 }
 
+// Walks the crane history of 'packet' back over the last 'rounds' rounds and
+// updates our knowledge base with cargo placed during these rounds.
+static void replayRounds(const crane_location_msg_t* packet, uint16_t rounds)
+{
+	loc_bundle_t sloc;
+	am_addr_t saddr;
+	uint8_t i, len;
+
+	len = packet->historyLen < CRANE_HISTORY_LEN ? packet->historyLen : CRANE_HISTORY_LEN;
+	if(rounds > len)
+	{
+		warn1("Crane rounds lost %u", rounds - len);
+		requestCargoStatus(); // Cargo placed in these is not known
+		rounds = len;
+	}
+
+	sloc.x = packet->x_coordinate;
+	sloc.y = packet->y_coordinate;
+	for(i=0;i<rounds;i++)
+	{
+		switch(packet->history[i]) // Undo the round to get the location before it
+		{
+			case CM_UP: sloc.y--;
+			break;
+			case CM_DOWN: sloc.y++;
+			break;
+			case CM_LEFT: sloc.x++;
+			break;
+			case CM_RIGHT: sloc.x--;
+			break;
+			case CM_PLACE_CARGO:
+				saddr = getShipAddr(sloc);
+				if(saddr != 0 && getCargoStatus(saddr) == cs_cargo_not_received)markCargo(saddr);
+			break;
+			default:
+			break;
+		}
+	}
+}
+
 // Listen to and store commands sent by other ships
 static void commandMsgHandler(void *args)
 {
@@ -323,7 +571,7 @@ static void commandMsgHandler(void *args)
 		osMessageQueueGet(cmsg_qID, &packet, NULL, osWaitForever);
 		if(packet.messageID == CRANE_COMMAND_MSG)
 		{
-			info1("Cmnd %lu", ntoh16(packet.senderAddr));
+			info1("Cmnd %u", ntoh16(packet.senderAddr));
 			while(osMutexAcquire(cmdb_mutex, 1000) != osOK);
 			for(i=0;i<MAX_SHIPS;i++)
 			{
@@ -354,17 +602,29 @@ static void commandMsgHandler(void *args)
 
 static void radioSendDone(comms_layer_t * comms, comms_msg_t * msg, comms_error_t result, void * user)
 {
+	uint32_t now = osKernelGetTickCount();
+
+	while(osMutexAcquire(tmg_mutex, 1000) != osOK);
+	if(result == COMMS_SUCCESS)
+	{
+		tx_done = true;
+		tx_done_time = now;
+	}
+	else tx_pending = false; // Not sent, nothing to time
+	osMutexRelease(tmg_mutex);
     logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "Cmnd sent %u", result);
     osThreadFlagsSet(snd_task_id, 0x00000001U);
 }
 
 static void sendCommandMsg(void *args)
 {
+	cmd_out_t out;
 	crane_command_msg_t packet;
 
 	for(;;)
 	{
-		osMessageQueueGet(smsg_qID, &packet, NULL, osWaitForever);
+		osMessageQueueGet(smsg_qID, &out, NULL, osWaitForever);
+		packet = out.packet;
 		
 		osThreadFlagsWait(0x00000001U, osFlagsWaitAny, osWaitForever); // Flags are automatically cleared
 
@@ -381,10 +641,18 @@ static void sendCommandMsg(void *args)
 			
 		// Send data packet
 	    comms_set_packet_type(cradio, &m_msg, AMID_CRANECOMMUNICATION);
-	    comms_am_set_destination(cradio, &m_msg, crane_address);
+	    comms_am_set_destination(cradio, &m_msg, AM_BROADCAST_ADDR); // Overheard by other ships, see countVotes
 	    comms_set_payload_length(cradio, &m_msg, sizeof(crane_command_msg_t));
 
+		// Time this one against the round broadcast, an earlier command of the round is overtaken by it
+		while(osMutexAcquire(tmg_mutex, 1000) != osOK);
+		tx_cmd = out;
+		tx_pending = true;
+		tx_done = false;
+		osMutexRelease(tmg_mutex);
+
 	    comms_error_t result = comms_send(cradio, &m_msg, radioSendDone, NULL);
+	    if(result != COMMS_SUCCESS)radioSendDone(cradio, &m_msg, result, NULL); // No send done event will follow
 	    logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "snd %u", result);
 	}
 }
@@ -451,10 +719,61 @@ bool getAlwaysPlaceCargo()
 	return val;
 }
 
+// Sets whether the vote of this ship is chosen with vote prediction, see predictWinningCmd.
+// If 'true', the ship may vote for another command than the one that leads straight to the 
+// target, if that command is expected to bring the crane closer to the target. 
+// Used with tactic 'cc_to_address', 'cc_to_location' and 'cc_tour'.
+
+void setVotePrediction(bool val)
+{
+	static bool v;
+	v = val;
+	while(osMutexAcquire(cctt_mutex, 1000) != osOK);
+	votePrediction = val;
+	osMutexRelease(cctt_mutex);
+	info1("Vote prediction %u", (uint8_t) v);
+}
+
+// Returns whether the vote of this ship is chosen with vote prediction.
+// Used with tactic 'cc_to_address', 'cc_to_location' and 'cc_tour'.
+
+bool getVotePrediction()
+{
+	bool val;
+
+	while(osMutexAcquire(cctt_mutex, 1000) != osOK);
+	val = votePrediction;
+	osMutexRelease(cctt_mutex);
+	
+	return val;
+}
+
+// Predicts the command the crane picks at the end of this round from the votes of other ships 
+// heard this round and the vote 'my_cmd' of this ship (CM_NOTHING_TO_DO for no vote). The crane 
+// picks the command with most votes and breaks ties at random. Sets 'percent' to the probability 
+// of each command CM_NO_COMMAND..CM_PLACE_CARGO, CM_NO_COMMAND meaning no votes at all.
+// Returns the command with highest probability, the lowest one if tied.
+
+crane_command_t predictWinningCmd(crane_command_t my_cmd, uint8_t percent[CM_CURRENT_LOCATION])
+{
+	uint8_t votes[CM_CURRENT_LOCATION], chance[CM_CURRENT_LOCATION], i;
+	crane_command_t best = CM_NO_COMMAND;
+
+	countVotes(votes);
+	if(my_cmd > CM_NO_COMMAND && my_cmd < CM_CURRENT_LOCATION)votes[my_cmd]++;
+	winChances(votes, chance);
+	for(i=0;i<CM_CURRENT_LOCATION;i++)
+	{
+		percent[i] = (uint8_t)(chance[i] * 100 / CC_VOTE_ONE);
+		if(chance[i] > chance[best])best = i;
+	}
+	return best;
+}
+
 // Sets tactical choice for crane command selection.
 // Possible choices are defined in crane_control.h
-// Currently these are 'cc_do_nothing', 'cc_to_address', 'cc_to_location', 'cc_parrot_ship'
-// and 'cc_popular_command'.
+// Currently these are 'cc_do_nothing', 'cc_to_address', 'cc_to_location', 'cc_parrot_ship',
+// 'cc_popular_command' and 'cc_tour'. 'cc_tour' does not use 'ship_addr' and 'loc'.
 
 void setCraneTactics(cmd_sel_tactic_t tt, am_addr_t ship_addr, loc_bundle_t loc)
 {
@@ -468,6 +787,53 @@ void setCraneTactics(cmd_sel_tactic_t tt, am_addr_t ship_addr, loc_bundle_t loc)
 	info1("Crane tactics %u", tact);
 }
 
+// Sets how long before the crane round closes the crane command is sent, in ms.
+// A longer guard leaves more time for the radio, a shorter one lets the command 
+// take in more of the round, e.g. commands of other ships.
+
+void setCommandGuard(uint32_t ms)
+{
+	while(osMutexAcquire(tmg_mutex, 1000) != osOK);
+	command_guard = ms;
+	send_stats.guard = adaptGuard();
+	osMutexRelease(tmg_mutex);
+	info1("Command guard %u", (unsigned int)ms);
+}
+
+// Returns how long before the crane round closes the crane command is sent, in ms.
+// This is the adapted guard, unless adaptation is turned off.
+
+uint32_t getCommandGuard()
+{
+	uint32_t ms;
+
+	while(osMutexAcquire(tmg_mutex, 1000) != osOK);
+	ms = send_stats.guard;
+	osMutexRelease(tmg_mutex);
+	return ms;
+}
+
+// Sets whether the command guard adapts to measured delays and missed rounds. 
+// If 'false', the guard set with setCommandGuard is used.
+
+void setAdaptiveGuard(bool val)
+{
+	while(osMutexAcquire(tmg_mutex, 1000) != osOK);
+	adaptive_guard = val;
+	send_stats.guard = adaptGuard();
+	osMutexRelease(tmg_mutex);
+	info1("Adaptive guard %u", (uint8_t) val);
+}
+
+// Copies command send statistics to 'stats'.
+
+void getSendStats(cc_send_stats_t* stats)
+{
+	while(osMutexAcquire(tmg_mutex, 1000) != osOK);
+	*stats = send_stats;
+	osMutexRelease(tmg_mutex);
+}
+
 // Returns current tactical choise.
 // Possible return values are defined in crane_control.h
 // Currently these are 'cc_do_nothing', 'cc_to_address', 'cc_to_location', 'cc_parrot_ship'
@@ -491,18 +857,32 @@ cmd_sel_tactic_t getCraneTactics(am_addr_t *ship_addr, loc_bundle_t *loc)
 	return tt;
 }
 
-// Selects an appropriate command to get the crane to location (x; y)
+// Selects an appropriate command to get the crane of game snapshot 'snap' to location (x; y)
 // Takes into account 'Xfirst' and 'alwaysPlaceCargo' choices.
 // This function can return CM_NOTHING_TO_DO in some cases
-static crane_command_t goToDestination(uint8_t x, uint8_t y)
+static crane_command_t goToDestination(const game_snapshot_t* snap, uint8_t x, uint8_t y)
 {
-	crane_command_t cmd;
-	while(osMutexAcquire(cloc_mutex, 1000) != osOK);
-	if(x != 0 && y != 0)cmd = selectCommand(x, y);
-	osMutexRelease(cloc_mutex);
+	crane_command_t cmd = CM_NOTHING_TO_DO;
+	if(x != 0 && y != 0)cmd = selectCommand(snap, x, y);
 	return cmd;
 }
 
+// Returns ship with address 'addr' in game snapshot 'snap', NULL if no such ship.
+static const snapshot_ship_t* shipByAddr(const game_snapshot_t* snap, am_addr_t addr)
+{
+	uint8_t i;
+	for(i=0;i<snap->len;i++)if(snap->ships[i].addr == addr)return &snap->ships[i];
+	return NULL;
+}
+
+// Returns ship at location 'loc' in game snapshot 'snap', NULL if no such ship.
+static const snapshot_ship_t* shipAtLoc(const game_snapshot_t* snap, loc_bundle_t loc)
+{
+	uint8_t i;
+	for(i=0;i<snap->len;i++)if(snap->ships[i].loc.x == loc.x && snap->ships[i].loc.y == loc.y)return &snap->ships[i];
+	return NULL;
+}
+
 // Returns command sent by ship with sID.
 // If no such ship or no command, returns CM_NOTHING_TO_DO.
 // This tactic can work only if other ships send their 
@@ -587,13 +967,10 @@ static crane_command_t selectPopular()
 	return cmd[0];
 }
 
-static crane_command_t selectCommand(uint8_t x, uint8_t y)
+static crane_command_t selectCommand(const game_snapshot_t* snap, uint8_t x, uint8_t y)
 {
-	uint8_t len = 0, i;
-	cargo_status_t stat;
+	uint8_t i;
 	bool x_first, placeCargo;
-	am_addr_t ships[MAX_SHIPS];
-	loc_bundle_t sloc;
 
 	while(osMutexAcquire(cctt_mutex, 1000) != osOK);
 	x_first = Xfirst;
@@ -601,23 +978,19 @@ static crane_command_t selectCommand(uint8_t x, uint8_t y)
 	osMutexRelease(cctt_mutex);
 
 	// First check if cargo was placed in the last round, if not, maybe we need to.
-	if(!cloc.cargo_here)
+	if(!snap->crane.cargo_here)
 	{
 		// There is no cargo in this place, is there a ship here and do we need to place cargo?
 		if(placeCargo)
 		{
-			len = getAllShipsAddr(ships, MAX_SHIPS);
-
-			if(len > 0 && len <= MAX_SHIPS)
+			if(snap->len > 0)
 			{
-				for(i=0;i<len;i++)
+				for(i=0;i<snap->len;i++)
 				{
-					sloc = getShipLocation(ships[i]);
 					// If there is a ship here, then only reasonable command is place cargo.
-					if(distToCrane(sloc) == 0)
+					if(snap->ships[i].loc.x == snap->crane.crane_x && snap->ships[i].loc.y == snap->crane.crane_y)
 					{
-						stat = getCargoStatus(ships[i]);
-						if(stat != cs_cargo_received)return CM_PLACE_CARGO; // Ship here, no cargo.
+						if(!snap->ships[i].cargo)return CM_PLACE_CARGO; // Ship here, no cargo.
 						else break; // Ship here, has cargo.
 					}
 				}
@@ -632,44 +1005,375 @@ static crane_command_t selectCommand(uint8_t x, uint8_t y)
 	}
 	else ; // Cargo was placed by the crane in the last round, so no need to place it again this round.
 
-	if(x_first)return selectCommandXFirst(x, y);
-	else return selectCommandYFirst(x, y);
+	if(x_first)return selectCommandXFirst(&snap->crane, x, y);
+	else return selectCommandYFirst(&snap->crane, x, y);
 }
 
-static crane_command_t selectCommandYFirst(uint8_t x, uint8_t y)
+static crane_command_t selectCommandYFirst(const crane_location_t* crane, uint8_t x, uint8_t y)
 {
-	if(y > cloc.crane_y)return CM_UP;
-	else if(y < cloc.crane_y)return CM_DOWN;
+	if(y > crane->crane_y)return CM_UP;
+	else if(y < crane->crane_y)return CM_DOWN;
 	else ;
 
-	if(x > cloc.crane_x)return CM_RIGHT;
-	else if(x < cloc.crane_x)return CM_LEFT;
+	if(x > crane->crane_x)return CM_RIGHT;
+	else if(x < crane->crane_x)return CM_LEFT;
 	else ;
 
 	// If we get here, then the crane is at the desired location (x; y).
 	// Check if there is cargo here and issue place cargo, if there isn't, else return with 'do nothing'.
 	// This ensures that we only place cargo to a ship only once.
-	if(cloc.cargo_here)return CM_NOTHING_TO_DO;
+	if(crane->cargo_here)return CM_NOTHING_TO_DO;
 	else return CM_PLACE_CARGO;
 }
 
-static crane_command_t selectCommandXFirst(uint8_t x, uint8_t y)
+static crane_command_t selectCommandXFirst(const crane_location_t* crane, uint8_t x, uint8_t y)
 {
-	if(x > cloc.crane_x)return CM_RIGHT;
-	else if(x < cloc.crane_x)return CM_LEFT;
+	if(x > crane->crane_x)return CM_RIGHT;
+	else if(x < crane->crane_x)return CM_LEFT;
 	else ;
 
-	if(y > cloc.crane_y)return CM_UP;
-	else if(y < cloc.crane_y)return CM_DOWN;
+	if(y > crane->crane_y)return CM_UP;
+	else if(y < crane->crane_y)return CM_DOWN;
 	else ;
 
 	// If we get here, then the crane is at the desired location (x; y).
 	// Check if there is cargo here and issue place cargo, if there isn't, else return with 'do nothing'.
 	// This ensures that we only place cargo to a ship only once.
-	if(cloc.cargo_here)return CM_NOTHING_TO_DO;
+	if(crane->cargo_here)return CM_NOTHING_TO_DO;
 	else return CM_PLACE_CARGO;
 }
 
+/**********************************************************************************************
+ *	Tour planning
+ **********************************************************************************************/
+
+// Brings the tour up to date with ships in the game and improves it, see module description.
+static void planTour()
+{
+	game_snapshot_t snap;
+	tour_stop_t stop, best[MAX_SHIPS], trial[MAX_SHIPS];
+	loc_bundle_t from;
+	uint32_t cost, best_cost, round, arrive, now, freq = osKernelGetTickFreq();
+	uint16_t budget, moves;
+	uint8_t i, k, n, pos, served;
+	bool changed = false, skip[MAX_SHIPS]; // Ship is on the tour or needs no visit
+
+	getGameSnapshot(&snap);
+	now = osKernelGetTickCount();
+	from.x = snap.crane.crane_x;
+	from.y = snap.crane.crane_y;
+
+	// Ships that need cargo and can still get it
+	for(k=0;k<snap.len;k++)
+	{
+		skip[k] = false;
+		if(snap.ships[k].cargo || snap.ships[k].loc.x == 0 || (int32_t)(snap.ships[k].deadline_time - now) <= 0)skip[k] = true;
+	}
+
+	// Update ships on the tour, drop those that got cargo, left or can no longer be served
+	for(i=0,n=0;i<tour_len;i++)
+	{
+		for(k=0;k<snap.len;k++)if(snap.ships[k].addr == tour[i].addr)break;
+		if(k < snap.len && !skip[k])
+		{
+			skip[k] = true;
+			tour[n] = tour[i];
+			tour[n].loc = snap.ships[k].loc;
+			tour[n++].due = (snap.ships[k].deadline_time - now) / freq / CRANE_UPDATE_INTERVAL;
+		}
+		else changed = true;
+	}
+	tour_len = n;
+
+	// Insert new ships where they cost least
+	for(k=0;k<snap.len;k++)
+	{
+		if(skip[k])continue;
+
+		stop.addr = snap.ships[k].addr;
+		stop.loc = snap.ships[k].loc;
+		stop.due = (snap.ships[k].deadline_time - now) / freq / CRANE_UPDATE_INTERVAL;
+
+		best_cost = UINT32_MAX;
+		for(pos=0;pos<=tour_len;pos++)
+		{
+			for(i=0,n=0;i<=tour_len;i++)trial[i] = i == pos ? stop : tour[n++];
+			cost = tourCost(trial, tour_len + 1, from, &served);
+			if(cost < best_cost)
+			{
+				best_cost = cost;
+				for(i=0;i<=tour_len;i++)best[i] = trial[i];
+			}
+		}
+		tour_len++;
+		for(i=0;i<tour_len;i++)tour[i] = best[i];
+		changed = true;
+	}
+
+	// Improve it, continuing the search of the last round
+	cost = tourCost(tour, tour_len, from, &served);
+	if(changed)tour_tried = 0;
+	moves = 2 * tour_len * tour_len; // Moves a tour of this length has
+	for(budget=0;budget<CC_TOUR_BUDGET && tour_tried < moves;budget++)
+	{
+		if(tour_move >= moves)tour_move = 0;
+		if(tryTourMove(tour_move++, from, &cost))tour_tried = 0;
+		else tour_tried++;
+	}
+
+	// Ships whose deadline is not met go last, cost does not change
+	for(i=0,n=0,k=0,round=0;i<tour_len;i++)
+	{
+		stop = tour[i];
+		arrive = round + abs(stop.loc.x - from.x) + abs(stop.loc.y - from.y) + 1;
+		if(arrive <= stop.due)
+		{
+			round = arrive;
+			from = stop.loc;
+			tour[n++] = stop;
+		}
+		else trial[k++] = stop;
+	}
+	served = n;
+	for(i=0;i<k;i++)tour[n++] = trial[i];
+
+	if(changed || served != tour_served)
+	{
+		info1("Tour %u/%u ships, next %04X", served, tour_len, tour_len > 0 ? tour[0].addr : 0);
+	}
+	tour_served = served;
+}
+
+// Returns cost of visiting 'stops' in order starting from 'from', lower is better. 
+// Stops whose deadline cannot be met are skipped, 'served' is set to the number of the others.
+static uint32_t tourCost(const tour_stop_t stops[], uint8_t len, loc_bundle_t from, uint8_t* served)
+{
+	uint32_t round = 0, arrive, sum = 0;
+	uint8_t i;
+
+	*served = 0;
+	for(i=0;i<len;i++)
+	{
+		arrive = round + abs(stops[i].loc.x - from.x) + abs(stops[i].loc.y - from.y) + 1; // Moves and placing cargo
+		if(arrive > stops[i].due)continue;
+		round = arrive;
+		sum += arrive;
+		from = stops[i].loc;
+		(*served)++;
+	}
+	if(sum > 0xFFFF)sum = 0xFFFF;
+	return ((uint32_t)(len - *served) << 16) | sum;
+}
+
+// Tries tour move 'move': moves of 0..len*len-1 move one ship to another place, the rest reverse
+// a part of the tour. Applies the move and updates 'cost', if the move lowers the cost of the tour.
+// Returns true if the move was applied.
+static bool tryTourMove(uint16_t move, loc_bundle_t from, uint32_t* cost)
+{
+	tour_stop_t trial[MAX_SHIPS], stop;
+	uint8_t i, j, k, served;
+	uint32_t c;
+
+	i = (move % (tour_len * tour_len)) / tour_len;
+	j = move % tour_len;
+	if(i == j)return false;
+
+	for(k=0;k<tour_len;k++)trial[k] = tour[k];
+	if(move < tour_len * tour_len) // Move ship i to place j
+	{
+		stop = trial[i];
+		if(i < j)for(k=i;k<j;k++)trial[k] = trial[k + 1];
+		else for(k=i;k>j;k--)trial[k] = trial[k - 1];
+		trial[j] = stop;
+	}
+	else // Reverse ships i..j
+	{
+		if(i > j)return false;
+		for(k=0;k<=j-i;k++)trial[i + k] = tour[j - k];
+	}
+
+	c = tourCost(trial, tour_len, from, &served);
+	if(c >= *cost)return false;
+	for(k=0;k<tour_len;k++)tour[k] = trial[k];
+	*cost = c;
+	return true;
+}
+
+// Sets 'loc' to the location of the first ship of the tour that still needs cargo.
+// If the tour meets no deadline any more, this is the first ship anyway, deadlines are
+// only known to a second. Returns false if no ship needs cargo.
+static bool tourTarget(const game_snapshot_t* snap, loc_bundle_t* loc)
+{
+	const snapshot_ship_t* ship;
+	uint8_t i;
+
+	for(i=0;i<tour_len;i++)
+	{
+		ship = shipByAddr(snap, tour[i].addr);
+		if(ship != NULL && !ship->cargo)
+		{
+			*loc = tour[i].loc;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**********************************************************************************************
+ *	Vote prediction
+ **********************************************************************************************/
+
+// Returns the vote that is expected to bring the crane closest to 'target', 'cmd' if no other is
+// better. For each vote the crane's pick is predicted from the votes of other ships, see 
+// predictWinningCmd, and weighed by the progress of each command, see cmdProgress. E.g. if
+// the command that leads straight to the target would lose anyway, joining a command that ties 
+// with a command leading away from the target turns a sure loss into an even chance.
+static crane_command_t voteCommand(const game_snapshot_t* snap, crane_command_t cmd, loc_bundle_t target)
+{
+	uint8_t votes[CM_CURRENT_LOCATION], trial[CM_CURRENT_LOCATION], chance[CM_CURRENT_LOCATION];
+	int8_t progress[CM_CURRENT_LOCATION];
+	int16_t value, best_value = INT16_MIN;
+	crane_command_t c, w, best = cmd;
+
+	countVotes(votes);
+	for(w=CM_NO_COMMAND;w<CM_CURRENT_LOCATION;w++)progress[w] = cmdProgress(w, target, &snap->crane);
+	if(progress[cmd] < 1)progress[cmd] = 1; // E.g. placing cargo on the way, the tactic wants it
+
+	for(c=CM_UP;c<CM_CURRENT_LOCATION;c++)
+	{
+		for(w=0;w<CM_CURRENT_LOCATION;w++)trial[w] = votes[w];
+		trial[c]++;
+		winChances(trial, chance);
+		for(value=0,w=0;w<CM_CURRENT_LOCATION;w++)value += chance[w] * progress[w];
+		if(value > best_value || (value == best_value && c == cmd))
+		{
+			best_value = value;
+			best = c;
+		}
+	}
+	if(best != cmd)info1("Cmnd vote %u for %u", best, cmd);
+	return best;
+}
+
+// Returns how many rounds the crane command 'cmd' brings the crane closer to placing cargo 
+// at 'target' from 'crane': 1 for a move closer or placing cargo there, -1 for a move away and 0 otherwise.
+static int8_t cmdProgress(crane_command_t cmd, loc_bundle_t target, const crane_location_t* crane)
+{
+	switch(cmd)
+	{
+		case CM_UP : return target.y > crane->crane_y ? 1 : -1;
+		case CM_DOWN : return target.y < crane->crane_y ? 1 : -1;
+		case CM_RIGHT : return target.x > crane->crane_x ? 1 : -1;
+		case CM_LEFT : return target.x < crane->crane_x ? 1 : -1;
+		case CM_PLACE_CARGO : return target.x == crane->crane_x && target.y == crane->crane_y && !crane->cargo_here ? 1 : 0;
+		default : return 0;
+	}
+}
+
+// Counts votes of other ships heard this round, per command CM_NO_COMMAND..CM_PLACE_CARGO.
+static void countVotes(uint8_t votes[CM_CURRENT_LOCATION])
+{
+	uint8_t i;
+
+	for(i=0;i<CM_CURRENT_LOCATION;i++)votes[i] = 0;
+	while(osMutexAcquire(cmdb_mutex, 1000) != osOK);
+	for(i=0;i<MAX_SHIPS;i++)
+	{
+		if(cmds[i].ship_addr != 0 && cmds[i].ship_cmd > CM_NO_COMMAND && cmds[i].ship_cmd < CM_CURRENT_LOCATION)votes[cmds[i].ship_cmd]++;
+	}
+	osMutexRelease(cmdb_mutex);
+}
+
+// Sets 'chance' to the probability, in CC_VOTE_ONE parts, of each command winning with 'votes', 
+// as getWinningCmd of the crane picks it. With no votes CM_NO_COMMAND wins.
+static void winChances(const uint8_t votes[CM_CURRENT_LOCATION], uint8_t chance[CM_CURRENT_LOCATION])
+{
+	uint8_t i, max = 0, mcount = 0;
+
+	for(i=CM_UP;i<CM_CURRENT_LOCATION;i++)if(votes[i] > max)max = votes[i];
+	for(i=CM_UP;i<CM_CURRENT_LOCATION;i++)if(votes[i] == max)mcount++;
+	for(i=0;i<CM_CURRENT_LOCATION;i++)chance[i] = 0;
+	if(max == 0)chance[CM_NO_COMMAND] = CC_VOTE_ONE;
+	else for(i=CM_UP;i<CM_CURRENT_LOCATION;i++)if(votes[i] == max)chance[i] = CC_VOTE_ONE / mcount;
+}
+
+/**********************************************************************************************
+ *	Send timing
+ **********************************************************************************************/
+
+// Times the command sent for the round that the broadcast 'packet', received at 'now', closes, 
+// and the broadcast period. Adapts the command guard.
+static void timeRound(const crane_location_msg_t* packet, uint32_t now)
+{
+	const uint32_t freq = osKernelGetTickFreq(), period = CRANE_UPDATE_INTERVAL * freq;
+	uint16_t seq = ntoh16(packet->seq);
+	uint32_t margin, dev;
+	uint8_t bin;
+
+	while(osMutexAcquire(tmg_mutex, 1000) != osOK);
+	// Deviation of the broadcast period, only over consecutive rounds
+	if(last_round_valid && (uint16_t)(seq - last_round_seq) == 1)
+	{
+		dev = now - last_round_time > period ? now - last_round_time - period : period - (now - last_round_time);
+		smooth(&jit_avg, &jit_var, dev * 1000 / freq);
+	}
+	last_round_time = now;
+	last_round_seq = seq;
+	last_round_valid = true;
+
+	if(tx_pending && (uint16_t)(seq - tx_cmd.round) == 1) // Command was meant for this round
+	{
+		tx_pending = false;
+		send_stats.sends++;
+		if(tx_done && (int32_t)(now - tx_done_time) >= 0)
+		{
+			smooth(&send_avg, &send_var, (tx_done_time - tx_cmd.chosen) * 1000 / freq);
+			margin = (now - tx_done_time) * 1000 / freq;
+			bin = margin < 10 ? 1 : margin < 25 ? 2 : margin < 50 ? 3 : margin < 100 ? 4 : margin < 250 ? 5 : 6;
+			send_stats.margin_hist[bin]++;
+			if(packet->history[0] == tx_cmd.packet.cmd)send_stats.confirmed++;
+			backoff -= backoff / 8;
+		}
+		else
+		{
+			send_stats.margin_hist[0]++;
+			send_stats.misses++;
+			backoff = 2 * backoff + CC_GUARD_BACKOFF;
+			if(backoff > period * 1000 / freq)backoff = period * 1000 / freq;
+			warn1("Cmnd late, round %u", seq);
+		}
+	}
+	else if(tx_pending && (int16_t)(seq - tx_cmd.round) > 1)tx_pending = false; // Broadcast of its round was missed
+
+	send_stats.send_delay = send_avg / 8;
+	send_stats.jitter = jit_avg / 8;
+	send_stats.guard = adaptGuard();
+	if(seq % CC_STATS_ROUNDS == 0)info1("Cmnd guard %u ms, sent %u late %u confirmed %u", (unsigned int)send_stats.guard, 
+		(unsigned int)send_stats.sends, (unsigned int)send_stats.misses, (unsigned int)send_stats.confirmed);
+	osMutexRelease(tmg_mutex);
+}
+
+// Updates smoothed 'avg' and variation 'var' (both ms * 8) with 'sample' (ms).
+static void smooth(uint32_t* avg, uint32_t* var, uint32_t sample)
+{
+	int32_t err = (int32_t)(sample * 8) - (int32_t)*avg;
+
+	*avg += err / 8;
+	*var += ((err < 0 ? -err : err) - (int32_t)*var) / 4;
+}
+
+// Returns command guard to use, ms. Must be called with tmg_mutex held.
+static uint32_t adaptGuard()
+{
+	uint32_t guard, half = CRANE_UPDATE_INTERVAL * 1000 / 2;
+
+	if(!adaptive_guard || send_stats.sends < CC_GUARD_WARMUP)return command_guard;
+	guard = (send_avg + send_var * 4 + jit_avg + jit_var * 4) / 8 + CC_GUARD_MARGIN + backoff;
+	if(guard < CC_GUARD_MIN)guard = CC_GUARD_MIN;
+	if(guard > half)guard = half; // Commands are never chosen before seeing half of the round
+	return guard;
+}
+
 /**********************************************************************************************
  *	Utility functions
  **********************************************************************************************/
@@ -17,9 +17,23 @@ typedef enum {
 	cc_to_address,		// Call crane to specified ship and place cargo.
 	cc_to_location,		// Call crane to specified location and place cargo.
 	cc_parrot_ship,		// Send same command message as specified ship.
-	cc_popular_command	// Send the command that is currently most popular.
+	cc_popular_command,	// Send the command that is currently most popular.
+	cc_tour				// Call crane along a tour of all ships without cargo that meets most loading deadlines.
 } cmd_sel_tactic_t;
 
+// Crane command send statistics, see getSendStats
+#define CC_MARGIN_BINS 7
+typedef struct {
+	uint32_t sends;		// Commands timed against the broadcast of their round
+	uint32_t misses;	// Commands not sent before the broadcast, i.e. late for their round
+	uint32_t confirmed;	// Commands the crane did in their round
+	uint32_t guard;		// Current command guard, ms
+	uint32_t send_delay;// Smoothed delay from choosing a command until it has been sent, ms
+	uint32_t jitter;	// Smoothed deviation of the round broadcast period, ms
+	uint32_t margin_hist[CC_MARGIN_BINS]; // Time from command sent to round broadcast: late, 
+						// <10, <25, <50, <100, <250, >=250 ms
+} cc_send_stats_t;
+
 /**********************************************************************************************
  *	Initialise module
  **********************************************************************************************/
@@ -37,7 +51,7 @@ void craneReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* use
  **********************************************************************************************/
 
 // Sets whether crane is commanded to move along x coordinate first or along y coordinate first.
-// Used with tactic 'cc_to_address' and 'cc_to_location'.
+// Used with tactic 'cc_to_address', 'cc_to_location' and 'cc_tour'.
 void setXFirst(bool val);
 
 // Returns whether crane is commanded to move along x coordinate first or along y coordinate first.
@@ -56,16 +70,52 @@ void setAlwaysPlaceCargo(bool val);
 // Used with tactic 'cc_to_address' and 'cc_to_location'.
 bool getAlwaysPlaceCargo();
 
+// Sets whether the vote of this ship is chosen with vote prediction, see predictWinningCmd.
+// If 'true', the ship may vote for another command than the one that leads straight to the 
+// target, if that command is expected to bring the crane closer to the target. The straight 
+// vote is announced in the middle of the round, so the ship sends two commands a round. 
+// Default 'false'.
+// Used with tactic 'cc_to_address', 'cc_to_location' and 'cc_tour'.
+void setVotePrediction(bool val);
+
+// Returns whether the vote of this ship is chosen with vote prediction.
+// Used with tactic 'cc_to_address', 'cc_to_location' and 'cc_tour'.
+bool getVotePrediction();
+
+// Predicts the command the crane picks at the end of this round from the votes of other ships 
+// heard this round and the vote 'my_cmd' of this ship (CM_NOTHING_TO_DO for no vote). The crane 
+// picks the command with most votes and breaks ties at random. Sets 'percent' to the probability 
+// of each command CM_NO_COMMAND..CM_PLACE_CARGO, CM_NO_COMMAND meaning no votes at all.
+// Returns the command with highest probability, the lowest one if tied.
+// Only votes that other ships broadcast can be heard, see crane_control.c.
+crane_command_t predictWinningCmd(crane_command_t my_cmd, uint8_t percent[CM_CURRENT_LOCATION]);
+
 // Sets tactical choice for crane command selection.
 // Possible choices are defined in crane_control.h
-// Currently these are 'cc_do_nothing', 'cc_to_address', 'cc_to_location', 'cc_parrot_ship'
-// and 'cc_popular_command'.
+// Currently these are 'cc_do_nothing', 'cc_to_address', 'cc_to_location', 'cc_parrot_ship',
+// 'cc_popular_command' and 'cc_tour'. 'cc_tour' does not use 'ship_addr' and 'loc'.
 void setCraneTactics(cmd_sel_tactic_t tt, am_addr_t ship_addr, loc_bundle_t loc);
 
+// Sets how long before the crane round closes the crane command is sent, in ms.
+// Takes effect from the next crane round broadcast. Default 250 ms. With adaptive
+// guard this is used until enough commands have been timed.
+void setCommandGuard(uint32_t ms);
+
+// Returns how long before the crane round closes the crane command is sent, in ms.
+// This is the adapted guard, unless adaptation is turned off.
+uint32_t getCommandGuard();
+
+// Sets whether the command guard adapts to measured delays and missed rounds, default 'true'.
+// If 'false', the guard set with setCommandGuard is used.
+void setAdaptiveGuard(bool val);
+
+// Copies command send statistics to 'stats'.
+void getSendStats(cc_send_stats_t* stats);
+
 // Returns current tactical choise.
 // Possible return values are defined in crane_control.h
-// Currently these are 'cc_do_nothing', 'cc_to_address', 'cc_to_location', 'cc_parrot_ship'
-// and 'cc_popular_command'.
+// Currently these are 'cc_do_nothing', 'cc_to_address', 'cc_to_location', 'cc_parrot_ship',
+// 'cc_popular_command' and 'cc_tour'.
 cmd_sel_tactic_t getCraneTactics(am_addr_t *ship_addr, loc_bundle_t *loc);
 
 /**********************************************************************************************
@@ -23,8 +23,53 @@
  * MAX_SHIPS (see game_types.h) number of ships. 
  * 
  * Note:
- * 		There is currently no mechanism for a ship to publicly announce leaving the 
- * 		game or becoming inactive. 
+ * 		When several ships ask for the list of all ships at about the same time,
+ * 		crane-agent answers them all with one broadcast AS_QRMSG. Broadcast lists
+ * 		carry a version and a list is processed only if its version differs from
+ * 		the last one processed.
+ * 
+ * Note:
+ * 		The list of ships is kept up to date with paged roster queries 
+ * 		(AS_PAGE_QMSG), every GS_UPDATE_INTERVAL and after joining the game.
+ * 		A query pass asks only for the pages that changed since the roster
+ * 		version of the last complete pass and follows the cursor of each
+ * 		response until there are no more changed pages. Only ships not yet
+ * 		known are queried for their data.
+ * 
+ * Note:
+ * 		Cargo status of all ships is refreshed every GS_UPDATE_INTERVAL with a
+ * 		cargo map query. The cargo map (CARGO_MAP_QRMSG) refers to ships by the
+ * 		registration slot given in WELCOME_RMSG and SHIP_QRMSG and is decoded
+ * 		straight into the ship table. Slots are given out again after 
+ * 		departures, so a ship's slot is used only if it is known to be right
+ * 		at the roster version of the map: the version it was given at, or of
+ * 		a roster page or pass that confirmed it. Roster pages also drop ships
+ * 		not in their slot any more, whose DEPART_RMSG was missed. If some slots
+ * 		are not known to be right, the changed roster pages are asked for, and
+ * 		if the map lists more ships than are known, all roster pages.
+ * 
+ * Note:
+ * 		A ship leaves the game with leaveGame(), otherwise it leaves when its 
+ * 		loading deadline passes. Crane-agent broadcasts every departure with
+ * 		DEPART_RMSG, the departed ship is dropped from the ship table and its
+ * 		registration slot can be given to a new ship. At the end of the game 
+ * 		all ships depart and the scoreboard (SCOREBOARD_MSG) is logged.
+ * 		When this ship departs, the ship table and game snapshot are emptied.
+ * 		When the scoreboard arrives, they are emptied again, as the departure
+ * 		may have been lost, and the welcome message loop registers the ship
+ * 		again for the next game, so one ship plays each game once.
+ * 
+ * Note:
+ * 		Every update of the ship table or the crane state publishes a snapshot of
+ * 		both (see getGameSnapshot). Changes that belong together, such as the 
+ * 		cargo list of one message or the cargo replayed from a crane broadcast 
+ * 		and the new crane state, are made between beginGameUpdate and
+ * 		endGameUpdate and published at once. Snapshots are double-buffered: 
+ * 		the writer, holding sddb_mutex, fills the buffer not in use and then
+ * 		publishes it.
+ * 		Each buffer has a sequence number that is odd while it is written, a
+ * 		reader copies the published buffer and retries if the sequence number
+ * 		changed meanwhile, so readers take no locks.
  * 
  * Note:
  * 		Cargo status of ships is set to false after initialisation and there is no
@@ -32,10 +77,6 @@
  * 		cargo status of a ship is set to true, there is no going back after this 
  * 		action.
  * 
- * TODO Regular cargo status updates.
- * 
- * TODO Mechanism to leave the game.
- * 
  * TODO CRANE_ADDR and SYSYEM_ADDR are still used to identify crane-agent. This
  * 		however does not solve crane-agent identity theft and impersonation problem
  * 		so in this regard it is redundant. Suggested for removal.
@@ -49,6 +90,8 @@
 #include "cmsis_os2.h"
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "mist_comm_am.h"
 #include "radio.h"
@@ -65,14 +108,18 @@
 
 #define GS_UPDATE_INTERVAL 60 				// Update game state, seconds
 #define GS_WELCOME_MSG_RETRY_INTERVAL 10 	// Retry welcome message, seconds
+#define GS_REJOIN_FLAG 0x00000001U			// Join the game again, see welcomeMsgLoop
 
 typedef struct {
 	bool ship_in_game;
 	am_addr_t ship_addr; 
-	uint16_t ship_deadline;
+	uint16_t ship_deadline;	// Seconds left when the ship was added
+	uint32_t deadline_time;	// Loading deadline, kernel ticks
 	uint8_t x_coordinate;
 	uint8_t y_coordinate;
 	uint8_t is_cargo_loaded;
+	uint16_t slot; // Registration slot, see cargo_map_msg_t
+	uint16_t slot_version; // Roster version 'slot' is known to be right at, 0 if none
 } ship_data_t;
 
 static am_addr_t ship_addr[MAX_SHIPS]; // Protected by asdb_mutex
@@ -81,6 +128,20 @@ static ship_data_t ships[MAX_SHIPS]; // Protected by sddb_mutex
 
 uint32_t global_time_left; // Protected by sddb_mutex
 
+// Game snapshots, written with sddb_mutex held, read without locks, see getGameSnapshot
+typedef struct {
+	uint32_t seq; // Odd while written
+	game_snapshot_t snap;
+} snapshot_buf_t;
+
+static snapshot_buf_t snap_buf[2];
+static uint8_t snap_current = 0; // Published buffer
+static uint32_t snap_version = 0; // Protected by sddb_mutex
+static crane_location_t snap_crane; // Protected by sddb_mutex
+static uint16_t snap_crane_seq = 0; // Protected by sddb_mutex
+static uint8_t snap_batch = 0; // Nesting of open updates, see beginGameUpdate; protected by sddb_mutex
+static bool snap_dirty = false; // Changed in an open update; protected by sddb_mutex
+
 static osMutexId_t sddb_mutex, asdb_mutex;
 static osMessageQueueId_t snd_msg_qID;
 static osThreadId_t wmsg_thread, snd_task_id;
@@ -91,6 +152,10 @@ static comms_layer_t* sradio;
 static am_addr_t my_address;
 static am_addr_t system_address = AM_BROADCAST_ADDR; // Use actual system address if possible
 static bool first_msg = true; // Used to get actual system address once
+static uint16_t as_version = 0; // Version of last processed AS_QRMSG, 0 if none
+static uint16_t map_version = 0; // Version of last processed CARGO_MAP_QRMSG, 0 if none
+static uint16_t roster_version = 0; // Roster version of last complete paged query pass, 0 if none; protected by asdb_mutex
+static uint16_t roster_pass_version = 0; // Roster version of the first page of current pass; protected by asdb_mutex
 
 static void welcomeMsgLoop(void *args);
 static void sendMsgLoop(void *args);
@@ -101,6 +166,14 @@ static uint8_t getEmptySlot();
 static uint8_t getIndex(am_addr_t addr);
 static void addShip(query_response_msg_t* ship);
 static void addShipAddr(am_addr_t addr);
+static void removeShip(am_addr_t addr);
+static bool decodeCargoMap(const cargo_map_msg_t* map, uint8_t len, bool* all);
+static void syncRoster(bool all);
+static void requestRosterPage(uint16_t cursor, uint16_t since);
+static void handleRosterPage(const roster_page_msg_t* page);
+static void publishSnapshot();
+static void snapshotChanged();
+static void clearShips();
 
 
 /**********************************************************************************************
@@ -109,7 +182,6 @@ static void addShipAddr(am_addr_t addr);
 
 void initSystemStatus(comms_layer_t* radio, am_addr_t addr)
 {
-	uint8_t i;
 	const osMutexAttr_t sddb_Mutex_attr = { .attr_bits = osMutexRecursive }; // Allow nesting of this mutex
 
 	sddb_mutex = osMutexNew(&sddb_Mutex_attr);	// Protects ships' crane command database
@@ -117,36 +189,19 @@ void initSystemStatus(comms_layer_t* radio, am_addr_t addr)
 
 	evt_id = osEventFlagsNew(NULL);	// Tells 'getAllShipsData' task to quiery for the next ship
 
-	snd_msg_qID = osMessageQueueNew(MAX_SHIPS + 3, sizeof(query_msg_t), NULL);
+	snd_msg_qID = osMessageQueueNew(MAX_SHIPS + 3, sizeof(query_page_msg_t), NULL); // Shorter queries use the start of it
 	
 	sradio = radio; 	// This is the only write, so not going to protect it with mutex
 	my_address = addr; 	// This is the only write, so not going to protect it with mutex
 
 	// Initialise ships' buffers
-	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
-	for(i=0;i<MAX_SHIPS;i++)
-	{
-		ships[i].ship_in_game = false;
-		ships[i].ship_addr = 0;
-		ships[i].ship_deadline = 0;
-		ships[i].x_coordinate = 0;
-		ships[i].y_coordinate = 0;
-		ships[i].is_cargo_loaded = false;
-	}
-	osMutexRelease(sddb_mutex);
+	clearShips();
 
-	while(osMutexAcquire(asdb_mutex, 1000) != osOK);
-	for(i=0;i<MAX_SHIPS;i++)
-	{
-		ship_addr[i] = 0;
-	}
-	osMutexRelease(asdb_mutex);
-
-	wmsg_thread = osThreadNew(welcomeMsgLoop, NULL, NULL); // Sends welcome message and then stops
+	wmsg_thread = osThreadNew(welcomeMsgLoop, NULL, NULL); // Sends welcome message until registered, again when rejoining
 	snd_task_id = osThreadNew(sendMsgLoop, NULL, NULL); // Sends quiery messages
 	osThreadFlagsSet(snd_task_id, 0x00000001U); // Sets thread to ready-to-send state
 	osThreadNew(getAllShipsData, NULL, NULL);
-	osThreadNew(getAllShipsIngame, NULL, NULL); // Sends AS_QMSG message	
+	osThreadNew(getAllShipsIngame, NULL, NULL); // Sends AS_PAGE_QMSG message	
 }
 
 /**********************************************************************************************
@@ -155,21 +210,18 @@ void initSystemStatus(comms_layer_t* radio, am_addr_t addr)
 
 static void getAllShipsIngame(void *args)
 {
-	query_msg_t packet;
-	
 	for(;;)
 	{
 		osDelay(GS_UPDATE_INTERVAL*osKernelGetTickFreq());
-		packet.messageID = AS_QMSG;
-		packet.senderAddr = my_address;
-		osMessageQueuePut(snd_msg_qID, &packet, 0, osWaitForever);
+		syncRoster(false);
+		requestCargoStatus();
 	}
 }
 
 static void getAllShipsData(void *args)
 {
 	uint8_t i;
-	query_msg_t packet;
+	query_page_msg_t packet;
 
 	for(;;)
 	{
@@ -192,7 +244,7 @@ static void getAllShipsData(void *args)
 
 static void welcomeMsgLoop(void *args)
 {
-	query_msg_t packet;
+	query_page_msg_t packet;
 	for(;;)
 	{
 		while(osMutexAcquire(sddb_mutex, 1000) != osOK);
@@ -207,8 +259,9 @@ static void welcomeMsgLoop(void *args)
 		else 
 		{
 			osMutexRelease(sddb_mutex);
-			// Terminate task, cuz no need for it anymore
-			osThreadTerminate(wmsg_thread);
+			// Registered, wait until this ship departs and is to join again
+			osThreadFlagsWait(GS_REJOIN_FLAG, osFlagsWaitAny, osWaitForever);
+			continue;
 		}
 		
 		osDelay(GS_WELCOME_MSG_RETRY_INTERVAL*osKernelGetTickFreq());
@@ -227,7 +280,12 @@ void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* us
 	uint8_t * rmsg = (uint8_t *) comms_get_payload(comms, msg, pl_len);
 	query_response_msg_t * packet;
 	query_response_buf_t * bpacket;
-	query_msg_t packet2;
+	cargo_map_msg_t * mpacket;
+	roster_page_msg_t * ppacket;
+	bool all;
+	scoreboard_msg_t * spacket;
+	query_page_msg_t packet2;
+	am_addr_t qaddr;
 	
 	switch(rmsg[0])
 	{
@@ -243,7 +301,10 @@ void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* us
 		case GTIME_QMSG :
 		case SHIP_QMSG :
 		case AS_QMSG :
+		case AS_PAGE_QMSG :
 		case ACARGO_QMSG :
+		case CARGO_MAP_QMSG :
+		case LEAVE_QMSG :
 			break;
 
 		case GTIME_QRMSG :
@@ -271,9 +332,7 @@ void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* us
 			if(dest == my_address)
 			{
 				info1("Rcv wlcm my loc %u %u", packet->x_coordinate, packet->y_coordinate);
-				packet2.messageID = AS_QMSG;
-				packet2.senderAddr = my_address;
-				osMessageQueuePut(snd_msg_qID, &packet2, 0, 1000);
+				syncRoster(false);
 			}
 			break;
 
@@ -290,8 +349,11 @@ void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* us
 		case AS_QRMSG :
 
 			bpacket = (query_response_buf_t *) comms_get_payload(comms, msg, sizeof(query_response_buf_t));
-			if(ntoh16(bpacket->shipAddr) == my_address) // Only if I made quiery
+			qaddr = ntoh16(bpacket->shipAddr);
+			// Only if I made quiery, or if it is a broadcast list I have not seen yet
+			if(qaddr == my_address || (qaddr == AM_BROADCAST_ADDR && (ntoh16(bpacket->version) != as_version || as_version == 0)))
 			{
+				as_version = ntoh16(bpacket->version);
 				while(osMutexAcquire(asdb_mutex, 1000) != osOK);
 				for(i=0;i<bpacket->len;i++)
 				{
@@ -305,12 +367,64 @@ void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* us
 		case ACARGO_QRMSG :
 
 			bpacket = (query_response_buf_t *) comms_get_payload(comms, msg, sizeof(query_response_buf_t));
-			while(osMutexAcquire(sddb_mutex, 1000) != osOK);
+			beginGameUpdate(); // Published once for the whole list
 			for(i=0;i<bpacket->len;i++)
 			{
 				markCargo(ntoh16(bpacket->ships[i]));
 			}
-			osMutexRelease(sddb_mutex);
+			endGameUpdate();
+			break;
+
+		case CARGO_MAP_QRMSG :
+
+			mpacket = (cargo_map_msg_t *) rmsg;
+			if(pl_len < offsetof(cargo_map_msg_t, data))break;
+			qaddr = ntoh16(mpacket->shipAddr);
+			// Only if I made quiery, or if it is a broadcast map I have not seen yet
+			if(qaddr == my_address || (qaddr == AM_BROADCAST_ADDR && (ntoh16(mpacket->version) != map_version || map_version == 0)))
+			{
+				map_version = ntoh16(mpacket->version);
+				if(decodeCargoMap(mpacket, pl_len, &all))syncRoster(all); // Slots of the map not known to be right
+			}
+			break;
+
+		case AS_PAGE_QRMSG :
+
+			ppacket = (roster_page_msg_t *) comms_get_payload(comms, msg, sizeof(roster_page_msg_t));
+			if(ntoh16(ppacket->shipAddr) == my_address)handleRosterPage(ppacket); // Pages are always unicast
+			break;
+
+		case DEPART_RMSG :
+
+			packet = (query_response_msg_t *) comms_get_payload(comms, msg, sizeof(query_response_msg_t));
+			qaddr = ntoh16(packet->shipAddr);
+			if(qaddr == my_address)
+			{
+				// Out of the game, what we know of it is stale. Join again for the next game, see SCOREBOARD_MSG
+				info1("Departed cargo %u", packet->isCargoLoaded);
+				clearShips();
+				as_version = map_version = 0;
+			}
+			else 
+			{
+				debug1("Ship %u departed", qaddr);
+				removeShip(qaddr);
+			}
+			break;
+
+		case SCOREBOARD_MSG :
+
+			spacket = (scoreboard_msg_t *) rmsg;
+			if(pl_len < offsetof(scoreboard_msg_t, winners) || pl_len < offsetof(scoreboard_msg_t, winners) + spacket->len * sizeof(am_addr_t))break;
+			if(spacket->first == 0)info1("Game %u over, loaded %u/%u", ntoh16(spacket->gameSeq), ntoh16(spacket->loaded), ntoh16(spacket->ships));
+			for(i=0;i<spacket->len;i++)if(ntoh16(spacket->winners[i]) == my_address)info1("Won");
+			if(spacket->first == 0)
+			{
+				// Every ship has departed, even if our DEPART_RMSG was lost or comes later
+				clearShips();
+				as_version = map_version = 0;
+				osThreadFlagsSet(wmsg_thread, GS_REJOIN_FLAG); // Join the next game
+			}
 			break;
 
 		default:
@@ -330,15 +444,17 @@ static void radioSendDone(comms_layer_t * comms, comms_msg_t * msg, comms_error_
 
 static void sendMsgLoop(void *args)
 {
-	query_msg_t packet;
+	query_page_msg_t packet;
+	uint8_t len;
 	for(;;)
 	{
 		osMessageQueueGet(snd_msg_qID, &packet, NULL, osWaitForever);
 
 		osThreadFlagsWait(0x00000001U, osFlagsWaitAny, osWaitForever); // Flags are automatically cleared
 
+		len = packet.messageID == AS_PAGE_QMSG ? sizeof(query_page_msg_t) : sizeof(query_msg_t);
 		comms_init_message(sradio, &m_msg);
-		query_msg_t * qmsg = comms_get_payload(sradio, &m_msg, sizeof(query_msg_t));
+		query_page_msg_t * qmsg = comms_get_payload(sradio, &m_msg, len);
 		if (qmsg == NULL)
 		{
 			continue ;// Continue for(;;) loop
@@ -346,11 +462,16 @@ static void sendMsgLoop(void *args)
 		qmsg->messageID = packet.messageID;
 		qmsg->senderAddr = hton16(packet.senderAddr);
 		qmsg->shipAddr = hton16(packet.shipAddr);
+		if(packet.messageID == AS_PAGE_QMSG)
+		{
+			qmsg->cursor = hton16(packet.cursor);
+			qmsg->since = hton16(packet.since);
+		}
 
 		// Send data packet
 	    comms_set_packet_type(sradio, &m_msg, AMID_SYSTEMCOMMUNICATION);
 	    comms_am_set_destination(sradio, &m_msg, system_address);
-	    comms_set_payload_length(sradio, &m_msg, sizeof(query_msg_t));
+	    comms_set_payload_length(sradio, &m_msg, len);
 
 	    comms_error_t result = comms_send(sradio, &m_msg, radioSendDone, NULL);
 	    logger(result == COMMS_SUCCESS ? LOG_DEBUG1: LOG_WARN1, "snd %u", result);
@@ -379,6 +500,25 @@ loc_bundle_t getShipLocation(am_addr_t ship_addr)
 	return sloc;
 }
 
+// Returns seconds left until the loading deadline of ship 'ship_addr'. 
+// If no such ship or its deadline has passed, returns 0.
+uint16_t getShipDeadline(am_addr_t ship_addr)
+{
+	uint16_t left = 0;
+	uint32_t now;
+	uint8_t ndx;
+
+	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
+	ndx = getIndex(ship_addr);
+	now = osKernelGetTickCount();
+	if(ndx < MAX_SHIPS && (int32_t)(ships[ndx].deadline_time - now) > 0)
+	{
+		left = (uint16_t)((ships[ndx].deadline_time - now) / osKernelGetTickFreq());
+	}
+	osMutexRelease(sddb_mutex);
+	return left;
+}
+
 // Returns address of ship in location 'sloc' or 0 if no ship in this location.
 am_addr_t getShipAddr(loc_bundle_t sloc)
 {
@@ -424,11 +564,116 @@ void markCargo(am_addr_t addr)
 	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
 	for(i=0;i<MAX_SHIPS;i++)if(ships[i].ship_addr == addr && ships[i].ship_in_game)
 	{
-		ships[i].is_cargo_loaded = true;
+		if(!ships[i].is_cargo_loaded)
+		{
+			ships[i].is_cargo_loaded = true;
+			snapshotChanged();
+		}
 		break;
 	}
 	osMutexRelease(sddb_mutex);
-	info1("Cargo placed %lu", saddr);
+	info1("Cargo placed %u", saddr);
+}
+
+// Asks crane-agent for cargo status of all ships, the answer updates the ship table.
+void requestCargoStatus()
+{
+	query_page_msg_t packet;
+
+	packet.messageID = CARGO_MAP_QMSG;
+	packet.senderAddr = my_address;
+	packet.shipAddr = 0;
+	osMessageQueuePut(snd_msg_qID, &packet, 0, 0);
+}
+
+// Tells crane-agent that this ship leaves the game, see DEPART_RMSG.
+void leaveGame()
+{
+	query_page_msg_t packet;
+
+	packet.messageID = LEAVE_QMSG;
+	packet.senderAddr = my_address;
+	packet.shipAddr = my_address;
+	osMessageQueuePut(snd_msg_qID, &packet, 0, 0);
+}
+
+// Starts a paged roster query pass, for all pages or only for pages changed since the last complete pass.
+static void syncRoster(bool all)
+{
+	uint16_t since;
+
+	while(osMutexAcquire(asdb_mutex, 1000) != osOK);
+	roster_pass_version = 0;
+	since = all ? 0 : roster_version;
+	osMutexRelease(asdb_mutex);
+	requestRosterPage(0, since);
+}
+
+static void requestRosterPage(uint16_t cursor, uint16_t since)
+{
+	query_page_msg_t packet;
+
+	packet.messageID = AS_PAGE_QMSG;
+	packet.senderAddr = my_address;
+	packet.shipAddr = 0;
+	packet.cursor = cursor;
+	packet.since = since;
+	osMessageQueuePut(snd_msg_qID, &packet, 0, 0);
+}
+
+// Input argument is network packet. Queues data queries for ships of the page that are not known
+// yet and asks for the next changed page. The pass is complete when there is no next page, then
+// the roster version of its first page is the version we are up to date with.
+static void handleRosterPage(const roster_page_msg_t* page)
+{
+	uint8_t i;
+	am_addr_t addr;
+	uint16_t next = ntoh16(page->next), first = ntoh16(page->firstSlot), version = ntoh16(page->version), since;
+	bool added = false, dropped = false;
+
+	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
+	while(osMutexAcquire(asdb_mutex, 1000) != osOK);
+	if(roster_pass_version == 0)roster_pass_version = version;
+	if(first != ROSTER_END)for(i=0;i<ROSTER_PAGE_SLOTS;i++)
+	{
+		addr = ntoh16(page->ships[i]);
+		if(addr != 0 && getIndex(addr) >= MAX_SHIPS)
+		{
+			addShipAddr(addr);
+			added = true;
+		}
+	}
+	// Check the slots of known ships against the page, a ship not in its slot has departed
+	if(first != ROSTER_END)for(i=0;i<MAX_SHIPS;i++)
+	{
+		if(!ships[i].ship_in_game || ships[i].slot < first || ships[i].slot - first >= ROSTER_PAGE_SLOTS)continue;
+		if(ships[i].slot_version != 0 && (int16_t)(version - ships[i].slot_version) < 0)continue; // Page is older
+		if(ntoh16(page->ships[ships[i].slot - first]) == ships[i].ship_addr)ships[i].slot_version = version;
+		else
+		{
+			debug1("Ship %u not in slot %u", ships[i].ship_addr, ships[i].slot);
+			ships[i].ship_in_game = false;
+			dropped = true;
+		}
+	}
+	since = roster_version;
+	if(next == ROSTER_END)
+	{
+		// Pages not changed since the last pass still hold the slots known right then
+		if(since != 0)for(i=0;i<MAX_SHIPS;i++)if(ships[i].ship_in_game && ships[i].slot_version == since)
+		{
+			ships[i].slot_version = roster_pass_version;
+		}
+		roster_version = roster_pass_version;
+		roster_pass_version = 0;
+	}
+	osMutexRelease(asdb_mutex);
+	if(dropped)snapshotChanged();
+	osMutexRelease(sddb_mutex);
+	debug1("Roster page %u next %u v%u", ntoh16(page->firstSlot), next, ntoh16(page->version));
+
+	if(added)osEventFlagsSet(evt_id, 0x00000001U); // Trigger getAllShipsData() task
+	if(next != ROSTER_END)requestRosterPage(next, since);
 }
 
 // Returns cargo status of ship 'ship_addr'. Possible return values:
@@ -449,6 +694,117 @@ cargo_status_t getCargoStatus(am_addr_t ship_addr)
 	return stat;
 }
 
+// Copies the latest game snapshot to 'snap' without taking locks, see module description.
+void getGameSnapshot(game_snapshot_t* snap)
+{
+	uint32_t seq;
+	uint8_t b;
+
+	do
+	{
+		b = __atomic_load_n(&snap_current, __ATOMIC_ACQUIRE);
+		seq = __atomic_load_n(&snap_buf[b].seq, __ATOMIC_ACQUIRE);
+		memcpy(snap, &snap_buf[b].snap, sizeof(game_snapshot_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	}
+	while((seq & 1) || __atomic_load_n(&snap_buf[b].seq, __ATOMIC_RELAXED) != seq); // Written meanwhile
+}
+
+// Sets crane state of game snapshots to 'crane' of round 'seq' and publishes a snapshot.
+void setSnapshotCrane(crane_location_t crane, uint16_t seq)
+{
+	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
+	snap_crane = crane;
+	snap_crane_seq = seq;
+	snapshotChanged();
+	osMutexRelease(sddb_mutex);
+}
+
+// Empties the ship table, the addresses waiting for a data query and the game snapshot.
+static void clearShips()
+{
+	uint8_t i;
+
+	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
+	for(i=0;i<MAX_SHIPS;i++)
+	{
+		ships[i].ship_in_game = false;
+		ships[i].ship_addr = 0;
+		ships[i].ship_deadline = 0;
+		ships[i].deadline_time = 0;
+		ships[i].x_coordinate = 0;
+		ships[i].y_coordinate = 0;
+		ships[i].is_cargo_loaded = false;
+		ships[i].slot = 0;
+		ships[i].slot_version = 0;
+	}
+	snap_crane.crane_x = snap_crane.crane_y = 0;
+	snap_crane.cargo_here = false;
+	snap_crane_seq = 0;
+	snapshotChanged();
+	osMutexRelease(sddb_mutex);
+
+	while(osMutexAcquire(asdb_mutex, 1000) != osOK);
+	for(i=0;i<MAX_SHIPS;i++)
+	{
+		ship_addr[i] = 0;
+	}
+	roster_version = roster_pass_version = 0;
+	osMutexRelease(asdb_mutex);
+}
+
+// Starts an update of the ship table and crane state, changes made until the matching endGameUpdate
+// are published in one snapshot. Updates nest. Holds sddb_mutex until endGameUpdate.
+void beginGameUpdate()
+{
+	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
+	snap_batch++;
+}
+
+// Ends an update started with beginGameUpdate, the outermost one publishes the changes made in it.
+void endGameUpdate()
+{
+	if(--snap_batch == 0 && snap_dirty)publishSnapshot();
+	osMutexRelease(sddb_mutex);
+}
+
+// Publishes a change of the ship table or crane state now, or at the end of the open update.
+// Must be called with sddb_mutex held.
+static void snapshotChanged()
+{
+	if(snap_batch > 0)snap_dirty = true;
+	else publishSnapshot();
+}
+
+// Publishes a snapshot of the ship table and crane state, must be called with sddb_mutex held.
+static void publishSnapshot()
+{
+	snapshot_buf_t* buf = &snap_buf[snap_current ^ 1];
+	game_snapshot_t* snap = &buf->snap;
+	uint8_t i;
+
+	__atomic_store_n(&buf->seq, buf->seq + 1, __ATOMIC_RELAXED); // Odd, readers of this buffer retry
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snap_dirty = false;
+	snap->version = ++snap_version;
+	snap->crane = snap_crane;
+	snap->crane_seq = snap_crane_seq;
+	snap->len = 0;
+	for(i=0;i<MAX_SHIPS;i++)if(ships[i].ship_in_game)
+	{
+		snap->ships[snap->len].addr = ships[i].ship_addr;
+		snap->ships[snap->len].loc.x = ships[i].x_coordinate;
+		snap->ships[snap->len].loc.y = ships[i].y_coordinate;
+		snap->ships[snap->len].cargo = ships[i].is_cargo_loaded;
+		snap->ships[snap->len].deadline_time = ships[i].deadline_time;
+		snap->len++;
+	}
+
+	__atomic_store_n(&buf->seq, buf->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&snap_current, snap_current ^ 1, __ATOMIC_RELEASE);
+}
+
 static uint8_t getEmptySlot()
 {
 	uint8_t k;
@@ -486,10 +842,30 @@ static void addShipAddr(am_addr_t addr)
 	else ; // This ship is already in database
 }
 
+// Drops departed ship 'addr' from ship table and from the addresses waiting for a data query.
+static void removeShip(am_addr_t addr)
+{
+	uint8_t i;
+
+	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
+	i = getIndex(addr);
+	if(i < MAX_SHIPS)
+	{
+		ships[i].ship_in_game = false;
+		snapshotChanged();
+	}
+	osMutexRelease(sddb_mutex);
+
+	while(osMutexAcquire(asdb_mutex, 1000) != osOK);
+	for(i=0;i<MAX_SHIPS;i++)if(ship_addr[i] == addr)ship_addr[i] = 0;
+	osMutexRelease(asdb_mutex);
+}
+
 // Input argument is network packet, so use ntoh functions to read values
 static void addShip(query_response_msg_t* ship)
 {
 	uint8_t ndx;
+	uint16_t v;
 	
 	ndx = getIndex(ntoh16(ship->shipAddr));
 	if(ndx >= MAX_SHIPS)
@@ -500,14 +876,72 @@ static void addShip(query_response_msg_t* ship)
 			ships[ndx].ship_in_game = true;
 			ships[ndx].ship_addr = ntoh16(ship->shipAddr);
 			ships[ndx].ship_deadline = ntoh16(ship->loadingDeadline);
+			ships[ndx].deadline_time = osKernelGetTickCount() + ships[ndx].ship_deadline * osKernelGetTickFreq();
 			ships[ndx].x_coordinate = ship->x_coordinate;
 			ships[ndx].y_coordinate = ship->y_coordinate;
 			ships[ndx].is_cargo_loaded = ship->isCargoLoaded;
+			ships[ndx].slot = ntoh16(ship->slot);
+			ships[ndx].slot_version = ntoh16(ship->rosterVersion);
 		}
 		else ; // No room
 	}
-	else // Already got this ship, update only cargo status
+	else // Already got this ship, update only cargo status and how recent its slot is
 	{
 		ships[ndx].is_cargo_loaded = ship->isCargoLoaded;
+		v = ntoh16(ship->rosterVersion);
+		if(ships[ndx].slot == ntoh16(ship->slot) && v != 0 && (ships[ndx].slot_version == 0 || (int16_t)(v - ships[ndx].slot_version) > 0))
+		{
+			ships[ndx].slot_version = v;
+		}
+	}
+	snapshotChanged();
+}
+
+// Input argument is network packet of payload length 'len', see cargo_map_msg_t.
+// Marks cargo of known ships whose cargo bit is set. Only ships whose slot is known to be
+// right at the roster version of the map are marked, slots are given out again after departures.
+// Returns true if the roster should be synced, then 'all' tells if all pages are needed: if the 
+// map has more ships than are known or slots are not known to be right at the last roster pass.
+static bool decodeCargoMap(const cargo_map_msg_t* map, uint8_t len, bool* all)
+{
+	const uint8_t* bits;
+	uint16_t first, count, bit = 0, known = 0, stale = 0, b, v, rv = ntoh16(map->rosterVersion), pass;
+	uint8_t r, i, bytes;
+	bool room, old = false;
+
+	if(len < offsetof(cargo_map_msg_t, data) + 4 * map->rangeCount)return false; // Truncated
+	bits = &map->data[4 * map->rangeCount];
+	bytes = len - offsetof(cargo_map_msg_t, data) - 4 * map->rangeCount;
+
+	while(osMutexAcquire(sddb_mutex, 1000) != osOK);
+	while(osMutexAcquire(asdb_mutex, 1000) != osOK);
+	pass = roster_version;
+	osMutexRelease(asdb_mutex);
+	for(r=0;r<map->rangeCount;r++)
+	{
+		memcpy(&v, &map->data[4 * r], sizeof(v));
+		first = ntoh16(v);
+		memcpy(&v, &map->data[4 * r + 2], sizeof(v));
+		count = ntoh16(v);
+		for(i=0;i<MAX_SHIPS;i++)if(ships[i].ship_in_game && ships[i].slot >= first && ships[i].slot - first < count)
+		{
+			if(ships[i].slot_version != rv)
+			{
+				stale++;
+				if(ships[i].slot_version != pass)old = true; // Not brought up to date by a pass of changed pages
+				continue;
+			}
+			b = bit + ships[i].slot - first;
+			if(b / 8 < bytes && (bits[b / 8] & (1 << (b % 8))))ships[i].is_cargo_loaded = true;
+			known++;
+		}
+		bit += count;
 	}
+	room = getEmptySlot() < MAX_SHIPS;
+	snapshotChanged();
+	osMutexRelease(sddb_mutex);
+	debug1("Cargo map v%u r%u %u/%u", ntoh16(map->version), rv, known, bit);
+
+	*all = old || (bit > known + stale && room);
+	return *all || stale > 0;
 }
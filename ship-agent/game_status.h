@@ -17,6 +17,23 @@ typedef enum {
     cs_unknown_ship_addr
 } cargo_status_t;
 
+// Ship in a game snapshot, see getGameSnapshot
+typedef struct {
+	am_addr_t addr;
+	loc_bundle_t loc;
+	bool cargo;				// Cargo has been received
+	uint32_t deadline_time;	// Loading deadline, kernel ticks
+} snapshot_ship_t;
+
+// Ship table and crane state at one moment, see getGameSnapshot
+typedef struct {
+	uint32_t version;		// Changes with every update of the ship table or crane state
+	crane_location_t crane;	// Crane state of the last crane location message, see setSnapshotCrane
+	uint16_t crane_seq;		// Round of 'crane'
+	uint8_t len;			// Number of ships in 'ships'
+	snapshot_ship_t ships[MAX_SHIPS]; // Ships in the game, own ship included
+} game_snapshot_t;
+
 /**********************************************************************************************
  *	Initialise module
  **********************************************************************************************/
@@ -36,6 +53,10 @@ void systemReceiveMessage(comms_layer_t* comms, const comms_msg_t* msg, void* us
 // Returns location of ship, if no such ship, returns 0 for both coordinates.
 loc_bundle_t getShipLocation(am_addr_t ship_addr);
 
+// Returns seconds left until the loading deadline of ship 'ship_addr'. 
+// If no such ship or its deadline has passed, returns 0.
+uint16_t getShipDeadline(am_addr_t ship_addr);
+
 // Marks cargo status as true for ship with address 'addr', if such a ship is found.
 // Use with care! There is no revers command to mark cargo status false.
 void markCargo(am_addr_t addr);
@@ -47,6 +68,30 @@ uint8_t  getAllShipsAddr(am_addr_t saddr[], uint8_t mlen);
 // Returns address of ship in location 'sloc' or 0 if no ship in this location.
 am_addr_t getShipAddr(loc_bundle_t sloc);
 
+// Asks crane-agent for cargo status of all ships, the answer updates the ship table.
+void requestCargoStatus();
+
+// Leaves the game. Crane-agent frees the registration slot of this ship and
+// broadcasts the departure, until then the ship is still in the game.
+void leaveGame();
+
+// Copies the latest game snapshot to 'snap'. The snapshot is published once per update of the 
+// ship table or crane state, so it is consistent and reading it takes no locks. Use it instead of 
+// a series of the functions above when deciding on several ships.
+void getGameSnapshot(game_snapshot_t* snap);
+
+// Sets crane state of game snapshots to 'crane' of round 'seq' and publishes a snapshot.
+// Called by crane control module when a crane location message is received.
+void setSnapshotCrane(crane_location_t crane, uint16_t seq);
+
+// Starts an update of the ship table and crane state, changes made until the matching 
+// endGameUpdate (e.g. markCargo, setSnapshotCrane) are published in one snapshot. 
+// Updates nest. Blocks other updates until endGameUpdate, so keep it short.
+void beginGameUpdate();
+
+// Ends an update started with beginGameUpdate and publishes the changes made in it.
+void endGameUpdate();
+
 // Returns cargo status of ship 'ship_addr'. Possible return values:
 // cs_cargo_received - cargo has been received, cargo present
 // cs_cargo_not_received - cargo has not been received, cargo not present